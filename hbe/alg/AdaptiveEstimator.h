@@ -4,10 +4,62 @@
 
 #include <Eigen/Dense>
 #include "mathUtils.h"
+#include "QueryTrace.h"
+#include "RunningStats.h"
 #include <chrono>
+#include <functional>
+#include <stdexcept>
 
+using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
+///
+/// Limits for AdaptiveEstimator::queryWithin; 0 means no limit.
+///
+struct QueryBudget {
+    ///
+    /// Wall-clock time, checked every CHECK_INTERVAL samples
+    ///
+    long nanos = 0;
+
+    ///
+    /// Number of samples drawn over all levels
+    ///
+    long samples = 0;
+
+    ///
+    /// Failure probability of the returned confidence interval
+    ///
+    double delta = 0.05;
+
+    static const int CHECK_INTERVAL = 4;
+};
+
+///
+/// Result of AdaptiveEstimator::queryWithin.
+///
+struct AnytimeEstimate {
+    ///
+    /// Mean of the level's samples, which the confidence interval is centred on
+    ///
+    double estimate = 0;
+    double samples = 0;
+    ///
+    /// Level the estimate comes from
+    ///
+    int level = 0;
+    ///
+    /// Empirical Bernstein interval around the mean of the level's samples, holding the density with
+    /// probability at least 1 - delta
+    ///
+    double lower = 0;
+    double upper = 0;
+    ///
+    /// Whether the adaptive walk finished within the budget
+    ///
+    bool complete = false;
+};
+
 ///
 /// Base class for the adaptive sampling procedure.
 /// Subclasses can be implemented via estimators like HBE and RS.
@@ -16,19 +68,53 @@ class AdaptiveEstimator {
 public:
     double totalTime = 0;
 
+    virtual ~AdaptiveEstimator() {}
+
     ///
     /// Estimate density of query q via adaptively sampling.
     ///
     std::vector<double> query(VectorXd q) {
+        return query(q, nullptr);
+    }
+
+    ///
+    /// Estimate density of query q via adaptively sampling, recording what each level did.
+    /// \param q query
+    /// \param trace trace to fill in, or nullptr to disable tracing
+    /// \return estimate, number of samples and the level the query stopped at
+    std::vector<double> query(VectorXd q, QueryTrace* trace) {
         auto t1 = std::chrono::high_resolution_clock::now();
-        std::vector<double> returns(2, 0);
+        std::vector<double> returns = estimate(q, trace);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count();
+        totalTime += elapsed;
+        if (trace != nullptr) { trace->totalNanos = elapsed; }
+        return returns;
+    }
+
+    ///
+    /// Same as query(), without updating totalTime; safe to call from several threads.
+    /// \param q query
+    /// \param trace trace to fill in, or nullptr to disable tracing
+    /// \return estimate, number of samples and the level the query stopped at
+    virtual std::vector<double> estimate(VectorXd q, QueryTrace* trace) {
+        std::vector<double> returns(3, 0);
         double est = 0;
         int i = 0;
+        if (trace != nullptr) { trace->clear(); }
         while (i < I) {
-            std::vector<double> results = evaluateQuery(q, i);
+            LevelTrace* level = nullptr;
+            if (trace != nullptr) {
+                trace->levels.push_back(LevelTrace());
+                level = &trace->levels.back();
+                level->level = i;
+                level->target = mui[i];
+            }
+            std::vector<double> results = evaluateQuery(q, i, level);
             est = results[0];
             returns[1] += results[1];
-//            std::cout << "Level: " << i << ", est: "<< est << ", target: "<< mui[i] << std::endl;
+            returns[2] = i;
+            if (level != nullptr) { level->estimate = est; }
             if (est >= mui[i] || L * Mi[i] > numPoints) {
                 break;
             } else {
@@ -37,11 +123,150 @@ public:
             }
         }
         returns[0] = est;
-        auto t2 = std::chrono::high_resolution_clock::now();
-        totalTime += std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count();
+        if (trace != nullptr) {
+            trace->estimate = est;
+            trace->samples = returns[1];
+        }
         return returns;
     }
 
+    /// Level-synchronous estimate() for a block of queries, for offline scoring. Each round takes the
+    /// lowest level any unfinished query is at and evaluates all queries at that level together
+    /// (evaluateBatch), so that estimators can share the work of a level across queries. Queries then
+    /// stop or move on exactly as in estimate(). Safe to call from several threads.
+    /// \param Q queries, one per row
+    /// \return estimate, number of samples and stopping level of each query
+    virtual std::vector<std::vector<double>> estimateBatch(const MatrixXd& Q) {
+        int n = Q.rows();
+        std::vector<std::vector<double>> returns(n, std::vector<double>(3, 0));
+        std::vector<int> level(n, 0);
+        std::vector<int> active(n);
+        for (int j = 0; j < n; j ++) { active[j] = j; }
+        while (!active.empty()) {
+            int i = I;
+            for (int j : active) { i = std::min(i, level[j]); }
+            std::vector<int> block, rest;
+            for (int j : active) { (level[j] == i ? block : rest).push_back(j); }
+
+            std::vector<std::vector<double>> results = evaluateBatch(Q, block, i);
+            for (size_t b = 0; b < block.size(); b ++) {
+                int j = block[b];
+                double est = results[b][0];
+                returns[j][0] = est;
+                returns[j][1] += results[b][1];
+                returns[j][2] = i;
+                if (est >= mui[i] || L * Mi[i] > numPoints) { continue; }
+                int k = (int) floor(log(est) / log(1 - gamma));
+                level[j] = std::max(k, i + 1);
+                if (level[j] < I) { rest.push_back(j); }
+            }
+            active = rest;
+        }
+        return returns;
+    }
+
+    ///
+    /// \return number of levels
+    int levels() const { return I; }
+
+    ///
+    /// Stop sampling a level as soon as an empirical Bernstein bound certifies its estimate
+    /// (RunningStats::sequentialMoM), instead of always drawing L * Mi samples.
+    /// \param delta failure probability per level (0: fixed-size median of means)
+    void setSequential(double delta) { seqDelta = delta; }
+
+    /// Anytime version of estimate(): walk the levels as estimate() does, drawing samples one at a time,
+    /// and stop when the budget runs out. The estimate then comes from the current level if it has
+    /// enough samples, otherwise from the last completed one: the mean of its samples, with a confidence
+    /// interval around it. Safe to call from several threads.
+    /// \param q query
+    /// \param budget time and sample limits
+    /// \return estimate, samples, level and confidence interval
+    AnytimeEstimate queryWithin(VectorXd q, const QueryBudget& budget) {
+        typedef std::chrono::steady_clock Clock;
+        // Fewer samples than this at the current level: report the previous level instead
+        const long MIN_SAMPLES = 16;
+        auto deadline = Clock::now() + std::chrono::nanoseconds(budget.nanos);
+        AnytimeEstimate result;
+        RunningStats last;
+        int lastLevel = -1;
+        long used = 0;
+        int i = 0;
+        while (i < I) {
+            std::function<double()> sample = levelSampler(q, i, nullptr);
+            RunningStats stats;
+            std::vector<double> Z(L, 0);
+            long total = (long) L * Mi[i];
+            bool exhausted = false;
+            for (long j = 0; j < total; j ++) {
+                if ((budget.samples > 0 && used >= budget.samples) || (budget.nanos > 0 &&
+                        used % QueryBudget::CHECK_INTERVAL == 0 && Clock::now() >= deadline)) {
+                    exhausted = true;
+                    break;
+                }
+                double x = sample();
+                stats.add(x);
+                Z[j / Mi[i]] += x;
+                used ++;
+            }
+            if (exhausted) {
+                if (stats.count() >= MIN_SAMPLES || lastLevel < 0) {
+                    last = stats;
+                    lastLevel = i;
+                }
+                break;
+            }
+
+            // The median of means decides the walk; the reported estimate is the mean, as the interval
+            // bounds it
+            double est = mathUtils::median(Z) / Mi[i];
+            last = stats;
+            lastLevel = i;
+            if (est >= mui[i] || L * Mi[i] > numPoints) {
+                result.complete = true;
+                break;
+            }
+            int k = (int) floor(log(est) / log(1 - gamma));
+            i = std::max(k, i + 1);
+            // Running off the last level ends the walk, as in estimate()
+            result.complete = i >= I;
+        }
+        result.samples = used;
+        result.level = std::max(lastLevel, 0);
+        if (last.count() > 0) {
+            result.estimate = last.mean();
+            double radius = last.bernstein(sampleRange(result.level), budget.delta);
+            result.lower = std::max(0.0, last.mean() - radius);
+            result.upper = last.mean() + radius;
+        } else {
+            result.upper = sampleRange(0);
+        }
+        return result;
+    }
+
+    /// Decide whether the density of q is at least t, for classification (e.g. outlier flags) rather
+    /// than estimation. Samples come from the first level sized for densities down to t, and sampling
+    /// stops as soon as a confidence interval excludes t (RunningStats::sequentialTest), so queries far
+    /// from the threshold cost a few samples instead of a full adaptive walk. Once the level's L * Mi
+    /// samples are drawn, its mean decides. Safe to call from several threads.
+    /// \param q query
+    /// \param t density threshold
+    /// \param delta probability that a certain decision is wrong
+    /// \return decision, estimate, samples drawn and confidence interval
+    ThresholdDecision isAbove(VectorXd q, double t, double delta) {
+        int level = thresholdLevel(t);
+        std::function<double()> sample = levelSampler(q, level, nullptr);
+        return RunningStats::sequentialTest(sample, (long) L * Mi[level], t, delta, sampleRange(level));
+    }
+
+    ///
+    /// \return level isAbove() samples from for threshold t
+    int thresholdLevel(double t) const {
+        int level = 0;
+        while (level < I - 1 && mui[level] > t) { level ++; }
+        return level;
+    }
+
     void setMedians(int l) { L = l; }
 
 protected:
@@ -61,6 +286,16 @@ protected:
     ///
     int L = 3;
 
+    ///
+    /// Relative error the levels are sized for
+    ///
+    double levelEps = 0;
+
+    ///
+    /// Failure probability of a sequential level (0: fixed-size median of means)
+    ///
+    double seqDelta = 0;
+
     ///
     /// target density of the level i
     ///
@@ -91,8 +326,38 @@ protected:
     std::string EXP_STR = "exp";
     ///
     /// For subclasses to implement: evaluate density of query q at the given level.
+    /// If trace is not nullptr, record probes, samples and time spent at the level in it.
+    ///
+    virtual std::vector<double> evaluateQuery(VectorXd q, int level, LevelTrace* trace) = 0;
+
+    ///
+    /// Evaluate the given rows of Q at the same level, for estimateBatch(). Subclasses that can share
+    /// work across queries override this; by default each query is evaluated on its own.
+    /// \return estimate and number of samples of each query in rows
     ///
-    virtual std::vector<double> evaluateQuery(VectorXd q, int level) = 0;
+    virtual std::vector<std::vector<double>> evaluateBatch(const MatrixXd& Q, const std::vector<int>& rows,
+            int level) {
+        std::vector<std::vector<double>> results;
+        for (int j : rows) {
+            results.push_back(evaluateQuery(Q.row(j), level, nullptr));
+        }
+        return results;
+    }
+
+    ///
+    /// For subclasses supporting sequential and anytime estimation: a function drawing i.i.d. samples
+    /// of the given level's estimator one at a time. It may refer to the estimator and to trace.
+    ///
+    virtual std::function<double()> levelSampler(const VectorXd&, int, LevelTrace*) {
+        throw std::logic_error("This estimator cannot draw samples one at a time");
+    }
+
+    ///
+    /// Upper bound on the samples levelSampler() draws at the given level (they are non-negative).
+    ///
+    virtual double sampleRange(int) {
+        throw std::logic_error("This estimator cannot draw samples one at a time");
+    }
 };
 
 
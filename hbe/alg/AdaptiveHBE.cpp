@@ -2,8 +2,8 @@
 #include "dataUtils.h"
 #include "SketchTable.h"
 
-void AdaptiveHBE::buildLevels(shared_ptr<MatrixXd> X, shared_ptr<Kernel> k, double tau, double eps,
-        bool sketch) {
+void AdaptiveHBE::setLevelParams(shared_ptr<Kernel> k, double tau, double eps, double diam,
+        const HBEOptions& opts) {
     double tmp = log(1/ tau);
     // Effective diameter
     r = sqrt(tmp);
@@ -14,18 +14,11 @@ void AdaptiveHBE::buildLevels(shared_ptr<MatrixXd> X, shared_ptr<Kernel> k, doub
     ti = vector<double>(I);
     ki = vector<int>(I);
     wi = vector<double>(I);
-    int n = X->rows();
-    int N_SKETCHES = 5;
-    int samples = int(sqrt(n));
-    double diam = dataUtils::estimateDiameter(X, tau);
+    relVar = vector<double>(I);
+    levelEps = eps;
     double exp_k = dataUtils::getPower(diam, 0.5);
     double exp_w = dataUtils::getWidth(exp_k, 0.5);
 
-    //Will be used to obtain a seed for the random number engine
-    std::random_device rd;
-    std::mt19937_64 rng(rd());
-
-    int ntables = 0;
     for (int i = 0; i < I; i ++) {
         if (i == 0) {
             mui[i] = (1 - gamma);
@@ -42,58 +35,401 @@ void AdaptiveHBE::buildLevels(shared_ptr<MatrixXd> X, shared_ptr<Kernel> k, doub
             ki[i] = (int) (3 * ceil(r * ti[i]));
             wi[i] = ki[i] / ti[i] * SQRT_2PI;
         }
-        Mi[i] = (int) (ceil(k->RelVar(mui[i]) / eps / eps));
-        ntables += Mi[i];
+        if (i < (int) opts.hashK.size() && i < (int) opts.hashW.size()) {
+            ki[i] = opts.hashK[i];
+            wi[i] = opts.hashW[i];
+        }
+        relVar[i] = i < (int) opts.relVar.size() ? opts.relVar[i] : k->RelVar(mui[i]);
+        Mi[i] = hashSamples(i, eps);
+    }
+}
+
+int AdaptiveHBE::hashSamples(int level, double eps) {
+    double reduction = probes > 1 ? probeGain : 1;
+    return (int) (ceil(relVar[level] / eps / eps / reduction));
+}
+
+IndexMemory AdaptiveHBE::planMemory(int n, int d) {
+    IndexMemory plan;
+    int samples = int(sqrt(n));
+    // UniformHBE builds each table on a subsample of sqrt(n) points
+    int points = (samples > 1 && samples < n) ? samples : n;
+    if (use_sketch) {
+        long ntables = 0;
+        for (int i = 0; i < I; i ++) { ntables += Mi[i]; }
+        int m = (int) min(ntables * samples, 2L * n);
+        int per_sketch = m / N_SKETCHES;
+        if (pyramid) {
+            plan.sketch = SketchPyramid::estimateMemory(per_sketch, d, ki);
+        } else {
+            plan.sketch = SketchTable::estimateMemory(per_sketch, d, ki[I - 1]);
+        }
+        plan.sketch.samples += heapBytes(per_sketch * sizeof(int));
+        plan.sketch *= N_SKETCHES;
+        // One downsampled copy of the data is alive while a sketch is built
+        plan.sketch.samples += heapBytes(size_t(per_sketch) * d * sizeof(double));
+        // SketchHBE builds each table on sqrt(m / N_SKETCHES) samples of a sketch
+        points = int(sqrt(per_sketch));
+    }
+
+    for (int i = 0; i < I; i ++) {
+        int t = int(Mi[i] * L * 1.1);
+        if (use_sketch) { t = t / N_SKETCHES * N_SKETCHES; }
+        MemoryUsage level = HashTable::estimateMemory(points, d, ki[i], use_sketch);
+        level *= t;
+        plan.levels.push_back(level);
+    }
+    return plan;
+}
+
+void AdaptiveHBE::applyBudget(IndexMemory& plan, size_t budget, double eps) {
+    size_t used = plan.sketch.total();
+    for (int i = 0; i < I; i ++) {
+        MemoryUsage& level = plan.levels[i];
+        if (rsLevel == I) {
+            size_t per_table = level.total() / max(level.tables, 1);
+            size_t left = budget > used ? budget - used : 0;
+            int fit = (int) min(size_t(level.tables), left / max(per_table, size_t(1)));
+            if (use_sketch) { fit = fit / N_SKETCHES * N_SKETCHES; }
+            // A query draws its L * Mi samples from distinct tables. With fewer tables it would reuse
+            // some of them, its samples would no longer be independent and Mi would not bound the
+            // variance, so such a level is answered by random sampling instead.
+            if (fit >= max(L * Mi[i], N_SKETCHES)) {
+                MemoryUsage capped;
+                capped.tables = 1;
+                capped.hashing = level.hashing / level.tables;
+                capped.buckets = level.buckets / level.tables;
+                capped.samples = level.samples / level.tables;
+                capped *= fit;
+                level = capped;
+                used += level.total();
+                continue;
+            }
+            rsLevel = i;
+        }
+        level = MemoryUsage();
+        Mi[i] = (int) (ceil(mathUtils::randomRelVar(mui[i]) / eps / eps));
     }
+    if (rsLevel == 0) { plan.sketch = MemoryUsage(); }
+}
+
+void AdaptiveHBE::buildLevels(shared_ptr<MatrixXd> X, shared_ptr<Kernel> k, double tau, double eps,
+        bool sketch, const HBEOptions& opts) {
+    int n = X->rows();
+    int samples = int(sqrt(n));
+    probes = max(1, opts.probes);
+    probeGain = max(1.0, opts.probeGain);
+    pyramid = opts.pyramid;
+    keepBelowTau = opts.keepBelowTau;
+    setLevelParams(k, tau, eps, dataUtils::estimateDiameter(X, tau), opts);
 
-    if (sketch) { // HBS
-        int m = min(ntables * samples, 2*n);
-        vector<SketchTable> sketches;
-        vector<vector<int>> indices;
+    long ntables = 0;
+    for (int i = 0; i < I; i ++) { ntables += Mi[i]; }
+    rsLevel = I;
+    IndexMemory plan = planMemory(n, X->cols());
+    if (opts.memoryBudget > 0) {
+        applyBudget(plan, opts.memoryBudget, eps);
+    }
+
+    sketchPoints = (int) (min(ntables * samples, 2L * n) / N_SKETCHES);
+    subsample = samples;
+    for (int i = 0; i < rsLevel; i ++) { levelTables.push_back(plan.levels[i].tables); }
+    if (sketch) {
+        s_levels = vector<SketchHBE>(rsLevel);
+    } else {
+        u_levels = vector<UniformHBE>(rsLevel);
+    }
+    levelRange = vector<double>(I, kernel->dimFactor * kernel->bwFactor);
+    built.reset(new std::atomic<bool>[rsLevel]);
+    for (int i = 0; i < rsLevel; i ++) { built[i] = false; }
+    levelsLeft = rsLevel;
+
+    if (!opts.lazy) {
+        for (int i = 0; i < rsLevel; i ++) { buildLevel(i); }
+    } else if (opts.prewarm) {
+        prewarming = true;
+        prewarmer = std::thread([this] {
+            for (int i = 0; i < rsLevel && !stopping; i ++) {
+                std::lock_guard<std::mutex> guard(buildLock);
+                if (!built[i]) { buildLevel(i); }
+            }
+        });
+    }
+}
+
+void AdaptiveHBE::buildSketches() {
+    sketchesBuilt = true;
+    if (pyramid) { // Multi-resolution HBS
+        vector<double> w(wi.begin(), wi.begin() + rsLevel);
+        vector<int> kk(ki.begin(), ki.begin() + rsLevel);
         for (int i = 0; i < N_SKETCHES; i ++ ){
             std::vector<int> idx;
-            shared_ptr<MatrixXd> X1 = dataUtils::downSample(X, idx, m/N_SKETCHES, rng);
+            shared_ptr<MatrixXd> X1 = cdf.empty() ? dataUtils::downSample(X, idx, sketchPoints, rng)
+                    : dataUtils::downSample(X, cdf, idx, sketchPoints, rng);
+            pyramids.push_back(SketchPyramid(X1, w, kk, rng));
+            sketchIndices.push_back(idx);
+            sketchMemory += pyramids.back().memoryUsage();
+            sketchMemory.samples += heapBytes(idx.capacity() * sizeof(int));
+        }
+    } else { // HBS
+        for (int i = 0; i < N_SKETCHES; i ++ ){
+            std::vector<int> idx;
+            shared_ptr<MatrixXd> X1 = cdf.empty() ? dataUtils::downSample(X, idx, sketchPoints, rng)
+                    : dataUtils::downSample(X, cdf, idx, sketchPoints, rng);
             sketches.push_back(SketchTable(X1, wi[I-1], ki[I-1], rng));
-            indices.push_back(idx);
+            sketchIndices.push_back(idx);
+            sketchMemory += sketches.back().memoryUsage();
+            sketchMemory.samples += heapBytes(idx.capacity() * sizeof(int));
         }
+    }
+}
 
-        for (int i = 0; i < I; i ++) {
-            int t = int(Mi[i] * L * 1.1);
-            s_levels.push_back(SketchHBE(X, sketches, indices, t, wi[i], ki[i], k, rng));
-        }
-    } else { // Uniform
-        for (int i = 0; i < I; i ++) {
-            int t = int(Mi[i] * L * 1.1);
-            u_levels.push_back(UniformHBE(X, t, wi[i], ki[i], k, samples));
+void AdaptiveHBE::buildLevel(int i) {
+    if (use_sketch) {
+        if (!sketchesBuilt) { buildSketches(); }
+        if (pyramid) {
+            // Each level's sketches are only sampled from once
+            vector<SketchTable> level;
+            for (auto& p : pyramids) { level.push_back(std::move(p.levels[i])); }
+            s_levels[i] = SketchHBE(X, level, sketchIndices, levelTables[i], wi[i], ki[i], kernel, rng);
+        } else {
+            s_levels[i] = SketchHBE(X, sketches, sketchIndices, levelTables[i], wi[i], ki[i], kernel, rng);
         }
+        s_levels[i].setProbes(probes);
+        if (retargeted) { s_levels[i].setActiveTables(int(Mi[i] * L * 1.1)); }
+        levelRange[i] = s_levels[i].sampleBound();
+    } else {
+        u_levels[i] = UniformHBE(X, weights, levelTables[i], wi[i], ki[i], kernel, subsample);
+        u_levels[i].setProbes(probes);
+        if (retargeted) { u_levels[i].setActiveTables(int(Mi[i] * L * 1.1)); }
+        levelRange[i] = u_levels[i].sampleBound();
     }
+    built[i].store(true, std::memory_order_release);
+
+    // The sketches are only needed to build levels
+    if (-- levelsLeft == 0) {
+        vector<SketchTable>().swap(sketches);
+        vector<SketchPyramid>().swap(pyramids);
+        vector<vector<int>>().swap(sketchIndices);
+    }
+}
+
+bool AdaptiveHBE::ensureLevel(int level, bool wait) {
+    if (built[level].load(std::memory_order_acquire)) { return true; }
+    std::unique_lock<std::mutex> guard(buildLock, std::defer_lock);
+    if (wait) {
+        guard.lock();
+    } else if (prewarming || !guard.try_lock()) {
+        // Leave the building to the prewarmer, queries should not wait for it
+        return false;
+    }
+    if (!built[level].load(std::memory_order_relaxed)) { buildLevel(level); }
+    return true;
+}
+
+bool AdaptiveHBE::distinctTables(int level) const {
+    int window = use_sketch ? s_levels[level].window() : u_levels[level].window();
+    return window >= (long) L * Mi[level];
 }
 
+int AdaptiveHBE::builtLevels() const {
+    int n = 0;
+    for (int i = 0; i < rsLevel; i ++) { n += built[i].load(std::memory_order_acquire); }
+    return n;
+}
+
+int AdaptiveHBE::rsSamples(int level) const {
+    return (int) (ceil(mathUtils::randomRelVar(mui[level]) / levelEps / levelEps));
+}
+
+AdaptiveHBE::AdaptiveHBE(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, double lb,
+        double eps, bool sketch) : AdaptiveHBE(data, k, lb, eps, sketch, HBEOptions()) {}
+
 AdaptiveHBE::AdaptiveHBE(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, double lb,
-        double eps, bool sketch) {
+        double eps, bool sketch, const HBEOptions& opts) {
+    //Will be used to obtain a seed for the random number engine
+    std::random_device rd;
+    rng = std::mt19937_64(rd());
+
+    X = data;
+    kernel = k;
     numPoints = data->rows();
     tau = lb;
     use_sketch = sketch;
-    buildLevels(data, k, tau, eps, sketch);
+    weights = opts.weights;
+    if (opts.weights != nullptr) {
+        cdf = mathUtils::cumulative(*opts.weights);
+    }
+    buildLevels(data, k, tau, eps, sketch, opts);
+}
+
+AdaptiveHBE::~AdaptiveHBE() {
+    stopping = true;
+    if (prewarmer.joinable()) { prewarmer.join(); }
+}
+
+IndexMemory AdaptiveHBE::memoryUsage() const {
+    IndexMemory mem;
+    mem.sketch = sketchMemory;
+    // buildLevel() frees the sketches with the last hashed level
+    mem.sketchHeld = sketchMemory.total() > 0 && builtLevels() < rsLevel;
+    for (int i = 0; i < I; i ++) {
+        if (i >= rsLevel || !built[i].load(std::memory_order_acquire)) {
+            mem.levels.push_back(MemoryUsage());
+        } else if (use_sketch) {
+            mem.levels.push_back(s_levels[i].memoryUsage());
+        } else {
+            mem.levels.push_back(u_levels[i].memoryUsage());
+        }
+    }
+    return mem;
+}
+
+IndexMemory AdaptiveHBE::estimateMemory(int n, int d, double tau, double eps, bool sketch,
+        shared_ptr<Kernel> k, const HBEOptions& opts) {
+    AdaptiveHBE est;
+    est.use_sketch = sketch;
+    est.probes = max(1, opts.probes);
+    est.probeGain = max(1.0, opts.probeGain);
+    est.pyramid = opts.pyramid;
+    // Without the data, use the upper bound that estimateDiameter caps the diameter with
+    est.setLevelParams(k, tau, eps, log(n / tau), opts);
+    est.rsLevel = est.I;
+    IndexMemory plan = est.planMemory(n, d);
+    if (opts.memoryBudget > 0) {
+        est.applyBudget(plan, opts.memoryBudget, eps);
+    }
+    return plan;
+}
+
+void AdaptiveHBE::setEps(double eps) {
+    std::lock_guard<std::mutex> guard(buildLock);
+    levelEps = eps;
+    retargeted = true;
+    for (int i = 0; i < I; i ++) {
+        if (i >= rsLevel) {
+            Mi[i] = rsSamples(i);
+            continue;
+        }
+        Mi[i] = hashSamples(i, eps);
+        int t = int(Mi[i] * L * 1.1);
+        if (!built[i]) {
+            continue;
+        } else if (use_sketch) {
+            s_levels[i].setActiveTables(t);
+        } else {
+            u_levels[i].setActiveTables(t);
+        }
+    }
+}
+
+std::function<double()> AdaptiveHBE::levelSampler(const VectorXd& q, int level, LevelTrace* trace) {
+    // Callers read sampleRange() after this, so wait for the level rather than fall back
+    if (level < rsLevel && ensureLevel(level, true)) {
+        return use_sketch ? s_levels[level].sampler(q, trace) : u_levels[level].sampler(q, trace);
+    }
+    return rsSampler(q);
+}
+
+std::function<double()> AdaptiveHBE::rsSampler(const VectorXd& q) {
+    std::uniform_int_distribution<int> distribution(0, numPoints - 1);
+    std::mt19937_64* rng = &mathUtils::threadRng();
+    return [this, q, distribution, rng]() mutable {
+        int idx = cdf.empty() ? distribution(*rng) : mathUtils::sampleCumulative(cdf, *rng);
+        return kernel->density(q, X->row(idx));
+    };
 }
 
+double AdaptiveHBE::sampleRange(int level) {
+    if (level < rsLevel && !built[level].load(std::memory_order_acquire)) {
+        return kernel->dimFactor * kernel->bwFactor;
+    }
+    return levelRange[level];
+}
+
+std::vector<double> AdaptiveHBE::evaluateQuery(VectorXd q, int l, LevelTrace* trace) {
+    if (l >= rsLevel || !ensureLevel(l, false)) {
+        return evaluateRS(q, l, rsSamples(l), trace);
+    }
 
-std::vector<double> AdaptiveHBE::evaluateQuery(VectorXd q, int l) {
-    // MoM
     std::vector<double> results = std::vector<double>(2, 0);
-    results[1] = Mi[l];
+    if (seqDelta > 0 && distinctTables(l)) {
+        results = RunningStats::sequentialMoM(levelSampler(q, l, trace), L, Mi[l], mui[l], levelEps, seqDelta,
+                levelRange[l]);
+    } else {
+        // MoM
+        results[1] = Mi[l];
+        if (use_sketch) {
+            results[0] = s_levels[l].estimate(q, L, Mi[l], trace);
+        } else {
+            results[0] = u_levels[l].estimate(q, L, Mi[l], trace);
+        }
+        results[1] *= L;
+    }
+    if (results[0] < tau && !keepBelowTau) { results[0] = 0; }
+    return results;
+}
+
+std::vector<std::vector<double>> AdaptiveHBE::evaluateBatch(const MatrixXd& Q, const std::vector<int>& rows,
+        int l) {
+    if (l >= rsLevel || !ensureLevel(l, false) || (seqDelta > 0 && distinctTables(l))) {
+        return AdaptiveEstimator::evaluateBatch(Q, rows, l);
+    }
+
+    int n = rows.size();
+    MatrixXd block(Q.cols(), n);
+    for (int j = 0; j < n; j ++) { block.col(j) = Q.row(rows[j]).transpose(); }
+    // Each query starts at its own random table, as in MoM()
+    int window = use_sketch ? s_levels[l].window() : u_levels[l].window();
+    std::uniform_int_distribution<int> start(0, window - 1);
+    vector<int> starts(n);
+    for (int j = 0; j < n; j ++) { starts[j] = start(mathUtils::threadRng()); }
+    MatrixXd Z = use_sketch ? s_levels[l].MoMBatch(block, starts, L, Mi[l])
+            : u_levels[l].MoMBatch(block, starts, L, Mi[l]);
+
+    std::vector<std::vector<double>> results(n, std::vector<double>(2, 0));
+    for (int j = 0; j < n; j ++) {
+        std::vector<double> z(Z.col(j).data(), Z.col(j).data() + L);
+        results[j][0] = mathUtils::median(z) / Mi[l];
+        if (results[j][0] < tau && !keepBelowTau) { results[j][0] = 0; }
+        results[j][1] = (double) L * Mi[l];
+    }
+    return results;
+}
+
+std::vector<double> AdaptiveHBE::evaluateRS(VectorXd q, int level, int m, LevelTrace* trace) {
+    std::mt19937_64& rng = mathUtils::threadRng();
+    std::uniform_int_distribution<int> distribution(0, numPoints - 1);
+    long t0 = traceNow(trace);
+
+    if (seqDelta > 0) {
+        std::vector<double> results = RunningStats::sequentialMoM(rsSampler(q), L, m, mui[level], levelEps,
+                seqDelta, kernel->dimFactor * kernel->bwFactor);
+        if (trace != nullptr) {
+            trace->samples += results[1];
+            trace->kernelNanos += traceNow(trace) - t0;
+        }
+        return results;
+    }
+
+    std::vector<double> results = std::vector<double>(2, 0);
+    results[1] = m;
 
     std::vector<double> Z = std::vector<double>(L, 0);
     for (int i = 0; i < L; i ++) {
-        if (use_sketch) {
-            Z[i] = s_levels[l].query(q, tau, results[1]);
-        } else {
-            Z[i] = u_levels[l].query(q, tau, results[1]);
+        for (int j = 0; j < results[1]; j ++) {
+            int idx = cdf.empty() ? distribution(rng) : mathUtils::sampleCumulative(cdf, rng);
+            Z[i] += kernel->density(q, X->row(idx));
         }
     }
 
-    results[0] = mathUtils::median(Z);
+    long t1 = traceNow(trace);
+    results[0] = mathUtils::median(Z) / results[1];
     results[1] *= L;
+    if (trace != nullptr) {
+        trace->samples += results[1];
+        trace->kernelNanos += t1 - t0;
+        trace->medianNanos += traceNow(trace) - t1;
+    }
     return results;
 }
-
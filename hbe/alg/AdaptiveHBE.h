@@ -3,14 +3,95 @@
 
 #include <Eigen/Dense>
 #include "SketchHBE.h"
+#include "SketchPyramid.h"
 #include "UniformHBE.h"
 #include "AdaptiveEstimator.h"
+#include "MemoryUsage.h"
 #include "kernel.h"
 #include "math.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
+///
+/// Optional construction parameters for AdaptiveHBE.
+///
+struct HBEOptions {
+    ///
+    /// Upper bound in bytes on the hash tables of all levels (0: unlimited).
+    /// Levels that do not fit drop the spare tables planned beyond one per sample; once a level cannot
+    /// afford one table per sample (L * Mi), it and all deeper levels are answered by random sampling
+    /// instead. Reusing tables within a query would correlate its samples and void the error bound, so
+    /// a tight budget trades query time (random sampling needs more samples) for the guarantee.
+    ///
+    size_t memoryBudget = 0;
+
+    ///
+    /// Cells probed per hash table (multi-probe LSH). Probing more cells lowers the variance of each
+    /// sample.
+    ///
+    int probes = 1;
+
+    ///
+    /// With probes > 1, factor by which multi-probe is taken to lower the relative variance of a sample:
+    /// hashed levels draw this many times fewer samples, and build this many times fewer tables. The
+    /// default 1 keeps the kernel's variance bound, under which the (1 +- eps) sizing holds. A larger
+    /// value, e.g. measured on the data and kernel at hand, trades that guarantee for a smaller index.
+    ///
+    double probeGain = 1;
+
+    ///
+    /// Weight of each data point (nullptr: unit weights). Uniform levels build weighted tables;
+    /// HBS sketches and random sampling levels draw points with probability proportional to weight.
+    ///
+    shared_ptr<VectorXd> weights;
+
+    ///
+    /// With HBS, build a multi-resolution sketch (SketchPyramid) so that each level samples its
+    /// tables from a sketch hashed at its own scale, instead of sharing sketches hashed at the
+    /// finest level's scale.
+    ///
+    bool pyramid = false;
+
+    ///
+    /// Build the sketches and the hash tables of a level only when the first query reaches it, instead
+    /// of building every level up front. A query reaching a level while another thread builds one
+    /// answers it by random sampling instead of waiting.
+    ///
+    bool lazy = false;
+
+    ///
+    /// With lazy, also build the levels in order on a background thread started by the constructor.
+    ///
+    bool prewarm = false;
+
+    ///
+    /// Hashing scheme of each level, e.g. as chosen by hbe_tune: number of hash functions and bin width.
+    /// Levels past the end of the lists keep the default scheme (3 * ceil(r * t_i) functions of width
+    /// k_i / t_i * sqrt(2 / pi) for the Gaussian kernel, getPower/getWidth for the exponential kernel).
+    ///
+    vector<int> hashK;
+    vector<double> hashW;
+
+    ///
+    /// Relative variance of a sample at each level under its hashing scheme, which sets the samples
+    /// per level. The (1 +- eps) guarantee holds for the queries whose variance it bounds: hbe_tune
+    /// writes the largest bound over its sampled queries. Levels past the end of the list use the
+    /// kernel's bound (Kernel::RelVar).
+    ///
+    vector<double> relVar;
+
+    ///
+    /// Report estimates below tau as they are instead of as 0, for estimates that are added up before
+    /// being compared to tau (the shards of ShardedEstimator).
+    ///
+    bool keepBelowTau = false;
+};
+
 ///
 /// Adaptive sampling via HBE.
 ///
@@ -38,8 +119,56 @@ public:
     /// \param sketch if true, use HBS as a sketch; otherwise use uniform sampling as a sketch
     AdaptiveHBE(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, double lb, double eps, bool sketch);
 
+    ///
+    /// \param data dataset
+    /// \param k kernel
+    /// \param lb tau (minimum density)
+    /// \param eps relative error
+    /// \param sketch if true, use HBS as a sketch; otherwise use uniform sampling as a sketch
+    /// \param opts construction options
+    AdaptiveHBE(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, double lb, double eps, bool sketch,
+            const HBEOptions& opts);
+
+    ~AdaptiveHBE();
+
+    ///
+    /// \return memory footprint of the hash tables of each level and of the sketches
+    IndexMemory memoryUsage() const;
+
+    ///
+    /// \return number of hashed levels whose tables are built (all of them unless lazy)
+    int builtLevels() const;
+
+    /// Dry run: predict the memory footprint of an index without building it.
+    /// The prediction assumes every point lands in its own bucket, so it is an upper bound.
+    /// \param n number of data points
+    /// \param d dimension
+    /// \param tau minimum density
+    /// \param eps relative error
+    /// \param sketch whether to use HBS or Uniform
+    /// \param k kernel
+    /// \param opts construction options
+    static IndexMemory estimateMemory(int n, int d, double tau, double eps, bool sketch,
+            shared_ptr<Kernel> k, const HBEOptions& opts);
+
+    ///
+    /// Re-target the estimator to a relative error without rebuilding: recompute the samples per
+    /// level and only use as many tables as an index built for eps would have. Tables are i.i.d., so
+    /// this matches a fresh build as long as eps is no smaller than the eps the index was built for.
+    /// \param eps relative error
+    void setEps(double eps);
+
 protected:
-    std::vector<double> evaluateQuery(VectorXd q, int level);
+    std::vector<double> evaluateQuery(VectorXd q, int level, LevelTrace* trace);
+
+    ///
+    /// Hashed levels evaluate the queries together, one table at a time (UniformHBE/SketchHBE::MoMBatch).
+    /// Random sampling levels and sequential levels evaluate each query on its own.
+    ///
+    std::vector<std::vector<double>> evaluateBatch(const MatrixXd& Q, const std::vector<int>& rows,
+            int level) override;
+    std::function<double()> levelSampler(const VectorXd& q, int level, LevelTrace* trace) override;
+    double sampleRange(int level) override;
 
 private:
     ///
@@ -48,8 +177,99 @@ private:
     double tau;
 
     bool use_sketch;
+    bool pyramid = false;
+    bool keepBelowTau = false;
     const double LOG2 = log(2);
     const double SQRT_2PI = sqrt(2.0 / M_PI);
+    const int N_SKETCHES = 5;
+
+    ///
+    /// Cells probed per hash table, and the variance reduction assumed for them
+    ///
+    int probes = 1;
+    double probeGain = 1;
+
+    ///
+    /// First level answered by random sampling instead of hashing (I if none).
+    ///
+    int rsLevel;
+
+    ///
+    /// Upper bound on a sample of each level: the kernel maximum for random sampling levels, the largest
+    /// importance weight the level's hash parameters allow for the others
+    ///
+    vector<double> levelRange;
+
+    ///
+    /// Relative variance of a sample at each level
+    ///
+    vector<double> relVar;
+
+    ///
+    /// Footprint of the sketches built during construction.
+    ///
+    MemoryUsage sketchMemory;
+
+    ///
+    /// Tables of each hashed level, as planned under the memory budget
+    ///
+    vector<int> levelTables;
+
+    ///
+    /// Points sampled into each of the N_SKETCHES sketches
+    ///
+    int sketchPoints = 0;
+
+    ///
+    /// Points each UniformHBE table is built on
+    ///
+    int subsample = 0;
+    shared_ptr<VectorXd> weights;
+
+    ///
+    /// Sketches the levels sample their tables from, with the dataset index of each sketch point.
+    /// Kept until every hashed level is built.
+    ///
+    vector<SketchTable> sketches;
+    vector<SketchPyramid> pyramids;
+    vector<vector<int>> sketchIndices;
+    bool sketchesBuilt = false;
+
+    ///
+    /// Whether each hashed level is built; queries read it without taking buildLock
+    ///
+    std::unique_ptr<std::atomic<bool>[]> built;
+    int levelsLeft = 0;
+
+    ///
+    /// Held while building a level, so that levels are built one at a time and only once
+    ///
+    std::mutex buildLock;
+    std::thread prewarmer;
+    bool prewarming = false;
+    std::atomic<bool> stopping{false};
+
+    ///
+    /// Whether setEps() was called, so that levels built later only use the tables it allows
+    ///
+    bool retargeted = false;
+
+    ///
+    /// Dataset and kernel, kept for the levels answered by random sampling.
+    ///
+    shared_ptr<MatrixXd> X;
+    shared_ptr<Kernel> kernel;
+    std::mt19937_64 rng;
+
+    ///
+    /// Prefix sums of the point weights; empty if the points are unweighted.
+    ///
+    vector<double> cdf;
+
+    ///
+    /// Empty estimator, used to plan the levels of a dry run.
+    ///
+    AdaptiveHBE() {}
 
     ///
     /// Helper function to build data structure for each level of adaptive sampling.
@@ -58,7 +278,79 @@ private:
     /// \param tau minimum density
     /// \param eps relative error
     /// \param sketch whether to use HBS or Uniform
-    void buildLevels(shared_ptr<MatrixXd> X, shared_ptr<Kernel> k, double tau, double eps, bool sketch);
+    /// \param opts construction options
+    void buildLevels(shared_ptr<MatrixXd> X, shared_ptr<Kernel> k, double tau, double eps, bool sketch,
+            const HBEOptions& opts);
+
+    ///
+    /// Set the target density, number of samples and hashing scheme of each level.
+    /// \param k kernel function
+    /// \param tau minimum density
+    /// \param eps relative error
+    /// \param diam estimated diameter of the dataset
+    /// \param opts construction options, for the hashing scheme and relative variance of each level
+    void setLevelParams(shared_ptr<Kernel> k, double tau, double eps, double diam, const HBEOptions& opts);
+
+    ///
+    /// Predict the footprint of each level, given the level parameters.
+    /// \param n number of data points
+    /// \param d dimension
+    IndexMemory planMemory(int n, int d);
+
+    ///
+    /// Cap the tables of each level so that the plan fits in the budget,
+    /// switching to random sampling from the first level that cannot be hashed.
+    /// \param plan footprint of each level, updated in place
+    /// \param budget memory budget in bytes
+    /// \param eps relative error
+    void applyBudget(IndexMemory& plan, size_t budget, double eps);
+
+    ///
+    /// Samples needed at a hashed level for the given relative error, divided by probeGain with
+    /// multi-probe.
+    /// \param level hashed level
+    /// \param eps relative error
+    int hashSamples(int level, double eps);
+
+    ///
+    /// Random sampling estimate at the given level, with L means of m samples.
+    ///
+    std::vector<double> evaluateRS(VectorXd q, int level, int m, LevelTrace* trace);
+
+    ///
+    /// \return samples random sampling needs at the given level
+    int rsSamples(int level) const;
+
+    ///
+    /// Build the sketches the levels sample their tables from. Called with buildLock held (or during
+    /// construction).
+    ///
+    void buildSketches();
+
+    ///
+    /// Build the hash tables of a level and mark it built. Called with buildLock held (or during
+    /// construction).
+    ///
+    void buildLevel(int level);
+
+    ///
+    /// Make sure a hashed level is built, building it now if needed (only the prewarmer builds levels
+    /// for callers that do not wait).
+    /// \param level hashed level
+    /// \param wait whether to wait while another thread builds a level, instead of giving up
+    /// \return whether the level is built; if not, answer it by random sampling
+    bool ensureLevel(int level, bool wait);
+
+    ///
+    /// \return whether a query at a built hashed level draws each of its L * Mi samples from its own table.
+    /// Otherwise (after setEps() to a smaller eps) the sampler wraps around and reuses tables, its samples
+    /// are not independent, and the empirical Bernstein bound of sequential estimation does not hold.
+    bool distinctTables(int level) const;
+
+    ///
+    /// Random sampling version of levelSampler()
+    ///
+    std::function<double()> rsSampler(const VectorXd& q);
 
 };
 
@@ -3,6 +3,13 @@
 #include "mathUtils.h"
 #include <math.h>
 
+void AdaptiveRS::setEps(double eps) {
+    levelEps = eps;
+    for (int i = 0; i < I; i ++) {
+        Mi[i] = (int) (ceil(mathUtils::randomRelVar(mui[i]) / eps / eps));
+    }
+}
+
 void AdaptiveRS::buildLevels(double tau, double eps) {
     double tmp = log(1/ tau);
     // Effective diameter
@@ -11,6 +18,7 @@ void AdaptiveRS::buildLevels(double tau, double eps) {
     I = (int) ceil(tmp / LOG2);
     mui = vector<double>(I);
     Mi = vector<int>(I);
+    levelEps = eps;
 
     for (int i = 0; i < I; i ++) {
         if (i == 0) {
@@ -36,6 +44,12 @@ AdaptiveRS::AdaptiveRS(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, double t
     buildLevels(tau, eps);
 }
 
+AdaptiveRS::AdaptiveRS(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, shared_ptr<Kernel> k,
+        double tau, double eps) : AdaptiveRS(data, k, tau, eps) {
+    if (weights != nullptr) {
+        cdf = mathUtils::cumulative(*weights);
+    }
+}
 
 AdaptiveRS::AdaptiveRS(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, int samples,
         double tau, double eps) {
@@ -65,9 +79,34 @@ AdaptiveRS::AdaptiveRS(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, int samp
     buildLevels(tau, eps);
 }
 
+std::function<double()> AdaptiveRS::levelSampler(const VectorXd& q, int, LevelTrace*) {
+    std::uniform_int_distribution<int> distribution(0, numPoints - 1);
+    std::mt19937_64* rng = &mathUtils::threadRng();
+    return [this, q, distribution, rng]() mutable {
+        int idx = cdf.empty() ? distribution(*rng) : mathUtils::sampleCumulative(cdf, *rng);
+        return kernel->density(q, X->row(idx));
+    };
+}
+
+double AdaptiveRS::sampleRange(int) {
+    return kernel->dimFactor * kernel->bwFactor;
+}
 
-std::vector<double> AdaptiveRS::evaluateQuery(VectorXd q, int level) {
+std::vector<double> AdaptiveRS::evaluateQuery(VectorXd q, int level, LevelTrace* trace) {
+    std::mt19937_64& rng = mathUtils::threadRng();
     std::uniform_int_distribution<int> distribution(0, numPoints - 1);
+    long t0 = traceNow(trace);
+
+    if (seqDelta > 0) {
+        // Samples are drawn one at a time, so they cannot be sorted for locality
+        std::vector<double> results = RunningStats::sequentialMoM(levelSampler(q, level, nullptr), L, Mi[level],
+                mui[level], levelEps, seqDelta, sampleRange(level));
+        if (trace != nullptr) {
+            trace->samples += results[1];
+            trace->kernelNanos += traceNow(trace) - t0;
+        }
+        return results;
+    }
 
     std::vector<double> results = std::vector<double>(2, 0);
     results[1] =  Mi[level];
@@ -76,7 +115,7 @@ std::vector<double> AdaptiveRS::evaluateQuery(VectorXd q, int level) {
     for (int i = 0; i < L; i ++) {
         std::vector<int> indices(results[1]);
         for (int j = 0; j < results[1]; j ++) {
-            indices[j] = distribution(rng);
+            indices[j] = cdf.empty() ? distribution(rng) : mathUtils::sampleCumulative(cdf, rng);
         }
         std::sort(indices.begin(), indices.end());
         for (int j = 0; j < results[1]; j ++) {
@@ -86,7 +125,13 @@ std::vector<double> AdaptiveRS::evaluateQuery(VectorXd q, int level) {
         }
     }
 
+    long t1 = traceNow(trace);
     results[0] = mathUtils::median(Z) / results[1];
     results[1] *= L;
+    if (trace != nullptr) {
+        trace->samples += results[1];
+        trace->kernelNanos += t1 - t0;
+        trace->medianNanos += traceNow(trace) - t1;
+    }
     return results;
 }
\ No newline at end of file
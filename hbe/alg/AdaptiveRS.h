@@ -31,10 +31,26 @@ public:
     /// \param eps relative error
     AdaptiveRS(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, int samples, double lb, double eps);
 
+    ///
+    /// \param data dataset
+    /// \param weights weight of each data point, or nullptr for unit weights;
+    ///        points are sampled with probability proportional to weight
+    /// \param k kernel
+    /// \param lb minimum density
+    /// \param eps relative error
+    AdaptiveRS(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, shared_ptr<Kernel> k, double lb, double eps);
+
+    ///
+    /// Re-target the estimator to a relative error: recompute the samples per level.
+    /// \param eps relative error
+    void setEps(double eps);
+
 protected:
     double lb;
     std::mt19937_64 rng;
-    std::vector<double> evaluateQuery(VectorXd q, int level);
+    std::vector<double> evaluateQuery(VectorXd q, int level, LevelTrace* trace);
+    std::function<double()> levelSampler(const VectorXd& q, int level, LevelTrace* trace) override;
+    double sampleRange(int level) override;
 
 private:
     ///
@@ -46,6 +62,11 @@ private:
     /// Kernel function
     ///
     shared_ptr<Kernel> kernel;
+
+    ///
+    /// Prefix sums of the point weights; empty if the points are unweighted.
+    ///
+    vector<double> cdf;
     const double LOG2 = log(2);
     const double SQRT_2PI = sqrt(2.0 / M_PI);
 
@@ -87,7 +87,7 @@ AdaptiveRSDiag::AdaptiveRSDiag(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k,
 }
 
 
-std::vector<double> AdaptiveRSDiag::evaluateQuery(VectorXd q, int level) {
+std::vector<double> AdaptiveRSDiag::evaluateQuery(VectorXd q, int level, LevelTrace* trace) {
     std::uniform_int_distribution<int> distribution(0, numPoints - 1);
 
     std::vector<double> results = std::vector<double>(2, 0);
@@ -103,6 +103,7 @@ std::vector<double> AdaptiveRSDiag::evaluateQuery(VectorXd q, int level) {
             results[0] += d;
         }
         results[0] /= results[1];
+        if (trace != nullptr) { trace->samples += numPoints; }
         return results;
     }
 
@@ -124,6 +125,7 @@ std::vector<double> AdaptiveRSDiag::evaluateQuery(VectorXd q, int level) {
     }
 
     results[0] = mathUtils::median(Z) / results[1];
+    if (trace != nullptr) { trace->samples += L * results[1]; }
     return results;
 }
 
@@ -236,11 +238,8 @@ void AdaptiveRSDiag::findRings(int strategy, double eps, VectorXd &q, int level)
     }
     set_start.push_back(contrib.size());
 
-    // Gaussian Kernel
-    if (kernel->getName() != EXP_STR) {
-        exp_w = wi[level];
-        exp_k = ki[level];
-    }
+    // Hashing scheme the importance weights are computed for
+    std::pair<int, double> scheme = hash_k > 0 ? std::make_pair(hash_k, hash_w) : hashParams(level);
 
     // Calculate set stats
     pmins = vector<double>(4, 1);
@@ -263,8 +262,8 @@ void AdaptiveRSDiag::findRings(int strategy, double eps, VectorXd &q, int level)
 
             int idx = samples[j];
             VectorXd delta = X->row(idx) - q.transpose();
-            double c = delta.norm() / exp_w;
-            double p = mathUtils::collisionProb(c, exp_k);
+            double c = delta.norm() / scheme.second;
+            double p = mathUtils::collisionProb(c, scheme.first);
             pmins[i] = min(pmins[i], p);
             pmaxs[i] = max(pmaxs[i], p);
 
@@ -316,18 +315,19 @@ double AdaptiveRSDiag::vbRS() {
 
 double AdaptiveRSDiag::vbHBE() {
 //    double sup3 = w_pps[3][0] * pmaxs[3];
-    double sup3 = w_ps[3][w_ps[3].size() - 1] ;
+    // Sets whose points all contribute less than thresh are skipped
+    double sup3 = w_ps[3].empty() ? 0 : w_ps[3][w_ps[3].size() - 1];
 
     double up = sup3 * u[3];
     double t2_factor = (set_start[1] - set_start[0]) * 1.0 / sample_count;
     double sup1;
     for (int i = 0; i < 3; i ++) {
-        if (set_start[3-i] == set_start[4-i]) {continue; }
+        if (set_start[3-i] == set_start[4-i] || w_ps[i].empty()) {continue; }
         for (int j = 0; j < 3; j ++) {
-            if (set_start[3-j] == set_start[4-j]) {continue; }
+            if (set_start[3-j] == set_start[4-j] || w_ps[j].empty()) {continue; }
             if (i == j) { // From the same set
                 sup1 = 1 / pmins[i];
-                for (size_t k = 0; k < 10; k ++) {
+                for (size_t k = 0; k < min(size_t(10), w_pps[i].size()); k ++) {
                     size_t l = 0;
                     while(w_p_idx[i][l] > w_pp_idx[i][k]) {
                         l ++;
@@ -348,6 +348,18 @@ double AdaptiveRSDiag::vbHBE() {
 }
 
 
+void AdaptiveRSDiag::setHashParams(int k, double w) {
+    hash_k = k;
+    hash_w = w;
+}
+
+std::pair<int, double> AdaptiveRSDiag::hashParams(int level) const {
+    if (kernel->getName() == EXP_STR) {
+        return std::make_pair(exp_k, exp_w);
+    }
+    return std::make_pair(ki[level], wi[level]);
+}
+
 int AdaptiveRSDiag::findActualLevel(VectorXd &q, double truth, double eps) {
 
     vector<int> indices;
@@ -358,7 +370,7 @@ int AdaptiveRSDiag::findActualLevel(VectorXd &q, double truth, double eps) {
     int i = 0;
     std::vector<double> Z = std::vector<double>(L, 0);
     while (i < I) {
-        std::vector<double> results = evaluateQuery(q, i);
+        std::vector<double> results = evaluateQuery(q, i, nullptr);
         if (fabs(results[0] - truth) / truth < eps) {
             return i;
         }
@@ -65,8 +65,22 @@ public:
     /// \return variance upper bound for HBE
     double vbHBE();
 
+    /// Evaluate vbHBE() for the given hashing scheme at every level, instead of the default one.
+    /// Takes effect at the next findRings().
+    /// \param k number of hash functions (0: back to the default schemes)
+    /// \param w bin width
+    void setHashParams(int k, double w);
+
+    ///
+    /// \return default number of hash functions and bin width at the level, as AdaptiveHBE uses them
+    std::pair<int, double> hashParams(int level) const;
+
+    ///
+    /// \return target density of the level
+    double levelTarget(int level) const { return mui[level]; }
+
 protected:
-    std::vector<double> evaluateQuery(VectorXd q, int level);
+    std::vector<double> evaluateQuery(VectorXd q, int level, LevelTrace* trace);
 
 private:
     shared_ptr<MatrixXd> X;
@@ -77,6 +91,11 @@ private:
     int exp_k;
     double exp_w;
     double thresh;
+    ///
+    /// Hashing scheme set by setHashParams() (0: default scheme of each level)
+    ///
+    int hash_k = 0;
+    double hash_w = 0;
 
     // Diagnosis constants
     vector<size_t> set_start;
@@ -1,6 +1,8 @@
 #ifndef EPS_MRSKETCH_H
 #define EPS_MRSKETCH_H
 
+#include <algorithm>
+#include <functional>
 #include "SketchTable.h"
 #include "dataUtils.h"
 
@@ -17,30 +19,99 @@ public:
         final_samples.clear();
         int N = X->rows();
 
-        //Will be used to obtain a seed for the random number engine
-        int remain = m % ntbls;
-
+        // Tables are built in parallel; each gets its own engine, seeded in table order
+        vector<uint64_t> seeds = tableSeeds(ntbls, rng);
+        vector<vector<pair<int, double>>> table_samples(ntbls);
+        #pragma omp parallel for schedule(dynamic)
         for (int i = 0; i < ntbls; i ++) {
-            int nsamples = m / ntbls;
-            if (i < remain) {nsamples ++;}
+            std::mt19937_64 table_rng(seeds[i]);
 
             // Subsample dataset
             int subsample = N * 2 / ntbls;
             std::vector<int> indices;
-            shared_ptr<MatrixXd> X_sample = dataUtils::downSample(X, indices, subsample, rng);
+            shared_ptr<MatrixXd> X_sample = dataUtils::downSample(X, indices, subsample, table_rng);
 
-            SketchTable t = SketchTable(X_sample, w, k, rng);
-            vector<pair<int, double>> samples = t.sample(nsamples, rng);
+            SketchTable t = SketchTable(X_sample, w, k, table_rng);
+            table_samples[i] = t.sample(tableSamples(m, ntbls, i), table_rng);
 
             // Output samples and normalize weights
-            for (size_t j = 0; j < samples.size(); j ++) {
-                samples[j].first = indices[samples[j].first];
-                final_samples.push_back(samples[j]);
+            for (auto& sample : table_samples[i]) {
+                sample.first = indices[sample.first];
+            }
+        }
+        for (auto& samples : table_samples) {
+            final_samples.insert(final_samples.end(), samples.begin(), samples.end());
+        }
+    }
+
+    ///
+    /// Streaming construction: the dataset arrives in chunks of consecutive rows and is never held in
+    /// memory. Each table hashes a random subset of 2N / ntbls row indices, fixed up front, so the
+    /// tables only keep row indices; the samples refer to rows of the stream.
+    /// \param next fills its argument with the next chunk of rows and returns false at the end of the data
+    /// \param N number of rows in the stream
+    /// \param d dimension
+    /// \param m number of samples
+    /// \param w bin width
+    /// \param k number of hash functions
+    /// \param ntbls number of hash tables
+    HBS(std::function<bool(MatrixXd&)> next, int N, int d, int m, double w, int k, int ntbls,
+            std::mt19937_64 & rng) {
+        final_samples.clear();
+        vector<uint64_t> seeds = tableSeeds(ntbls, rng);
+        vector<SketchTable> tables;
+        vector<vector<int>> subsets;
+        vector<std::mt19937_64> engines;
+        for (int i = 0; i < ntbls; i ++) {
+            engines.push_back(std::mt19937_64(seeds[i]));
+            std::unordered_set<int> elems = mathUtils::pickSet(N, N * 2 / ntbls, engines[i]);
+            subsets.push_back(vector<int>(elems.begin(), elems.end()));
+            std::sort(subsets[i].begin(), subsets[i].end());
+            tables.push_back(SketchTable(d, w, k, engines[i]));
+        }
+
+        // Position in each table's subset of the first row not yet hashed
+        vector<size_t> cursor(ntbls, 0);
+        MatrixXd chunk;
+        int offset = 0;
+        while (next(chunk)) {
+            int end = offset + chunk.rows();
+            #pragma omp parallel for schedule(dynamic)
+            for (int i = 0; i < ntbls; i ++) {
+                vector<int> ids;
+                while (cursor[i] < subsets[i].size() && subsets[i][cursor[i]] < end) {
+                    ids.push_back(subsets[i][cursor[i]]);
+                    cursor[i] ++;
+                }
+                MatrixXd rows(ids.size(), d);
+                for (size_t j = 0; j < ids.size(); j ++) {
+                    rows.row(j) = chunk.row(ids[j] - offset);
+                }
+                tables[i].insert(rows, ids);
             }
+            offset = end;
+        }
+
+        for (int i = 0; i < ntbls; i ++) {
+            tables[i].finalize();
+            vector<pair<int, double>> samples = tables[i].sample(tableSamples(m, ntbls, i), engines[i]);
+            final_samples.insert(final_samples.end(), samples.begin(), samples.end());
         }
+    }
+
+private:
+    static vector<uint64_t> tableSeeds(int ntbls, std::mt19937_64 & rng) {
+        vector<uint64_t> seeds;
+        for (int i = 0; i < ntbls; i ++) { seeds.push_back(rng()); }
+        return seeds;
+    }
 
+    ///
+    /// Number of samples drawn from table i: m split evenly, remainder to the first tables.
+    static int tableSamples(int m, int ntbls, int i) {
+        return m / ntbls + (i < m % ntbls ? 1 : 0);
     }
 };
 
 
-#endif //EPS_MRSKETCH_H
\ No newline at end of file
+#endif //EPS_MRSKETCH_H
@@ -5,6 +5,7 @@
 #include <Eigen/Dense>
 #include <random>
 #include "kernel.h"
+#include "MemoryUsage.h"
 
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
@@ -132,6 +133,23 @@ public:
         }
     }
 
+    ///
+    /// Heap bytes held by the bucket header: counts, weights and sample handles.
+    ///
+    size_t overheadBytes() const {
+        return heapBytes(count.capacity() * sizeof(int)) + heapBytes(wSum.capacity() * sizeof(double))
+            + heapBytes(sample.capacity() * sizeof(VectorXd));
+    }
+
+    ///
+    /// Heap bytes held by the data samples stored in the bucket.
+    ///
+    size_t sampleBytes() const {
+        size_t bytes = 0;
+        for (auto& s : sample) { bytes += heapBytes(s.size() * sizeof(double)); }
+        return bytes;
+    }
+
 private:
 
 };
@@ -0,0 +1,86 @@
+#include "HashEstimator.h"
+
+std::function<double()> HashEstimator::sampler(VectorXd query, LevelTrace* trace) {
+    int window = this->window();
+    int table = std::uniform_int_distribution<int>(0, window - 1)(mathUtils::threadRng());
+    return [this, query, trace, window, table]() mutable {
+        double x = evaluateQuery(query, table, trace);
+        table = (table + 1) % window;
+        return x;
+    };
+}
+
+MatrixXd HashEstimator::MoMBatch(const MatrixXd& Q, int L, int m) {
+    std::uniform_int_distribution<int> start(0, window() - 1);
+    vector<int> starts(Q.cols());
+    for (auto& s : starts) { s = start(mathUtils::threadRng()); }
+    return MoMBatch(Q, starts, L, m);
+}
+
+MatrixXd HashEstimator::MoMBatch(const MatrixXd& Q, const vector<int>& starts, int L, int m) {
+    int n = Q.cols();
+    int active = window();
+    long total = (long) L * m;
+    MatrixXd Z = MatrixXd::Zero(L, n);
+    if (numProbes > 1) {
+        for (int j = 0; j < n; j ++) {
+            VectorXd q = Q.col(j);
+            for (long i = 0; i < total; i ++) {
+                Z(i / m, j) += evaluateQuery(q, (starts[j] + i) % active, nullptr);
+            }
+        }
+        return Z;
+    }
+
+    // Query j draws its i-th sample from table (starts[j] + i) mod active
+    vector<int> cols;
+    vector<int> group;
+    for (int t = 0; t < active; t ++) {
+        cols.clear();
+        group.clear();
+        for (int j = 0; j < n; j ++) {
+            long i = (t - starts[j] + active) % active;
+            // Fewer tables than samples: later rounds of the walk revisit the table
+            for (; i < total; i += active) {
+                cols.push_back(j);
+                group.push_back(i / m);
+            }
+        }
+        if (cols.empty()) { continue; }
+        MatrixXd block(Q.rows(), cols.size());
+        for (size_t c = 0; c < cols.size(); c ++) { block.col(c) = Q.col(cols[c]); }
+        VectorXd samples = tables[t].sampleBatch(block, *kernel, weighted());
+        double norm = tableMass(t);
+        for (size_t c = 0; c < cols.size(); c ++) {
+            Z(group[c], cols[c]) += samples(c) / norm;
+        }
+    }
+    return Z;
+}
+
+vector<double> HashEstimator::MoM(VectorXd query, int L, int m, LevelTrace* trace) {
+    // Walk consecutive tables from a random start, so that the L * m samples of one call
+    // come from distinct tables while concurrent calls share no state.
+    int window = this->window();
+    int table = std::uniform_int_distribution<int>(0, window - 1)(mathUtils::threadRng());
+    std::vector<double> Z = std::vector<double>(L, 0);
+    for (int i = 0; i < L; i ++) {
+        for (int j = 0; j < m; j ++){
+            Z[i] += evaluateQuery(query, table, trace);
+            table = (table + 1) % window;
+        }
+    }
+    return Z;
+}
+
+double HashEstimator::evaluateQuery(const VectorXd& query, int table, LevelTrace* trace) {
+    return tables[table].evaluate(query, *kernel, weighted(), numProbes, trace) / tableMass(table);
+}
+
+MemoryUsage HashEstimator::memoryUsage() const {
+    MemoryUsage mem;
+    for (auto& t : tables) {
+        mem += t.memoryUsage();
+    }
+    return mem;
+}
@@ -0,0 +1,99 @@
+#ifndef HBE_HASHESTIMATOR_H
+#define HBE_HASHESTIMATOR_H
+
+#include "HashBucket.h"
+#include "HashTable.h"
+#include "MoMEstimator.h"
+#include <functional>
+
+///
+/// Base class of the HBE estimators: samples queries from a collection of hash tables, walking
+/// consecutive tables from a random start. Subclasses build the tables and say how a table's buckets
+/// and total mass are read.
+///
+class HashEstimator : public MoMEstimator {
+public:
+    ///
+    /// A collection of hash tables for HBE.
+    ///
+    vector<HashTable> tables;
+
+    ///
+    /// \return heap footprint of all hash tables
+    MemoryUsage memoryUsage() const;
+
+    ///
+    /// Only sample from the first m hash tables, as if the estimator had been built with m tables.
+    /// \param m number of tables to use (0: all)
+    void setActiveTables(int m) { activeTables = m; }
+
+    ///
+    /// Probe the given number of cells per table (multi-probe LSH) instead of only the query's cell.
+    /// \param probes number of cells to probe per table
+    void setProbes(int probes) { numProbes = probes; }
+
+    ///
+    /// Sampler over consecutive tables from a random start, the way MoM() walks them: each call
+    /// returns one sample from the next table. Used for sequential, anytime and threshold queries.
+    /// \param query query point
+    /// \param trace trace to record probes, samples and time in, or nullptr
+    /// \return function drawing the next sample; it refers to this estimator and must not outlive it
+    std::function<double()> sampler(VectorXd query, LevelTrace* trace) override;
+
+    /// Batched MoM(): the L * m samples of each query, walking consecutive tables from its own start.
+    /// Each table hashes all the queries that sample from it with one matrix product and evaluates the
+    /// samples they find as a block (HashTable::sampleBatch). With multi-probe, queries are sampled one
+    /// at a time.
+    /// \param Q queries, one per column
+    /// \param starts first table of each query, in [0, number of active tables)
+    /// \param L median of L means
+    /// \param m means of m samples
+    /// \return L x n matrix whose column j holds the L sums of m samples of query j
+    MatrixXd MoMBatch(const MatrixXd& Q, const vector<int>& starts, int L, int m);
+
+    ///
+    /// \return number of tables queries sample from
+    int window() const { return activeTables > 0 ? min(activeTables, numTables) : numTables; }
+
+protected:
+    ///
+    /// Number of hash tables
+    ///
+    int numTables = 0;
+    ///
+    /// Number of hash tables queries sample from (0: all)
+    ///
+    int activeTables = 0;
+    ///
+    /// Number of cells probed per hash table
+    ///
+    int numProbes = 1;
+    double binWidth;
+    int numHash;
+    shared_ptr<Kernel> kernel;
+
+    ///
+    /// \return total count or weight of the points in a table, which its samples are normalized by
+    virtual double tableMass(int table) const = 0;
+
+    ///
+    /// \return whether buckets are read by the weight sum of their points rather than their count
+    virtual bool weighted() const = 0;
+
+    ///
+    /// Take a biased sample from a hash table via HBE (HashTable::evaluate), normalized by its mass.
+    /// \param query query point
+    /// \param table index of the hash table to sample from
+    /// \param trace trace to record the probe in, or nullptr
+    /// \return normalized contribution of the biased sample
+    double evaluateQuery(const VectorXd& query, int table, LevelTrace* trace);
+
+    ///
+    /// MoMBatch() with a random start table for each query, as MoM() picks it.
+    ///
+    MatrixXd MoMBatch(const MatrixXd& Q, int L, int m) override;
+    std::vector<double> MoM(VectorXd query, int L, int m, LevelTrace* trace) override;
+};
+
+
+#endif //HBE_HASHESTIMATOR_H
@@ -3,6 +3,8 @@
 
 #include "HashBucket.h"
 #include "mathUtils.h"
+#include "QueryTrace.h"
+#include <algorithm>
 #include <unordered_map>
 #include <vector>
 #include <exception>
@@ -160,6 +162,219 @@ public:
     }
 
 
+    /// Hash a point.
+    /// \param x data or query point
+    /// \return one key per table in the batch
+    vector<size_t> hashfunction(VectorXd x) {
+        VectorXd v = G * x + b;
+        return getkey(v);
+    }
+
+    /// Turn a projected point into hash keys.
+    /// \param v projection Gx + b
+    /// \return one key per table in the batch
+    vector<size_t> getkey(VectorXd v) {
+        vector<size_t> keys(batchSize);
+        for (int b = 0; b < batchSize; b++) {
+            size_t key = b;
+            for (int i = 0; i < numHash; i ++) {
+                boost::hash_combine(key, (int)ceil(v(i)));
+            }
+            keys[b] = key;
+        }
+        return keys;
+    }
+
+    ///
+    /// A cell probed by multi-probe LSH: the query's cell shifted by one along at most one coordinate.
+    ///
+    struct Probe {
+        size_t key;
+        ///
+        /// Shifted coordinate (-1 for the query's own cell) and direction (+1 or -1)
+        ///
+        int dim;
+        int shift;
+    };
+
+    /// Project a point for hashing.
+    /// \param x data or query point
+    /// \return Gx + b
+    VectorXd project(const VectorXd& x) const {
+        return G * x + b;
+    }
+
+    /// Key of the cell a projected point falls in, as getkey() computes it for a single table.
+    /// \param v projection Gx + b
+    size_t cellKey(const Eigen::Ref<const VectorXd>& v) const {
+        size_t key = 0;
+        for (int i = 0; i < numHash; i ++) {
+            boost::hash_combine(key, (int)ceil(v(i)));
+        }
+        return key;
+    }
+
+    /// HBE samples of a block of queries from this table. One matrix product hashes all queries, and the
+    /// samples of the buckets they fall in are evaluated together. Each result is what the single-query
+    /// samplers compute before normalizing by the table's mass: the sum over the bucket's scales of
+    /// K(x, q) / p(x, q) times the count (or weight sum) of the scale.
+    /// \param Q queries, one per column
+    /// \param kernel kernel function
+    /// \param weighted whether to use the weight sums of the buckets instead of their counts
+    /// \return sample of each query (0 for an empty bucket)
+    VectorXd sampleBatch(const MatrixXd& Q, Kernel& kernel, bool weighted) const {
+        int n = Q.cols();
+        MatrixXd P = G * Q;
+        P.colwise() += b;
+
+        // Gather the bucket samples of all queries
+        vector<int> owner;
+        vector<const VectorXd*> points;
+        vector<double> mass;
+        for (int j = 0; j < n; j ++) {
+            const HashBucket* bucket = find(cellKey(P.col(j)));
+            if (bucket == nullptr) { continue; }
+            for (int s = 0; s < bucket->SCALES; s ++) {
+                if (bucket->count[s] > 0) {
+                    owner.push_back(j);
+                    points.push_back(&bucket->sample[s]);
+                    mass.push_back(weighted ? bucket->wSum[s] : bucket->count[s]);
+                }
+            }
+        }
+
+        int hits = owner.size();
+        MatrixXd D(Q.rows(), hits);
+        for (int i = 0; i < hits; i ++) {
+            D.col(i) = *points[i] - Q.col(owner[i]);
+        }
+        Eigen::ArrayXd dist = D.colwise().norm().transpose().array();
+        Eigen::Map<const VectorXd> invBw(kernel.invBandwidth.data(), kernel.dim);
+        Eigen::ArrayXd density = (invBw.asDiagonal() * D).colwise().squaredNorm().transpose().array();
+        kernel.densityFromSquared(density);
+
+        VectorXd results = VectorXd::Zero(n);
+        for (int i = 0; i < hits; i ++) {
+            double p = mathUtils::collisionProb(dist(i) / binWidth, numHash);
+            results(owner[i]) += density(i) / p * mass[i];
+        }
+        return results;
+    }
+
+    /// HBE sample of a query from this table, before normalizing by the table's mass: the sum over the
+    /// scales of the bucket the query falls in of K(x, q) / p(x, q) times the count (or weight sum) of
+    /// the scale. With multi-probe, a Horvitz-Thompson estimate over the samples of all probed cells,
+    /// each weighted by the probability of falling into any of the probed cells (probeProb).
+    /// \param q query
+    /// \param kernel kernel function
+    /// \param weighted whether to use the weight sums of the buckets instead of their counts
+    /// \param probes number of cells to probe
+    /// \param trace trace to record the probes, samples and time in, or nullptr
+    /// \return sample of the query (0 for empty buckets)
+    double evaluate(const VectorXd& q, Kernel& kernel, bool weighted, int probes, LevelTrace* trace) const {
+        long t0 = traceNow(trace);
+        VectorXd v = project(q);
+        vector<Probe> seq = probes > 1 ? probeSequence(v, probes) : vector<Probe>{Probe{cellKey(v), -1, 0}};
+        long t1 = traceNow(trace);
+        vector<const HashBucket*> buckets;
+        for (auto& p : seq) {
+            buckets.push_back(find(p.key));
+        }
+        long t2 = traceNow(trace);
+        double results = 0;
+        int evals = 0;
+        for (auto bucket : buckets) {
+            if (bucket == nullptr) {
+                if (trace != nullptr) { trace->emptyBuckets ++; }
+                continue;
+            }
+            for (int j = 0; j < bucket->SCALES; j ++) {
+                if (bucket->count[j] > 0) {
+                    double mass = weighted ? bucket->wSum[j] : bucket->count[j];
+                    VectorXd delta = bucket->sample[j] - q;
+                    double c = delta.norm() / binWidth;
+                    double p = probes > 1 ? probeProb(v, seq, c) : mathUtils::collisionProb(c, numHash);
+                    results += kernel.density(delta) / p * mass;
+                    evals ++;
+                }
+            }
+        }
+        if (trace != nullptr) {
+            long t3 = traceNow(trace);
+            trace->probes += seq.size();
+            trace->samples += evals;
+            trace->hashNanos += t1 - t0;
+            trace->lookupNanos += t2 - t1;
+            trace->kernelNanos += t3 - t2;
+        }
+        return results;
+    }
+
+    /// Multi-probe sequence: the query's cell, followed by the neighbouring cells across the
+    /// probes - 1 bin boundaries closest to the query's projection.
+    /// \param v projection Gq + b of the query
+    /// \param probes number of cells to probe
+    /// \return probed cells, most likely first
+    vector<Probe> probeSequence(const VectorXd& v, int probes) const {
+        // Crossing the upper boundary of coordinate i costs f_i = ceil(v_i) - v_i, the lower one 1 - f_i
+        vector<pair<double, Probe>> shifts;
+        for (int i = 0; i < numHash; i ++) {
+            double f = ceil(v(i)) - v(i);
+            shifts.push_back(make_pair(f, Probe{0, i, 1}));
+            shifts.push_back(make_pair(1 - f, Probe{0, i, -1}));
+        }
+        int n = min(probes - 1, int(shifts.size()));
+        partial_sort(shifts.begin(), shifts.begin() + n, shifts.end(),
+                [](const pair<double, Probe>& a, const pair<double, Probe>& b) { return a.first < b.first; });
+
+        vector<Probe> seq;
+        seq.push_back(Probe{probeKey(v, -1, 0), -1, 0});
+        for (int i = 0; i < n; i ++) {
+            Probe p = shifts[i].second;
+            p.key = probeKey(v, p.dim, p.shift);
+            seq.push_back(p);
+        }
+        return seq;
+    }
+
+    /// Probability, over the hash functions and conditioned on the query's offsets within its cell,
+    /// that a point at normalized distance c from the query falls into one of the probed cells.
+    /// The probed cells are disjoint, so this is the sum of the probability of each cell.
+    /// \param v projection Gq + b of the query
+    /// \param seq probed cells
+    /// \param c distance / bin width
+    double probeProb(const VectorXd& v, const vector<Probe>& seq, double c) const {
+        // A duplicate of the query always shares its cell
+        if (c < 1e-12) { return 1; }
+        vector<double> home(numHash);
+        double p0 = 1;
+        for (int i = 0; i < numHash; i ++) {
+            home[i] = mathUtils::cellProb(ceil(v(i)) - v(i), 0, c);
+            p0 *= home[i];
+        }
+        double prob = 0;
+        for (auto& p : seq) {
+            if (p.dim < 0) {
+                prob += p0;
+                continue;
+            }
+            double pi = 1;
+            for (int i = 0; i < numHash; i ++) {
+                pi *= (i == p.dim) ? mathUtils::cellProb(ceil(v(i)) - v(i), p.shift, c) : home[i];
+            }
+            prob += pi;
+        }
+        return prob;
+    }
+
+    /// Find the bucket stored under a hash key.
+    /// \param key hash key
+    /// \return the bucket, or nullptr if no data point hashed to the key
+    const HashBucket* find(size_t key) const {
+        auto it = table.find(key);
+        return it == table.end() ? nullptr : &it->second;
+    }
+
     /// Find hash buckets that the query falls in.
     /// \param query query point
     /// \return
@@ -177,7 +392,45 @@ public:
         return buckets;
     }
 
+    ///
+    /// \return heap footprint of the table
+    MemoryUsage memoryUsage() const {
+        MemoryUsage mem;
+        mem.tables = 1;
+        mem.hashing = heapBytes(G.size() * sizeof(double)) + heapBytes(b.size() * sizeof(double));
+        mem.buckets = heapBytes(table.bucket_count() * sizeof(void*)) + table.size() * heapBytes(NODE_BYTES);
+        for (auto& it : table) {
+            mem.buckets += it.second.overheadBytes();
+            mem.samples += it.second.sampleBytes();
+        }
+        return mem;
+    }
+
+    /// Predict the footprint of a table before building it, assuming every point lands in its own bucket.
+    /// \param points number of points inserted into the table
+    /// \param d dimension
+    /// \param k number of hash functions
+    /// \param weighted whether buckets keep a weight sum (tables built from weighted samples)
+    /// \return upper bound on the heap footprint of the table
+    static MemoryUsage estimateMemory(int points, int d, int k, bool weighted) {
+        MemoryUsage mem;
+        mem.tables = 1;
+        mem.hashing = heapBytes(size_t(k) * d * sizeof(double)) + heapBytes(k * sizeof(double));
+        // unordered_map keeps the load factor <= 1 and grows the bucket array by ~2x
+        size_t bucket_array = heapBytes(size_t(points) * 2 * sizeof(void*));
+        size_t per_bucket = heapBytes(NODE_BYTES) + heapBytes(sizeof(int)) + heapBytes(sizeof(VectorXd));
+        if (weighted) { per_bucket += heapBytes(sizeof(double)); }
+        mem.buckets = bucket_array + size_t(points) * per_bucket;
+        mem.samples = size_t(points) * heapBytes(d * sizeof(double));
+        return mem;
+    }
+
 private:
+    ///
+    /// Size of an unordered_map node: next pointer plus the stored key/bucket pair.
+    ///
+    static constexpr size_t NODE_BYTES = sizeof(void*) + sizeof(pair<const size_t, HashBucket>);
+
     ///
     /// Minimum weight in the bucket. Used to determine the weight scale.
     ///
@@ -222,22 +475,18 @@ private:
     ///
     int W_SCALE = 3;
 
-
-    vector<size_t> hashfunction(VectorXd x) {
-        VectorXd v = G * x + b;
-        return getkey(v);
-    }
-
-    vector<size_t> getkey(VectorXd v) {
-        vector<size_t> keys(batchSize);
-        for (int b = 0; b < batchSize; b++) {
-            size_t key = b;
-            for (int i = 0; i < numHash; i ++) {
-                boost::hash_combine(key, (int)ceil(v(i)));
-            }
-            keys[b] = key;
+    /// Key of the query's cell, shifted along one coordinate.
+    /// \param v projection of the query
+    /// \param dim shifted coordinate, or -1 for the query's own cell
+    /// \param shift cell offset along dim
+    size_t probeKey(const VectorXd& v, int dim, int shift) const {
+        size_t key = 0;
+        for (int i = 0; i < numHash; i ++) {
+            int cell = (int)ceil(v(i));
+            if (i == dim) { cell += shift; }
+            boost::hash_combine(key, cell);
         }
-        return keys;
+        return key;
     }
 
     int getWeightBucket(double weight) {
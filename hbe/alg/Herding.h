@@ -1,6 +1,7 @@
 #ifndef EPS_HERDING_H
 #define EPS_HERDING_H
 
+#include <limits>
 #include <vector>
 #include "kernel.h"
 #include "dataUtils.h"
@@ -30,45 +31,107 @@ public:
         X_indices.clear();
         X = dataUtils::downSample(data, X_indices, N, rng);
 
+        // Scale by the inverse bandwidth so that kernel values follow from squared distances,
+        // which we get in batches from dot products
+        VectorXd inv_bw = Eigen::Map<const VectorXd>(kernel->invBandwidth.data(), kernel->dim);
+        points = *X * inv_bw.asDiagonal();
+        norms = points.rowwise().squaredNorm();
+
         rs_indices.clear();
         densities = vector<double> (N, 0);
-        std::uniform_int_distribution<int> uniform(0, N - 1);
-        // Estimate density via samples
-        for (int i = 0; i < N; i ++) {
-            std::vector<int> indices(m);
-            for (int j = 0; j < m; j ++) {
-                indices[j] = uniform(rng);
+        if (m >= N) {
+            // Sampling m candidates per candidate costs more than summing over all of them:
+            // use the exact densities. N <= sqrt(n), so the kernel matrix has at most n entries.
+            gram = MatrixXd(N, N);
+            #pragma omp parallel for schedule(dynamic, 16)
+            for (int j = 0; j < N; j ++) {
+                Eigen::ArrayXd col = kernelColumn(j);
+                gram.col(j) = col.matrix();
+                densities[j] = col.mean();
             }
-            std::sort(indices.begin(), indices.end());
-            rs_indices.push_back(indices);
-
-            auto q = X->row(i);
-            for (int j = 0; j < m; j ++) {
-                int idx = indices[j];
-                if (m == N) { idx = j; }
-                densities[i] += kernel->density(q, X->row(idx));
+        } else {
+            // Estimate density via samples
+            std::uniform_int_distribution<int> uniform(0, N - 1);
+            for (int i = 0; i < N; i ++) {
+                std::vector<int> indices(m);
+                for (int j = 0; j < m; j ++) {
+                    indices[j] = uniform(rng);
+                }
+                std::sort(indices.begin(), indices.end());
+                rs_indices.push_back(indices);
+            }
+            #pragma omp parallel
+            {
+                Eigen::ArrayXd sq(m);
+                #pragma omp for schedule(static)
+                for (int i = 0; i < N; i ++) {
+                    for (int j = 0; j < m; j ++) {
+                        int idx = rs_indices[i][j];
+                        sq(j) = max(0.0, norms(i) + norms(idx) - 2 * points.row(i).dot(points.row(idx)));
+                    }
+                    ker->densityFromSquared(sq);
+                    densities[i] = sq.mean();
+                }
             }
-            densities[i] /= m;
         }
 
-        // Get m samples
+        // Get m samples. Keep the sum of kernel values between every candidate and the samples so
+        // far; each step adds the kernel column of the new sample. Columns are computed once per
+        // distinct sample, at most min(N, m) * N <= n values.
         samples.clear();
-        vector<double> new_densities(N, 0);
+        Eigen::ArrayXd sums = Eigen::ArrayXd::Zero(N);
+        vector<Eigen::ArrayXd> columns(gram.size() > 0 ? 0 : N);
+        const bool parallel = N >= PARALLEL_SCAN;
         for (int i = 0; i < m; i++) {
+            const double scale = i == 0 ? 0 : 1.0 / i;
             int idx = 0;
-            double max_diff = -1;
-            for (int j = 0; j < N; j ++) {
-                double diff = densities[j] - new_densities[j];
-                if (diff > max_diff) {
-                    max_diff = diff;
-                    idx = j;
+            double max_diff = std::numeric_limits<double>::lowest();
+            #pragma omp parallel if (parallel)
+            {
+                int local_idx = 0;
+                double local_diff = std::numeric_limits<double>::lowest();
+                #pragma omp for schedule(static) nowait
+                for (int j = 0; j < N; j ++) {
+                    double diff = densities[j] - sums(j) * scale;
+                    if (diff > local_diff) {
+                        local_diff = diff;
+                        local_idx = j;
+                    }
+                }
+                #pragma omp critical
+                if (local_diff > max_diff || (local_diff == max_diff && local_idx < idx)) {
+                    max_diff = local_diff;
+                    idx = local_idx;
                 }
             }
             samples.push_back(make_pair<>(X_indices[idx], 1.0 / m));
-            for (int j = 0; j < N; j ++) {
-                new_densities[j] = (new_densities[j] * i + ker->density(X->row(j), X->row(idx))) / (i + 1);
+            if (gram.size() > 0) {
+                sums += gram.col(idx).array();
+            } else {
+                if (columns[idx].size() == 0) { columns[idx] = kernelColumn(idx); }
+                sums += columns[idx];
             }
         }
+        points.resize(0, 0);
+        gram.resize(0, 0);
+    }
+
+private:
+    ///
+    /// Candidates below this count are scanned by one thread
+    ///
+    const int PARALLEL_SCAN = 1 << 15;
+
+    RowMatrixXd points;
+    VectorXd norms;
+    MatrixXd gram;
+
+    ///
+    /// Kernel values between every candidate and candidate c.
+    Eigen::ArrayXd kernelColumn(int c) {
+        Eigen::ArrayXd sq = (norms.array() + norms(c) - 2 * (points * points.row(c).transpose()).array()).max(0);
+        ker->densityFromSquared(sq);
+        return sq;
     }
 };
 
@@ -0,0 +1,109 @@
+#include "HotSwapEstimator.h"
+#include "AdaptiveRS.h"
+#include <stdexcept>
+
+HotSwapEstimator::HotSwapEstimator(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights,
+        shared_ptr<Kernel> k, double tau, double eps, const HotSwapOptions& opts, DataLoader load) :
+        kernel(k), tau(tau), eps(eps), opts(opts), load(load) {
+    serving = make_shared<AdaptiveRS>(data, weights, k, tau, eps);
+    // RS and HBE have the same levels for the same tau
+    I = serving->levels();
+    numPoints = data->rows();
+    rebuild(data, weights);
+    builder = std::thread(&HotSwapEstimator::buildLoop, this);
+}
+
+HotSwapEstimator::~HotSwapEstimator() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    builder.join();
+}
+
+std::vector<double> HotSwapEstimator::estimate(VectorXd q, QueryTrace* trace) {
+    return current()->estimate(q, trace);
+}
+
+std::vector<std::vector<double>> HotSwapEstimator::estimateBatch(const MatrixXd& Q) {
+    return current()->estimateBatch(Q);
+}
+
+shared_ptr<AdaptiveEstimator> HotSwapEstimator::current() const {
+    return std::atomic_load(&serving);
+}
+
+void HotSwapEstimator::rebuild(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        nextData = data;
+        nextWeights = weights;
+        requested ++;
+    }
+    wake.notify_all();
+}
+
+void HotSwapEstimator::waitReady() {
+    std::unique_lock<std::mutex> guard(lock);
+    long target = requested;
+    built.wait(guard, [&] { return done >= target || stopping; });
+}
+
+std::string HotSwapEstimator::lastError() {
+    std::lock_guard<std::mutex> guard(lock);
+    return error;
+}
+
+std::vector<double> HotSwapEstimator::evaluateQuery(VectorXd, int, LevelTrace*) {
+    throw std::logic_error("HotSwapEstimator answers queries with its current estimator");
+}
+
+void HotSwapEstimator::buildLoop() {
+    auto nextRefresh = std::chrono::steady_clock::now() + opts.rebuildEvery;
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+        if (nextData == nullptr) {
+            if (opts.rebuildEvery.count() > 0 && load != nullptr) {
+                wake.wait_until(guard, nextRefresh, [&] { return stopping || nextData != nullptr; });
+            } else {
+                wake.wait(guard, [&] { return stopping || nextData != nullptr; });
+            }
+            if (stopping) { break; }
+        }
+
+        shared_ptr<MatrixXd> data = nextData;
+        shared_ptr<VectorXd> weights = nextWeights;
+        long target = requested;
+        nextData = nullptr;
+        nextWeights = nullptr;
+        guard.unlock();
+
+        shared_ptr<AdaptiveEstimator> hbe;
+        std::string failure;
+        try {
+            if (data == nullptr) {
+                // Periodic rebuild
+                load(data, weights);
+            }
+            HBEOptions hbeOpts = opts.hbe;
+            hbeOpts.weights = weights;
+            hbe = make_shared<AdaptiveHBE>(data, kernel, tau, eps, opts.sketch, hbeOpts);
+        } catch (const std::exception& e) {
+            // Keep serving the current estimator
+            failure = e.what();
+        }
+        if (hbe != nullptr) {
+            // In-flight queries hold their own reference to the old estimator
+            std::atomic_store(&serving, hbe);
+            swaps ++;
+        }
+        nextRefresh = std::chrono::steady_clock::now() + opts.rebuildEvery;
+
+        guard.lock();
+        if (!failure.empty()) { error = failure; }
+        done = std::max(done, target);
+        built.notify_all();
+    }
+    built.notify_all();
+}
@@ -0,0 +1,148 @@
+#ifndef HBE_HOTSWAPESTIMATOR_H
+#define HBE_HOTSWAPESTIMATOR_H
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "AdaptiveHBE.h"
+#include "AdaptiveEstimator.h"
+#include "kernel.h"
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+///
+/// Optional construction parameters for HotSwapEstimator.
+///
+struct HotSwapOptions {
+    ///
+    /// With HBE, use HBS rather than uniform sampling as a sketch.
+    ///
+    bool sketch = true;
+
+    ///
+    /// Options of each AdaptiveHBE built; the weights are taken from the data being indexed instead.
+    ///
+    HBEOptions hbe;
+
+    ///
+    /// Rebuild the index on data from the loader this often (0: only on rebuild()).
+    ///
+    std::chrono::milliseconds rebuildEvery{0};
+};
+
+///
+/// Serves queries while an AdaptiveHBE index is being built. Queries are answered by AdaptiveRS, which
+/// needs no construction, until a background thread has built the HBE index; the index is then swapped
+/// in. Rebuilds, on request or periodically on fresh data, keep serving the current estimator until the
+/// new index is ready.
+///
+/// The serving estimator is held by a shared_ptr that is read and replaced atomically (RCU style):
+/// every query takes its own reference, so a query in flight during a swap finishes on the estimator it
+/// started on, and that estimator is freed once the last such query returns.
+///
+class HotSwapEstimator : public AdaptiveEstimator {
+public:
+    ///
+    /// Loads fresh data for a periodic rebuild, scaled by the bandwidth like DataIngest::X_ptr, with its
+    /// weights or nullptr for unit weights.
+    ///
+    typedef std::function<void(shared_ptr<MatrixXd>& X, shared_ptr<VectorXd>& weights)> DataLoader;
+
+    /// Start serving RS on the data and build the HBE index in the background.
+    /// \param data dataset
+    /// \param weights weight of each data point, or nullptr for unit weights
+    /// \param k kernel
+    /// \param tau minimum density
+    /// \param eps relative error
+    /// \param opts construction options
+    /// \param load loads fresh data for periodic rebuilds (only used if opts.rebuildEvery > 0)
+    HotSwapEstimator(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, shared_ptr<Kernel> k,
+            double tau, double eps, const HotSwapOptions& opts, DataLoader load = nullptr);
+
+    ///
+    /// Stop the builder, after the build in progress (if any) is done.
+    ~HotSwapEstimator();
+
+    HotSwapEstimator(const HotSwapEstimator&) = delete;
+    HotSwapEstimator& operator=(const HotSwapEstimator&) = delete;
+
+    ///
+    /// Answer the query with the current estimator. Safe to call from several threads.
+    std::vector<double> estimate(VectorXd q, QueryTrace* trace) override;
+
+    ///
+    /// Answer the block with the current estimator.
+    std::vector<std::vector<double>> estimateBatch(const MatrixXd& Q) override;
+
+    ///
+    /// \return the estimator currently serving queries. It stays valid while the reference is held, so
+    /// callers can use queryWithin() or isAbove() on it.
+    shared_ptr<AdaptiveEstimator> current() const;
+
+    /// Rebuild the HBE index on new data in the background and swap it in when ready. A rebuild
+    /// requested while another one is running starts once that one is done, on the latest data.
+    /// \param data dataset
+    /// \param weights weight of each data point, or nullptr for unit weights
+    void rebuild(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights);
+
+    ///
+    /// \return whether an HBE index serves queries (false while RS answers them)
+    bool ready() const { return swaps > 0; }
+
+    ///
+    /// \return number of indexes swapped in so far
+    int generation() const { return swaps; }
+
+    ///
+    /// Block until the latest rebuild requested (or the initial build) is swapped in or has failed.
+    void waitReady();
+
+    ///
+    /// \return message of the last failed build, empty if none failed
+    std::string lastError();
+
+protected:
+    ///
+    /// Not used: the current estimator walks its own levels.
+    std::vector<double> evaluateQuery(VectorXd q, int level, LevelTrace* trace) override;
+
+private:
+    shared_ptr<AdaptiveEstimator> serving;
+    shared_ptr<Kernel> kernel;
+    double tau;
+    double eps;
+    HotSwapOptions opts;
+    DataLoader load;
+
+    ///
+    /// Data of the next build (nullptr if none is requested)
+    ///
+    shared_ptr<MatrixXd> nextData;
+    shared_ptr<VectorXd> nextWeights;
+
+    ///
+    /// Builds requested and builds done, so that waitReady() knows when the latest one is in
+    ///
+    long requested = 0;
+    long done = 0;
+    std::atomic<int> swaps{0};
+    std::string error;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable built;
+    bool stopping = false;
+    std::thread builder;
+
+    ///
+    /// Builder thread: build each requested index, or one on fresh data every opts.rebuildEvery,
+    /// and swap it in.
+    void buildLoop();
+};
+
+#endif //HBE_HOTSWAPESTIMATOR_H
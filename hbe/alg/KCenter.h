@@ -1,6 +1,11 @@
 #ifndef EPS_KCENTER_H
 #define EPS_KCENTER_H
 
+#include <limits>
+#include <vector>
+#include "kernel.h"
+#include "dataUtils.h"
+
 using namespace std;
 
 ///
@@ -22,6 +27,66 @@ public:
     int kr;
     int n_rs;
 
+    ///
+    /// Gonzalez's farthest-point traversal: starting from seed, repeatedly add the point farthest
+    /// from the centers chosen so far. Keeps the distance of every point to its nearest center, so
+    /// each new center costs one pass over the data: O(N k d) overall. A point is only compared
+    /// with the new center if its own center is less than twice its distance away from the new one;
+    /// otherwise the triangle inequality rules the new center out.
+    /// \param X points, one per row
+    /// \param k number of centers
+    /// \param seed index of the first center
+    /// \return indices of the centers, in the order they were chosen
+    static vector<int> farthestPoints(const RowMatrixXd& X, int k, int seed) {
+        int n = X.rows();
+        vector<int> result;
+        result.push_back(seed);
+        // Squared distance from each point to its nearest center
+        vector<double> dist(n, std::numeric_limits<double>::infinity());
+        // Nearest center of each point, and a quarter of the squared distance between each center
+        // and the newest one
+        vector<int> owner(n, 0);
+        vector<double> bound(k);
+        const int d = X.cols();
+        for (int i = 1; i < k; i ++) {
+            const double* c = X.data() + (size_t) result.back() * d;
+            for (int a = 0; a < i; a ++) {
+                bound[a] = (X.row(result[a]) - X.row(result.back())).squaredNorm() / 4;
+            }
+            int max_idx = 0;
+            double max_dist = 0;
+            #pragma omp parallel
+            {
+                int local_idx = 0;
+                double local_dist = 0;
+                #pragma omp for schedule(static) nowait
+                for (int j = 0; j < n; j ++) {
+                    if (bound[owner[j]] < dist[j]) {
+                        const double* x = X.data() + (size_t) j * d;
+                        double sq = 0;
+                        for (int l = 0; l < d; l ++) { sq += (x[l] - c[l]) * (x[l] - c[l]); }
+                        if (sq < dist[j]) {
+                            dist[j] = sq;
+                            owner[j] = i - 1;
+                        }
+                    }
+                    if (dist[j] > local_dist) {
+                        local_dist = dist[j];
+                        local_idx = j;
+                    }
+                }
+                // Ties go to the smallest index, as in the sequential scan
+                #pragma omp critical
+                if (local_dist > max_dist || (local_dist == max_dist && local_idx < max_idx)) {
+                    max_dist = local_dist;
+                    max_idx = local_idx;
+                }
+            }
+            result.push_back(max_idx);
+        }
+        return result;
+    }
+
     KCenter(shared_ptr<MatrixXd> data, shared_ptr<Kernel> kernel, int k, int seed, std::mt19937_64 &rng) {
         int n = data->rows();
         std::uniform_int_distribution<int> uniform(0, n - 1);
@@ -69,41 +134,36 @@ public:
         }
         N = X->rows();
 
-        // Greedily find K centers
-        centers.clear();
-        centers.push_back(seed);
-        double max_dist;
-        for (int i = 0; i < kc - 1; i ++) {
-            int max_idx = 0;
-            max_dist = 0;
-            for (int j = 0; j < N; j ++) {
-                double min_dist = INT_MAX;
-                for (size_t c = 0; c < centers.size(); c ++) {
-                    auto delta = X->row(j) - X->row(centers[c]);
-                    double dist =  delta.norm();
-                    min_dist = min(min_dist, dist);
-                }
-                if (min_dist > max_dist) {
-                    max_dist = min_dist;
-                    max_idx = j;
-                }
-            }
-            centers.push_back(max_idx);
-        }
+        // Greedily find K centers; points are scanned row by row, so keep them row-major
+        RowMatrixXd points = *X;
+        centers = farthestPoints(points, kc, seed);
 
         // Find vector of weights
-        VectorXd y(kc);
-        for (int i = 0; i < kc; i ++) {
-            for (int j = 0; j < N; j ++) {
-                y(i) += kernel->density(X->row(j), X->row(centers[i]));
+        VectorXd y = VectorXd::Zero(kc);
+        #pragma omp parallel
+        {
+            VectorXd delta(points.cols());
+            #pragma omp for schedule(static)
+            for (int i = 0; i < kc; i ++) {
+                double sum = 0;
+                for (int j = 0; j < N; j ++) {
+                    delta = points.row(j) - points.row(centers[i]);
+                    sum += kernel->density(delta);
+                }
+                y(i) = sum / N;
             }
-            y(i) /= N;
         }
 
         MatrixXd K(kc, kc);
-        for (int i = 0; i < kc; i ++) {
-            for (int j = 0; j < kc; j ++) {
-                K(i, j) = kernel->density(X->row(centers[j]), X->row(centers[i]));
+        #pragma omp parallel
+        {
+            VectorXd delta(points.cols());
+            #pragma omp for schedule(dynamic, 16)
+            for (int i = 0; i < kc; i ++) {
+                for (int j = i; j < kc; j ++) {
+                    delta = points.row(centers[j]) - points.row(centers[i]);
+                    K(i, j) = K(j, i) = kernel->density(delta);
+                }
             }
         }
 
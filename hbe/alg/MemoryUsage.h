@@ -0,0 +1,97 @@
+#ifndef HBE_MEMORYUSAGE_H
+#define HBE_MEMORYUSAGE_H
+
+#include <cstddef>
+#include <vector>
+
+///
+/// Bytes reserved by the allocator for a request of the given size
+/// (glibc malloc: 8-byte header, 16-byte alignment, 32-byte minimum chunk).
+///
+inline size_t heapBytes(size_t bytes) {
+    if (bytes == 0) { return 0; }
+    size_t chunk = (bytes + 8 + 15) / 16 * 16;
+    return chunk < 32 ? 32 : chunk;
+}
+
+///
+/// Heap footprint of a collection of hash tables, in bytes.
+///
+struct MemoryUsage {
+    ///
+    /// Number of hash tables
+    ///
+    int tables = 0;
+
+    ///
+    /// Hash function parameters (G, b)
+    ///
+    size_t hashing = 0;
+
+    ///
+    /// Bucket array: map nodes, bucket headers, per-bucket counts and weights
+    ///
+    size_t buckets = 0;
+
+    ///
+    /// Data points stored in the buckets
+    ///
+    size_t samples = 0;
+
+    size_t total() const { return hashing + buckets + samples; }
+
+    MemoryUsage& operator+=(const MemoryUsage& other) {
+        tables += other.tables;
+        hashing += other.hashing;
+        buckets += other.buckets;
+        samples += other.samples;
+        return *this;
+    }
+
+    MemoryUsage& operator*=(int times) {
+        tables *= times;
+        hashing *= times;
+        buckets *= times;
+        samples *= times;
+        return *this;
+    }
+};
+
+///
+/// Memory footprint of an adaptive HBE index.
+///
+struct IndexMemory {
+    ///
+    /// Tables of each level. Levels answered by random sampling have no tables.
+    ///
+    std::vector<MemoryUsage> levels;
+
+    ///
+    /// HBS sketches the tables are sampled from. Only alive during construction.
+    ///
+    MemoryUsage sketch;
+
+    ///
+    /// Whether the sketches are still held, as by a lazy index until every hashed level is built.
+    /// Once they are freed, sketch only counts toward peak().
+    ///
+    bool sketchHeld = false;
+
+    ///
+    /// \return resident footprint of all levels
+    size_t resident() const {
+        size_t sum = 0;
+        for (auto& l : levels) { sum += l.total(); }
+        return sum;
+    }
+
+    ///
+    /// \return footprint now: all levels, plus the sketches while they are held
+    size_t current() const { return resident() + (sketchHeld ? sketch.total() : 0); }
+
+    ///
+    /// \return peak footprint during construction
+    size_t peak() const { return resident() + sketch.total(); }
+};
+
+#endif //HBE_MEMORYUSAGE_H
@@ -3,9 +3,15 @@
 
 
 #include <Eigen/Dense>
+#include "kernel.h"
 #include "mathUtils.h"
+#include "QueryTrace.h"
+#include "RunningStats.h"
 #include <chrono>
+#include <functional>
+#include <stdexcept>
 
+using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
 ///
@@ -25,10 +31,19 @@ public:
     /// \return: estimate of query if it's > lb, otherwise 0
     ///
     double query(VectorXd q, double lb, int m) {
-        int L = 1;
+        return query(q, lb, m, nullptr);
+    }
+
+    ///
+    /// \param q: query
+    /// \param lb: lower bound of query density
+    /// \param m: means of m samples
+    /// \param trace: trace to record probes, samples and time in, or nullptr to disable tracing
+    /// \return: estimate of query if it's > lb, otherwise 0
+    ///
+    double query(VectorXd q, double lb, int m, LevelTrace* trace) {
         auto t1 = std::chrono::high_resolution_clock::now();
-        std::vector<double> Z = MoM(q, L, m);
-        double est = mathUtils::median(Z) / m;
+        double est = estimate(q, 1, m, trace);
         auto t2 = std::chrono::high_resolution_clock::now();
         totalTime += std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count();
         if (est < lb) {
@@ -38,14 +53,147 @@ public:
         }
     }
 
+    ///
+    /// Median of means estimate without updating totalTime; safe to call from several threads.
+    /// \param q: query
+    /// \param L: median of L means
+    /// \param m: means of m samples
+    /// \param trace: trace to record probes, samples and time in, or nullptr to disable tracing
+    /// \return: estimate of query
+    ///
+    double estimate(VectorXd q, int L, int m, LevelTrace* trace) {
+        std::vector<double> Z = MoM(q, L, m, trace);
+        long t0 = traceNow(trace);
+        double est = mathUtils::median(Z) / m;
+        if (trace != nullptr) { trace->medianNanos += traceNow(trace) - t0; }
+        return est;
+    }
+
+    ///
+    /// Batched query(): answer every row of Q, sharing the work across queries where the estimator can
+    /// (MoMBatch), and write the estimates into out. Each query's estimate has the same distribution
+    /// as query() would give it, independently of the other queries.
+    /// \param Q: queries, one per row
+    /// \param lb: lower bound of query density
+    /// \param m: means of m samples
+    /// \param out: estimate of each query if it's > lb, otherwise 0; resized to the number of queries
+    ///
+    void queryBatch(const MatrixXd& Q, double lb, int m, VectorXd& out) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        estimateBatch(Q, 1, m, out);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        totalTime += std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count();
+        for (int j = 0; j < out.size(); j ++) {
+            if (out(j) < lb) { out(j) = 0; }
+        }
+    }
+
+    ///
+    /// Batched estimate() without updating totalTime; safe to call from several threads.
+    /// Queries are answered in blocks of BATCH_BLOCK.
+    /// \param Q: queries, one per row
+    /// \param L: median of L means
+    /// \param m: means of m samples
+    /// \param out: estimate of each query; resized to the number of queries
+    ///
+    void estimateBatch(const MatrixXd& Q, int L, int m, VectorXd& out) {
+        out.resize(Q.rows());
+        int block = BATCH_BLOCK;
+        for (int j0 = 0; j0 < Q.rows(); j0 += block) {
+            int n = std::min(block, int(Q.rows()) - j0);
+            MatrixXd Z = MoMBatch(Q.middleRows(j0, n).transpose(), L, m);
+            for (int j = 0; j < n; j ++) {
+                std::vector<double> z(Z.col(j).data(), Z.col(j).data() + L);
+                out(j0 + j) = mathUtils::median(z) / m;
+            }
+        }
+    }
+
+    ///
+    /// Decide whether the density of q is at least t, stopping as soon as a confidence interval
+    /// excludes t (RunningStats::sequentialTest).
+    /// \param q: query
+    /// \param t: density threshold
+    /// \param delta: probability that a certain decision is wrong
+    /// \param m: sample budget; the decision compares the mean to t when it runs out
+    /// \return: decision, estimate, samples drawn and confidence interval
+    ///
+    /// Like estimate(), does not update totalTime and is safe to call from several threads.
+    ///
+    ThresholdDecision isAbove(VectorXd q, double t, double delta, int m) {
+        return RunningStats::sequentialTest(sampler(q, nullptr), m, t, delta, sampleBound());
+    }
+
+    ///
+    /// For estimators supporting sequential estimation: a function drawing i.i.d. samples one at a time.
+    /// It takes the query and a trace to record probes, samples and time in (or nullptr), and refers to
+    /// the estimator, so it must not outlive it.
+    ///
+    virtual std::function<double()> sampler(VectorXd, LevelTrace*) {
+        throw std::logic_error("This estimator cannot draw samples one at a time");
+    }
+
+    ///
+    /// \return: upper bound on a single sample drawn by sampler() (they are non-negative)
+    ///
+    virtual double sampleBound() {
+        throw std::logic_error("This estimator cannot draw samples one at a time");
+    }
+
 protected:
+    ///
+    /// Upper bound on the importance weight K(x) / p(x) of a point hashed with k functions of bin width w,
+    /// evaluated on a geometric grid of distances.
+    /// With multi-probe, p(x) is the probability of falling into any probed cell given the query's offsets
+    /// within its cell (HashTable::probeProb). It is at least the probability of the query's own cell, a
+    /// product over the k coordinates that is smallest for a query on a cell boundary, so the bound
+    /// uses (Phi(w / dist) - 1/2)^k, which holds for every query and is up to 2^k times larger.
+    /// \param kernel: kernel function
+    /// \param w: bin width
+    /// \param k: number of hash functions
+    /// \param probes: number of cells probed per table
+    ///
+    static double importanceBound(Kernel& kernel, double w, int k, int probes) {
+        double bound = 1;
+        for (double dist = 1e-3 * w; dist < 1e3 * w; dist *= 1.01) {
+            double p = probes > 1 ? pow(mathUtils::normalCdf(w / dist) - 0.5, k)
+                    : mathUtils::collisionProb(dist, w, k);
+            if (p <= 0) { break; }
+            bound = std::max(bound, kernel.density(dist) / p);
+        }
+        return bound * kernel.dimFactor * kernel.bwFactor;
+    }
+
     ///
     /// \param q: query
     /// \param L: median of L means
     /// \param m: means of m samples
+    /// \param trace: trace to record probes, samples and time in, or nullptr
     /// \return: a vector of L elements, where each element is a sum of m samples
     ///
-    virtual std::vector<double> MoM(VectorXd q, int L, int m) = 0;
+    virtual std::vector<double> MoM(VectorXd q, int L, int m, LevelTrace* trace) = 0;
+
+    ///
+    /// Batched MoM() for estimateBatch(). Estimators that can share work across queries override this;
+    /// by default each query is sampled on its own.
+    /// \param Q: queries, one per column
+    /// \param L: median of L means
+    /// \param m: means of m samples
+    /// \return: L x n matrix whose column j holds the L sums of m samples of query j
+    ///
+    virtual MatrixXd MoMBatch(const MatrixXd& Q, int L, int m) {
+        MatrixXd Z(L, Q.cols());
+        for (int j = 0; j < Q.cols(); j ++) {
+            std::vector<double> z = MoM(Q.col(j), L, m, nullptr);
+            for (int i = 0; i < L; i ++) { Z(i, j) = z[i]; }
+        }
+        return Z;
+    }
+
+    ///
+    /// Number of queries estimateBatch() hands to MoMBatch() at a time, bounding its scratch memory
+    ///
+    static const int BATCH_BLOCK = 1024;
 
 };
 
@@ -0,0 +1,87 @@
+#ifndef HBE_QUERYTRACE_H
+#define HBE_QUERYTRACE_H
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+///
+/// Execution statistics of one level of an adaptive query.
+///
+struct LevelTrace {
+    int level = 0;
+
+    ///
+    /// Estimate at this level and the target density mui[level] it is compared against
+    ///
+    double estimate = 0;
+    double target = 0;
+
+    ///
+    /// Hash table lookups, and how many of them hit an empty bucket
+    ///
+    long probes = 0;
+    long emptyBuckets = 0;
+
+    ///
+    /// Kernel evaluations
+    ///
+    long samples = 0;
+
+    ///
+    /// Time spent hashing the query, looking up buckets, evaluating the kernel and taking the median
+    ///
+    long hashNanos = 0;
+    long lookupNanos = 0;
+    long kernelNanos = 0;
+    long medianNanos = 0;
+};
+
+///
+/// Execution trace of one adaptive query.
+///
+struct QueryTrace {
+    long id = 0;
+    double estimate = 0;
+    double samples = 0;
+    long totalNanos = 0;
+    std::vector<LevelTrace> levels;
+
+    void clear() {
+        estimate = 0;
+        samples = 0;
+        totalNanos = 0;
+        levels.clear();
+    }
+
+    ///
+    /// \return the trace as a single-line JSON object
+    std::string toJSON() const {
+        std::ostringstream out;
+        out << "{\"id\":" << id << ",\"estimate\":" << estimate << ",\"samples\":" << samples
+            << ",\"ns\":" << totalNanos << ",\"levels\":[";
+        for (size_t i = 0; i < levels.size(); i ++) {
+            const LevelTrace& l = levels[i];
+            if (i > 0) { out << ","; }
+            out << "{\"level\":" << l.level << ",\"estimate\":" << l.estimate << ",\"target\":" << l.target
+                << ",\"probes\":" << l.probes << ",\"empty\":" << l.emptyBuckets << ",\"samples\":" << l.samples
+                << ",\"hash_ns\":" << l.hashNanos << ",\"lookup_ns\":" << l.lookupNanos
+                << ",\"kernel_ns\":" << l.kernelNanos << ",\"median_ns\":" << l.medianNanos << "}";
+        }
+        out << "]}";
+        return out.str();
+    }
+};
+
+///
+/// Read the clock only when tracing is enabled.
+/// \param trace trace of the current level, or nullptr if tracing is disabled
+/// \return nanoseconds since the clock's epoch, or 0 if tracing is disabled
+inline long traceNow(const LevelTrace* trace) {
+    if (trace == nullptr) { return 0; }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif //HBE_QUERYTRACE_H
@@ -33,23 +33,91 @@ RS::RS(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, int samples) {
     numPoints = samples;
 }
 
-std::vector<double> RS::MoM(VectorXd q, int L, int m) {
-    std::random_device rd;  //Will be used to obtain a seed for the random number engine
-    std::mt19937_64 rng = std::mt19937_64(rd());
+RS::RS(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, shared_ptr<Kernel> k) {
+    X = data;
+    kernel = k;
+    numPoints = data->rows();
+    if (weights != nullptr) {
+        cdf = mathUtils::cumulative(*weights);
+    }
+}
+
+std::function<double()> RS::sampler(VectorXd q, LevelTrace* trace) {
+    std::uniform_int_distribution<int> distribution(0, numPoints - 1);
+    std::mt19937_64* rng = &mathUtils::threadRng();
+    return [this, q, trace, distribution, rng]() mutable {
+        int idx = cdf.empty() ? distribution(*rng) : mathUtils::sampleCumulative(cdf, *rng);
+        if (trace != nullptr) { trace->samples ++; }
+        return kernel->density(q, X->row(idx));
+    };
+}
+
+double RS::sampleBound() {
+    return kernel->dimFactor * kernel->bwFactor;
+}
+
+std::vector<double> RS::MoM(VectorXd q, int L, int m, LevelTrace* trace) {
+    std::mt19937_64& rng = mathUtils::threadRng();
     std::uniform_int_distribution<int> distribution(0, numPoints - 1);
 
+    long t0 = traceNow(trace);
     std::vector<double> Z = std::vector<double>(L, 0);
     for (int i = 0; i < L; i ++) {
         std::vector<int> indices(m);
         for (int j = 0; j < m; j ++) {
-            indices[j] = distribution(rng);
+            indices[j] = cdf.empty() ? distribution(rng) : mathUtils::sampleCumulative(cdf, rng);
         }
         std::sort(indices.begin(), indices.end());
         for (int j = 0; j < m; j ++) {
             int idx = indices[j];
-            if (m == numPoints) { idx = j; }
+            if (m == numPoints && cdf.empty()) { idx = j; }
             Z[i] += kernel->density(q, X->row(idx));
         }
     }
+    if (trace != nullptr) {
+        trace->samples += L * m;
+        trace->kernelNanos += traceNow(trace) - t0;
+    }
+    return Z;
+}
+
+MatrixXd RS::MoMBatch(const MatrixXd& Q, int L, int m) {
+    std::mt19937_64& rng = mathUtils::threadRng();
+    std::uniform_int_distribution<int> distribution(0, numPoints - 1);
+    // Points per block of squared distances
+    const int chunk = 1024;
+    int n = Q.cols();
+    int d = Q.rows();
+
+    // Squared distances in the kernel's scaled coordinates
+    Eigen::Map<const VectorXd> invBw(kernel->invBandwidth.data(), d);
+    MatrixXd Qs = invBw.asDiagonal() * Q;
+
+    MatrixXd Z = MatrixXd::Zero(L, n);
+    std::vector<int> indices(m);
+    MatrixXd S;
+    for (int q = 0; q < n; q ++) {
+        Eigen::RowVectorXd qs = Qs.col(q).transpose();
+        // Every query draws its own points, as in MoM(), so that estimates of different queries stay
+        // independent
+        for (int i = 0; i < L; i ++) {
+            for (int j = 0; j < m; j ++) {
+                indices[j] = cdf.empty() ? distribution(rng) : mathUtils::sampleCumulative(cdf, rng);
+            }
+            std::sort(indices.begin(), indices.end());
+            for (int j0 = 0; j0 < m; j0 += chunk) {
+                int c = std::min(chunk, m - j0);
+                S.resize(c, d);
+                for (int j = 0; j < c; j ++) {
+                    int idx = indices[j0 + j];
+                    if (m == numPoints && cdf.empty()) { idx = j0 + j; }
+                    S.row(j) = X->row(idx);
+                }
+                Eigen::ArrayXd sq = ((S * invBw.asDiagonal()).rowwise() - qs).rowwise().squaredNorm();
+                kernel->densityFromSquared(sq);
+                Z(i, q) += sq.sum();
+            }
+        }
+    }
     return Z;
 }
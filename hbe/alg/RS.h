@@ -26,14 +26,42 @@ public:
     /// \param samples size of the reservoir
     RS(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k, int samples);
 
+    /// Random sampling on a weighted dataset: points are drawn with probability proportional to weight.
+    /// \param data dataset
+    /// \param weights weight of each data point, or nullptr for unit weights
+    /// \param k kernel
+    RS(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, shared_ptr<Kernel> k);
+
+    ///
+    /// Sampler drawing the kernel value of one random point per call (by weight if weighted).
+    /// \param q query
+    /// \param trace trace to record samples in, or nullptr
+    std::function<double()> sampler(VectorXd q, LevelTrace* trace) override;
+
+    ///
+    /// \return maximum of the kernel, the range of the samples sampler() draws
+    double sampleBound() override;
+
 protected:
     ///
     /// \param q: query
     /// \param L: median of L means
     /// \param m: means of m samples
+    /// \param trace: trace to record samples and time in, or nullptr
     /// \return: a vector of L elements, where each element is a sum of m random samples
     ///
-    std::vector<double> MoM(VectorXd q, int L, int m);
+    std::vector<double> MoM(VectorXd q, int L, int m, LevelTrace* trace);
+
+    ///
+    /// Batched MoM(): each query draws its own L * m random points, as in MoM(), so estimates of
+    /// different queries stay independent. The kernel is evaluated on a block of points at a time, from
+    /// their squared distances, instead of one point at a time.
+    /// \param Q: queries, one per column
+    /// \param L: median of L means
+    /// \param m: means of m samples
+    /// \return: L x n matrix whose column j holds the L sums of m samples of query j
+    ///
+    MatrixXd MoMBatch(const MatrixXd& Q, int L, int m) override;
 
 private:
     ///
@@ -50,6 +78,11 @@ private:
     /// Kernel function.
     ///
     shared_ptr<Kernel> kernel;
+
+    ///
+    /// Prefix sums of the point weights; empty if the points are unweighted.
+    ///
+    vector<double> cdf;
 };
 
 
@@ -0,0 +1,253 @@
+#include "ShardedEstimator.h"
+#include "AdaptiveRS.h"
+#include "ChunkReader.h"
+#include "SocketIO.h"
+#include "dataUtils.h"
+#include <cerrno>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Requests sent to the workers
+const static int32_t OP_QUERY = 0;
+const static int32_t OP_SHUTDOWN = 1;
+
+///
+/// Sent by a worker once its shard is built.
+///
+struct ShardReady {
+    double ok;
+    double rows;
+    double mass;
+    double indexBytes;
+    double dim;
+    double levels;
+};
+
+ShardedEstimator::ShardedEstimator(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, int shards,
+        shared_ptr<Kernel> k, double tau, double eps, const ShardOptions& opts) {
+    ShardLoader load = [data, weights](const vector<long>& rows, shared_ptr<MatrixXd>& X, shared_ptr<VectorXd>& W) {
+        X = make_shared<MatrixXd>(rows.size(), data->cols());
+        for (size_t i = 0; i < rows.size(); i ++) { X->row(i) = data->row(rows[i]); }
+        if (weights != nullptr) {
+            W = make_shared<VectorXd>(rows.size());
+            for (size_t i = 0; i < rows.size(); i ++) { (*W)(i) = (*weights)(rows[i]); }
+        }
+    };
+    start(data->rows(), load, shards, k, tau, eps, opts);
+}
+
+ShardedEstimator::ShardedEstimator(long n, ShardLoader load, int shards, shared_ptr<Kernel> k,
+        double tau, double eps, const ShardOptions& opts) {
+    start(n, load, shards, k, tau, eps, opts);
+}
+
+ShardedEstimator::~ShardedEstimator() {
+    shutdown();
+}
+
+ShardedEstimator::ShardLoader ShardedEstimator::fileLoader(std::string filename, bool ignoreHeader,
+        int startCol, int endCol, vector<double> bandwidth, int weightCol) {
+    // Read columns startCol..endCol of the given rows, skipping the rows of the other shards without
+    // parsing them
+    auto readRows = [=](const vector<long>& rows, int startCol, int endCol) {
+        long n = rows.empty() ? 0 : rows.back() + 1;
+        ChunkReader reader(filename, ignoreHeader, n, startCol, endCol, 1);
+        MatrixXd M(rows.size(), endCol - startCol + 1);
+        MatrixXd row;
+        long next = 0;
+        for (size_t i = 0; i < rows.size(); i ++) {
+            reader.skip(rows[i] - next);
+            reader.next(row);
+            M.row(i) = row.row(0);
+            next = rows[i] + 1;
+        }
+        return M;
+    };
+    return [=](const vector<long>& rows, shared_ptr<MatrixXd>& X, shared_ptr<VectorXd>& W) {
+        MatrixXd points = readRows(rows, startCol, endCol);
+        X = make_shared<MatrixXd>(dataUtils::normalizeBandwidth(points, bandwidth));
+        W = nullptr;
+        if (weightCol >= 0) {
+            W = make_shared<VectorXd>(readRows(rows, weightCol, weightCol).col(0));
+        }
+    };
+}
+
+void ShardedEstimator::start(long n, ShardLoader load, int shards, shared_ptr<Kernel> k, double tau,
+        double eps, const ShardOptions& opts) {
+    shards = std::max(1, (int) std::min((long) shards, n));
+    this->tau = tau;
+    // Shards below tau are off by up to eps / 2 * tau each: see the class comment
+    double shardEps = eps / 2;
+    uint64_t seed = std::random_device()();
+    // Flush so that the workers do not inherit (and print again) buffered output
+    std::cout.flush();
+    for (int s = 0; s < shards; s ++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+            shutdown();
+            throw std::runtime_error("socketpair failed");
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(sv[0]);
+            close(sv[1]);
+            shutdown();
+            throw std::runtime_error("fork failed");
+        }
+        if (pid == 0) {
+            close(sv[0]);
+            // Only the parent talks to the other workers
+            for (auto& w : workers) { close(w.fd); }
+            serve(sv[1], shardRows(n, s, shards, seed), load, k, tau, shardEps, opts);
+        }
+        close(sv[1]);
+        Worker w;
+        w.pid = pid;
+        w.fd = sv[0];
+        workers.push_back(w);
+    }
+
+    // Workers build their shards in parallel; collect them in order
+    double mass = 0;
+    vector<double> masses;
+    I = 0;
+    for (auto& w : workers) {
+        ShardReady ready;
+        if (!SocketIO::readAll(w.fd, &ready, sizeof(ready)) || ready.ok == 0) {
+            shutdown();
+            throw std::runtime_error("Failed to build shard");
+        }
+        masses.push_back(ready.mass);
+        mass += ready.mass;
+        w.rows = (long) ready.rows;
+        w.indexBytes = (size_t) ready.indexBytes;
+        dim = (int) ready.dim;
+        I = std::max(I, (int) ready.levels);
+    }
+    for (size_t s = 0; s < workers.size(); s ++) {
+        workers[s].share = masses[s] / mass;
+    }
+    numPoints = n;
+}
+
+vector<long> ShardedEstimator::shardRows(long n, int shard, int shards, uint64_t seed) {
+    vector<long> rows;
+    for (long i = 0; i < n; i ++) {
+        // splitmix64 of the row index
+        uint64_t z = seed + (uint64_t) (i + 1) * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        if ((int) (z % shards) == shard) { rows.push_back(i); }
+    }
+    return rows;
+}
+
+void ShardedEstimator::serve(int fd, const vector<long>& rows, ShardLoader& load, shared_ptr<Kernel> k,
+        double tau, double eps, const ShardOptions& opts) {
+    ShardReady ready = {0, 0, 0, 0, 0, 0};
+    shared_ptr<AdaptiveEstimator> est;
+    try {
+        shared_ptr<MatrixXd> X;
+        shared_ptr<VectorXd> W;
+        load(rows, X, W);
+        if (X->rows() == 0) {
+            // No row hashed to this shard: it holds no weight and answers 0
+        } else if (opts.random) {
+            est = make_shared<AdaptiveRS>(X, W, k, tau, eps);
+        } else {
+            HBEOptions hbe = opts.hbe;
+            hbe.weights = W;
+            hbe.keepBelowTau = true;
+            auto adaptive = make_shared<AdaptiveHBE>(X, k, tau, eps, opts.sketch, hbe);
+            ready.indexBytes = adaptive->memoryUsage().resident();
+            est = adaptive;
+        }
+        if (est != nullptr && opts.sequential > 0) { est->setSequential(opts.sequential); }
+        ready.ok = 1;
+        ready.rows = X->rows();
+        ready.mass = W == nullptr ? X->rows() : W->sum();
+        ready.dim = X->cols();
+        ready.levels = est == nullptr ? 0 : est->levels();
+    } catch (std::exception& e) {
+        std::cerr << "Shard of " << rows.size() << " rows: " << e.what() << std::endl;
+    }
+    if (!SocketIO::writeAll(fd, &ready, sizeof(ready)) || ready.ok == 0) {
+        _exit(1);
+    }
+
+    VectorXd q((int) ready.dim);
+    int32_t op;
+    while (SocketIO::readAll(fd, &op, sizeof(op)) && op == OP_QUERY) {
+        if (!SocketIO::readAll(fd, q.data(), q.size() * sizeof(double))) { break; }
+        std::vector<double> returns = est == nullptr ? std::vector<double>(3, 0) : est->estimate(q, nullptr);
+        if (!SocketIO::writeAll(fd, returns.data(), 3 * sizeof(double))) { break; }
+    }
+    close(fd);
+    _exit(0);
+}
+
+std::vector<double> ShardedEstimator::estimate(VectorXd q, QueryTrace* trace) {
+    std::vector<double> returns(3, 0);
+    if (trace != nullptr) { trace->clear(); }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        // Scatter, then gather: the shards work on the query concurrently
+        for (auto& w : workers) {
+            if (!SocketIO::writeAll(w.fd, &OP_QUERY, sizeof(OP_QUERY)) ||
+                    !SocketIO::writeAll(w.fd, q.data(), dim * sizeof(double))) {
+                throw std::runtime_error("Shard worker " + std::to_string(w.pid) + " is gone");
+            }
+        }
+        for (auto& w : workers) {
+            double shard[3];
+            if (!SocketIO::readAll(w.fd, shard, sizeof(shard))) {
+                throw std::runtime_error("Shard worker " + std::to_string(w.pid) + " is gone");
+            }
+            returns[0] += w.share * shard[0];
+            returns[1] += shard[1];
+            returns[2] = std::max(returns[2], shard[2]);
+        }
+    }
+    if (returns[0] < tau) { returns[0] = 0; }
+    if (trace != nullptr) {
+        trace->estimate = returns[0];
+        trace->samples = returns[1];
+    }
+    return returns;
+}
+
+std::vector<std::vector<double>> ShardedEstimator::estimateBatch(const MatrixXd& Q) {
+    std::vector<std::vector<double>> returns;
+    for (int j = 0; j < Q.rows(); j ++) {
+        returns.push_back(estimate(Q.row(j), nullptr));
+    }
+    return returns;
+}
+
+std::vector<double> ShardedEstimator::evaluateQuery(VectorXd, int, LevelTrace*) {
+    throw std::logic_error("ShardedEstimator has no levels of its own");
+}
+
+vector<size_t> ShardedEstimator::shardIndexBytes() const {
+    vector<size_t> bytes;
+    for (auto& w : workers) { bytes.push_back(w.indexBytes); }
+    return bytes;
+}
+
+void ShardedEstimator::shutdown() {
+    for (auto& w : workers) {
+        SocketIO::writeAll(w.fd, &OP_SHUTDOWN, sizeof(OP_SHUTDOWN));
+        close(w.fd);
+    }
+    for (auto& w : workers) {
+        int status;
+        while (waitpid(w.pid, &status, 0) < 0 && errno == EINTR) {}
+    }
+    workers.clear();
+}
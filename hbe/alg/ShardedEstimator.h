@@ -0,0 +1,178 @@
+#ifndef HBE_SHARDEDESTIMATOR_H
+#define HBE_SHARDEDESTIMATOR_H
+
+#include <Eigen/Dense>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <sys/types.h>
+#include "AdaptiveHBE.h"
+#include "AdaptiveEstimator.h"
+#include "kernel.h"
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+///
+/// Optional construction parameters for ShardedEstimator.
+///
+struct ShardOptions {
+    ///
+    /// Answer each shard with adaptive RS instead of adaptive HBE.
+    ///
+    bool random = false;
+
+    ///
+    /// With HBE, use HBS rather than uniform sampling as a sketch.
+    ///
+    bool sketch = true;
+
+    ///
+    /// Options of each shard's AdaptiveHBE. The memory budget applies to each shard; the weights are
+    /// taken from the shard's data instead, and keepBelowTau is always set.
+    ///
+    HBEOptions hbe;
+
+    ///
+    /// Failure probability of sequential level estimation in each shard (0: off),
+    /// see AdaptiveEstimator::setSequential.
+    ///
+    double sequential = 0;
+};
+
+///
+/// Adaptive sampling over a dataset split into S shards, each indexed by its own AdaptiveHBE or
+/// AdaptiveRS in a worker process forked on the same host, so that no process has to hold the whole
+/// dataset or all of the hash tables.
+///
+/// The KDE is additive over disjoint subsets: with shard s holding a fraction p_s of the total weight,
+///     KDE(q) = sum_s p_s KDE_s(q).
+/// Rows are assigned to shards at random, by a hash of the row index under a seed shared by the workers,
+/// so that sorted data does not put a query's neighbours in a few shards. A query is sent to all workers
+/// over Unix domain sockets and each worker walks its own levels, stopping as soon as its shard's
+/// estimate is accepted, independently of the other shards.
+///
+/// A shard can hold less than tau of a query whose density over the whole dataset is above tau, so
+/// shards do not report densities below tau as 0 (HBEOptions::keepBelowTau; AdaptiveRS never does).
+/// Each shard is built for relative error eps / 2: a shard above tau is within eps / 2 of its density,
+/// and a shard below tau ends at the last level, which is sized for tau and is off by at most
+/// eps / 2 * tau. Then
+///     |estimate - KDE(q)| <= eps / 2 * KDE(q) + eps / 2 * tau,
+/// which is at most eps * KDE(q) when KDE(q) >= tau, with the failure probabilities of the shards
+/// added up. Only the combined estimate is compared to tau, and reported as 0 below it.
+///
+/// Queries are serialized: concurrent calls to estimate() take turns on the workers.
+///
+class ShardedEstimator : public AdaptiveEstimator {
+public:
+    ///
+    /// Loads the given rows of the dataset (in increasing order) in a worker, scaled by the bandwidth
+    /// like DataIngest::X_ptr, with their weights or nullptr for unit weights.
+    ///
+    typedef std::function<void(const vector<long>& rows, shared_ptr<MatrixXd>& X, shared_ptr<VectorXd>& weights)>
+            ShardLoader;
+
+    /// Shard an in-memory dataset. Each worker copies its rows from the parent's (copy-on-write) pages.
+    /// \param data dataset
+    /// \param weights weight of each data point, or nullptr for unit weights
+    /// \param shards number of shards
+    /// \param k kernel
+    /// \param tau minimum density
+    /// \param eps relative error
+    /// \param opts construction options
+    ShardedEstimator(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, int shards, shared_ptr<Kernel> k,
+            double tau, double eps, const ShardOptions& opts);
+
+    /// Shard a dataset that each worker loads itself, so the parent never holds it.
+    /// \param n number of data points
+    /// \param load loads the rows of one shard, called in the worker
+    /// \param shards number of shards
+    /// \param k kernel
+    /// \param tau minimum density
+    /// \param eps relative error
+    /// \param opts construction options
+    ShardedEstimator(long n, ShardLoader load, int shards, shared_ptr<Kernel> k, double tau, double eps,
+            const ShardOptions& opts);
+
+    ///
+    /// Shut the workers down.
+    ~ShardedEstimator();
+
+    ShardedEstimator(const ShardedEstimator&) = delete;
+    ShardedEstimator& operator=(const ShardedEstimator&) = delete;
+
+    /// Loader that reads the rows of the shard from a CSV file or binary dataset (see ChunkReader),
+    /// divided by the bandwidth. The rows of other shards are skipped: seeked over or read through in a
+    /// binary dataset, and not parsed in a CSV file.
+    /// \param filename dataset
+    /// \param ignoreHeader whether the first line of a CSV file is a header
+    /// \param startCol first column to read
+    /// \param endCol last column to read
+    /// \param bandwidth bandwidth of each column
+    /// \param weightCol column of the point weights, or -1 for unit weights
+    static ShardLoader fileLoader(std::string filename, bool ignoreHeader, int startCol, int endCol,
+            vector<double> bandwidth, int weightCol = -1);
+
+    ///
+    /// Fan the query out to all shards and combine their estimates.
+    /// \param q query
+    /// \param trace if not nullptr, filled with the combined estimate and samples
+    /// \return estimate, total number of samples and the deepest level a shard stopped at
+    std::vector<double> estimate(VectorXd q, QueryTrace* trace) override;
+
+    ///
+    /// Shards walk their own levels: answer each query with estimate().
+    std::vector<std::vector<double>> estimateBatch(const MatrixXd& Q) override;
+
+    // queryWithin() and isAbove() are not supported: the level samplers live in the workers, and
+    // levelSampler() throws std::logic_error.
+
+    ///
+    /// \return number of shards
+    int shards() const { return workers.size(); }
+
+    ///
+    /// \return heap footprint of the hash tables of each shard (0 for RS)
+    vector<size_t> shardIndexBytes() const;
+
+protected:
+    ///
+    /// Not used: each shard walks its own levels.
+    std::vector<double> evaluateQuery(VectorXd q, int level, LevelTrace* trace) override;
+
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int fd = -1;
+        long rows = 0;
+        ///
+        /// Fraction of the total weight held by the shard
+        ///
+        double share = 0;
+        size_t indexBytes = 0;
+    };
+
+    vector<Worker> workers;
+    int dim = 0;
+    ///
+    /// Minimum density of the combined estimate
+    ///
+    double tau = 0;
+    std::mutex lock;
+
+    void start(long n, ShardLoader load, int shards, shared_ptr<Kernel> k, double tau, double eps,
+            const ShardOptions& opts);
+
+    ///
+    /// \return rows of the dataset assigned to a shard, in increasing order
+    static vector<long> shardRows(long n, int shard, int shards, uint64_t seed);
+
+    ///
+    /// Build the shard's estimator on the given rows and answer queries until shut down. Never returns.
+    [[noreturn]] static void serve(int fd, const vector<long>& rows, ShardLoader& load, shared_ptr<Kernel> k,
+            double tau, double eps, const ShardOptions& opts);
+
+    void shutdown();
+};
+
+#endif //HBE_SHARDEDESTIMATOR_H
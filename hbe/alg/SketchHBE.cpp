@@ -1,5 +1,7 @@
 #include "SketchHBE.h"
 
+SketchHBE::SketchHBE() {}
+
 SketchHBE::SketchHBE(shared_ptr<MatrixXd> X, int M, double w, int k, shared_ptr<Kernel> ker) {
     numTables = M;
     binWidth = w;
@@ -16,6 +18,7 @@ SketchHBE::SketchHBE(shared_ptr<MatrixXd> X, int M, double w, int k, shared_ptr<
         for (int j = 0; j < numTables / N_SKETCHES; j ++) {
             numPoints.push_back(t.samples);
             vector<pair<int, double>> samples = t.sample(t.samples, rng);
+            trackMass(samples, t.samples);
             tables.push_back(HashTable(X, w, k, samples, rng));
         }
     }
@@ -39,6 +42,7 @@ SketchHBE::SketchHBE(shared_ptr<MatrixXd> X, int M, double w, int k, int scales,
         for (int j = 0; j < numTables / N_SKETCHES; j ++) {
             numPoints.push_back(t.samples);
             vector<pair<int, double>> samples = t.sample(t.samples, rng);
+            trackMass(samples, t.samples);
             tables.push_back(HashTable(X, w, k, samples, rng, scales));
         }
     }
@@ -62,6 +66,7 @@ SketchHBE::SketchHBE(shared_ptr<MatrixXd> X, vector<SketchTable> &sketches, vect
             for (size_t s = 0; s < samples.size(); s ++) {
                 samples[s].first = indices[i][samples[s].first];
             }
+            trackMass(samples, t.samples);
             tables.push_back(HashTable(X, w, k, samples, rng));
         }
     }
@@ -71,30 +76,12 @@ SketchHBE::SketchHBE(shared_ptr<MatrixXd> X, vector<SketchTable> &sketches, vect
     }
 }
 
-
-vector<double> SketchHBE::MoM(VectorXd query, int L, int m) {
-    std::vector<double> Z = std::vector<double>(L, 0);
-    for (int i = 0; i < L; i ++) {
-        for (int j = 0; j < m; j ++){
-            Z[i] += evaluateQuery(query);
-        }
-    }
-    return Z;
+void SketchHBE::trackMass(const vector<pair<int, double>>& samples, int points) {
+    double mass = 0;
+    for (auto& s : samples) { mass += s.second; }
+    maxMass = max(maxMass, mass / points);
 }
 
-double SketchHBE::evaluateQuery(VectorXd query) {
-    idx = (idx + 1) % numTables;
-    auto buckets = tables[idx].sample(query);
-    double results = 0;
-    auto& bucket = buckets[0];
-    for (int j = 0; j < bucket.SCALES; j ++) {
-        if (bucket.count[j] > 0) {
-            VectorXd delta = bucket.sample[j] - query;
-            double c = delta.norm() / binWidth;
-            double p = mathUtils::collisionProb(c, numHash);
-            results += kernel->density(delta) / p * bucket.wSum[j];
-        }
-    }
-    results /= numPoints[idx];
-    return results;
-}
\ No newline at end of file
+double SketchHBE::sampleBound() {
+    return importanceBound(*kernel, binWidth, numHash, numProbes) * maxMass;
+}
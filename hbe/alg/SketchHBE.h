@@ -1,22 +1,17 @@
 #ifndef HBE_SKETCHLSH_H
 #define HBE_SKETCHLSH_H
 
-#include "HashBucket.h"
-#include "HashTable.h"
+#include "HashEstimator.h"
 #include "SketchTable.h"
-#include "MoMEstimator.h"
 
 
 ///
 /// HBE on HBS
 ///
-class SketchHBE : public MoMEstimator {
+class SketchHBE : public HashEstimator {
 
 public:
-    ///
-    /// A collection of hash tables for HBE.
-    ///
-    vector<HashTable> tables;
+    SketchHBE();
 
     /// Build N_SKETCHES number of sketches (HBS); sample from sketches to build hash tables for HBE
     /// \param X full dataset
@@ -47,33 +42,31 @@ public:
     SketchHBE(shared_ptr<MatrixXd> X, vector<SketchTable> &sketches, vector<vector<int>> &indices,
             int M, double w, int k, shared_ptr<Kernel> ker, std::mt19937_64& rng);
 
-protected:
     ///
-    /// Take a biased sample from a hash table via HBE.
-    /// \param query query point
-    /// \return normalized contribution of the biased sample
-    double evaluateQuery(VectorXd query);
-    vector<double> MoM(VectorXd query, int L, int m);
+    /// \return upper bound on a single sample, the range of the samples sampler() draws
+    /// (the sketch weights of a table may sum to more than the number of points it holds)
+    double sampleBound() override;
+
+protected:
+    double tableMass(int table) const override { return numPoints[table]; }
+    bool weighted() const override { return true; }
 
 private:
-    ///
-    /// Number of hash tables
-    ///
-    int numTables;
-    double binWidth;
-    int numHash;
     vector<int> numPoints;
-    shared_ptr<Kernel> kernel;
     ///
-    /// Index of hash table that we should sample from next.
+    /// Largest total sample weight of a table, relative to the number of points it holds
     ///
-    int idx = 0;
+    double maxMass = 0;
     ///
     /// Number of sketches to sample from
     ///
     int N_SKETCHES = 5;
 
     std::mt19937_64 rng;
+
+    ///
+    /// Account for the sample weights of a new table in maxMass.
+    void trackMass(const vector<pair<int, double>>& samples, int points);
 };
 
 
@@ -0,0 +1,99 @@
+#ifndef HBE_SKETCHPYRAMID_H
+#define HBE_SKETCHPYRAMID_H
+
+#include <boost/functional/hash.hpp>
+#include "SketchTable.h"
+
+///
+/// Multi-resolution HBS: one sketch per hashing scheme (w_l, k_l), coarsest first, where each level
+/// refines the buckets of the level above it. Level l hashes a point with the functions of level
+/// l - 1 plus k_l - k_{l-1} new functions of width w_l, so every bucket of level l lies inside a
+/// bucket of level l - 1. Points are projected once, onto the functions of the finest level, so
+/// building the pyramid costs about as much as a single sketch at the finest level.
+///
+class SketchPyramid {
+public:
+    ///
+    /// One sketch per level, coarsest first.
+    ///
+    vector<SketchTable> levels;
+
+    /// \param X points to sketch
+    /// \param w bin width of each level
+    /// \param k number of hash functions of each level, non-decreasing; a level with no more
+    ///     functions than the one above it has the same buckets
+    /// \param rng random number generator
+    SketchPyramid(shared_ptr<MatrixXd> X, const vector<double>& w, const vector<int>& k, std::mt19937_64 &rng) {
+        int n = X->rows();
+        int nlevels = w.size();
+        vector<int> functions = totalFunctions(k);
+        int K = functions.back();
+        G = mathUtils::randNormal(K, X->cols(), rng);
+        b = mathUtils::randUniform(K, rng);
+        MatrixXd project = G * X->transpose();
+
+        vector<size_t> keys(n, 0);
+        vector<int> ids(n);
+        for (int i = 0; i < n; i ++) { ids[i] = i; }
+        for (int l = 0; l < nlevels; l ++) {
+            int first = l == 0 ? 0 : functions[l - 1];
+            for (int i = 0; i < n; i ++) {
+                for (int j = first; j < functions[l]; j ++) {
+                    boost::hash_combine(keys[i], (int) ceil(project(j, i) / w[l] + b(j)));
+                }
+            }
+            levels.push_back(SketchTable());
+            levels.back().binWidth = w[l];
+            levels.back().numHash = functions[l];
+            levels.back().insertKeys(keys, ids);
+            levels.back().finalize();
+        }
+    }
+
+    ///
+    /// \return heap footprint of the pyramid
+    MemoryUsage memoryUsage() const {
+        MemoryUsage mem;
+        mem.hashing = heapBytes(G.size() * sizeof(double)) + heapBytes(b.size() * sizeof(double));
+        for (auto& level : levels) {
+            mem += level.memoryUsage();
+        }
+        return mem;
+    }
+
+    /// Predict the footprint of a pyramid before building it, assuming every point lands in its own
+    /// bucket at every level.
+    /// \param n number of points hashed into the pyramid
+    /// \param d dimension
+    /// \param k number of hash functions of each level
+    /// \return upper bound on the heap footprint of the pyramid
+    static MemoryUsage estimateMemory(int n, int d, const vector<int>& k) {
+        MemoryUsage mem;
+        for (size_t l = 0; l < k.size(); l ++) {
+            // Levels share the projections, counted once below
+            mem += SketchTable::estimateMemory(n, d, 0);
+        }
+        int K = totalFunctions(k).back();
+        mem.hashing = heapBytes(size_t(K) * d * sizeof(double)) + heapBytes(K * sizeof(double));
+        return mem;
+    }
+
+private:
+    ///
+    /// Gaussian projections shared by all levels, and the offset of each
+    ///
+    MatrixXd G;
+    VectorXd b;
+
+    ///
+    /// Number of functions each level hashes with: the running maximum of k.
+    static vector<int> totalFunctions(const vector<int>& k) {
+        vector<int> functions;
+        for (size_t l = 0; l < k.size(); l ++) {
+            functions.push_back(l == 0 ? k[l] : max(k[l], functions[l - 1]));
+        }
+        return functions;
+    }
+};
+
+#endif //HBE_SKETCHPYRAMID_H
@@ -2,6 +2,7 @@
 #define HBE_SKETCHTABLE_H
 
 #include "mathUtils.h"
+#include "MemoryUsage.h"
 #include <unordered_map>
 #include <vector>
 #include <exception>
@@ -26,35 +27,59 @@ public:
     double gamma = 1;
     int samples;
     int numHash;
+    int inserted = 0;
 
     SketchTable() {}
 
-    SketchTable(shared_ptr<MatrixXd> X, double w, int k, std::mt19937_64 &rng) {
+    SketchTable(shared_ptr<MatrixXd> X, double w, int k, std::mt19937_64 &rng) : SketchTable(X->cols(), w, k, rng) {
+        vector<int> ids(X->rows());
+        for (size_t i = 0; i < ids.size(); i ++) { ids[i] = i; }
+        insert(*X, ids);
+        finalize();
+    }
+
+    ///
+    /// Empty sketch, to be filled with insert() and sealed with finalize(). Lets the data be hashed
+    /// in chunks, e.g. while streaming it from disk.
+    /// \param d dimension
+    /// \param w bin width
+    /// \param k number of hash functions
+    SketchTable(int d, double w, int k, std::mt19937_64 &rng) {
         binWidth = w;
         numHash = k;
-
-        int d = X->cols();
         G = mathUtils::randNormal(k, d, rng) / binWidth;
         b = mathUtils::randUniform(k, rng);
+    }
 
-        int n = X->rows();
-        MatrixXd project(numHash, n);
-        for (int i = 0; i < n; i ++) { project.col(i) = b; }
-
-        project += G * X->transpose();
-        int t = 0;
+    ///
+    /// Hash points into the sketch.
+    /// \param X points, one per row
+    /// \param ids identifier of each row, returned by sample()
+    void insert(const MatrixXd& X, const vector<int>& ids) {
+        int n = X.rows();
+        MatrixXd project = G * X.transpose();
+        project.colwise() += b;
         for (int i = 0; i < n; i ++) {
-            VectorXd x = X->row(i);
-            size_t key = getkey(project.col(i));
-            auto it = table.find(key);
-            if (it == table.end()) {
-                vector<int> vec = {i};
-                table[key] = vec;
-                t += 1;
-            } else {
-                it->second.push_back(i);
-            }
+            table[getkey(project.col(i))].push_back(ids[i]);
+        }
+        inserted += n;
+    }
+
+    ///
+    /// Add points whose bucket keys were computed elsewhere (see SketchPyramid).
+    /// \param keys bucket key of each point
+    /// \param ids identifier of each point, returned by sample()
+    void insertKeys(const vector<size_t>& keys, const vector<int>& ids) {
+        for (size_t i = 0; i < keys.size(); i ++) {
+            table[keys[i]].push_back(ids[i]);
         }
+        inserted += keys.size();
+    }
+
+    ///
+    /// Compute the bucket sampling distribution once all points are inserted.
+    void finalize() {
+        int n = inserted;
         size_t max_bucket = 0;
         size_t min_bucket = n;
         for (unordered_map<size_t, vector<int>>::iterator it=table.begin(); it!=table.end(); ++it) {
@@ -65,6 +90,7 @@ public:
             bucket_size.push_back(size);
         }
         size_t nbuckets = bucket_keys.size();
+        int t = nbuckets;
 
         // Set sketch parameters
         double eps = 0.5;
@@ -118,6 +144,44 @@ public:
         }
         return samples;
     }
+
+    ///
+    /// \return heap footprint of the sketch
+    MemoryUsage memoryUsage() const {
+        MemoryUsage mem;
+        mem.tables = 1;
+        mem.hashing = heapBytes(G.size() * sizeof(double)) + heapBytes(b.size() * sizeof(double));
+        mem.buckets = heapBytes(table.bucket_count() * sizeof(void*)) + table.size() * heapBytes(NODE_BYTES)
+            + heapBytes(bucket_keys.capacity() * sizeof(size_t)) + heapBytes(bucket_size.capacity() * sizeof(size_t))
+            + heapBytes(weights.capacity() * sizeof(double))
+            // discrete_distribution keeps the probabilities and their cumulative sums
+            + 2 * heapBytes(bucket_keys.size() * sizeof(double));
+        for (auto& it : table) {
+            mem.samples += heapBytes(it.second.capacity() * sizeof(int));
+        }
+        return mem;
+    }
+
+    /// Predict the footprint of a sketch before building it, assuming every point lands in its own bucket.
+    /// \param n number of points hashed into the sketch
+    /// \param k number of hash functions
+    /// \param d dimension
+    /// \return upper bound on the heap footprint of the sketch
+    static MemoryUsage estimateMemory(int n, int d, int k) {
+        MemoryUsage mem;
+        mem.tables = 1;
+        mem.hashing = heapBytes(size_t(k) * d * sizeof(double)) + heapBytes(k * sizeof(double));
+        mem.buckets = heapBytes(size_t(n) * 2 * sizeof(void*)) + size_t(n) * heapBytes(NODE_BYTES)
+            + 2 * heapBytes(size_t(n) * sizeof(size_t)) + 3 * heapBytes(size_t(n) * sizeof(double));
+        mem.samples = size_t(n) * heapBytes(sizeof(int));
+        return mem;
+    }
+
+private:
+    ///
+    /// Size of an unordered_map node: next pointer plus the stored key/index list pair.
+    ///
+    static constexpr size_t NODE_BYTES = sizeof(void*) + sizeof(pair<const size_t, vector<int>>);
 };
 
 
@@ -38,32 +38,43 @@ UniformHBE::UniformHBE(shared_ptr<MatrixXd> X, int M, double w, int k,
 
 }
 
+UniformHBE::UniformHBE(shared_ptr<MatrixXd> X, shared_ptr<VectorXd> weights, int M, double w, int k,
+                 shared_ptr<Kernel> ker, int subsample) {
+    if (weights == nullptr) {
+        *this = UniformHBE(X, M, w, k, ker, subsample);
+        return;
+    }
+    numTables = M;
+    binWidth = w;
+    numHash = k;
+    numPoints = X->rows();
+    kernel = ker;
 
+    std::random_device rd;  //Will be used to obtain a seed for the random number engine
+    rng = std::mt19937_64(rd());
 
-vector<double> UniformHBE::MoM(VectorXd query, int L, int m) {
-    std::vector<double> Z = std::vector<double>(L, 0);
-    for (int i = 0; i < L; i ++) {
-        for (int j = 0; j < m; j ++){
-            Z[i] += evaluateQuery(query);
+    // Tables are built on random blocks of a shuffled index, as in the unweighted case
+    vector<int> perm(numPoints);
+    for (int i = 0; i < numPoints; i ++) { perm[i] = i; }
+    std::shuffle(perm.begin(), perm.end(), rng);
+    if (subsample <= 1 || subsample >= numPoints) { subsample = numPoints; }
+    std::uniform_int_distribution<int> start(0, numPoints - subsample);
+    for (int i = 0; i < numTables; i ++) {
+        int idx = start(rng);
+        vector<pair<int, double>> samples;
+        double total = 0;
+        for (int j = idx; j < idx + subsample; j ++) {
+            samples.push_back(make_pair(perm[j], (*weights)(perm[j])));
+            total += (*weights)(perm[j]);
         }
+        tables.push_back(HashTable(X, w, k, samples, rng));
+        tableWeights.push_back(total);
     }
-    return Z;
+    numPoints = subsample;
 }
 
-double UniformHBE::evaluateQuery(VectorXd query) {
-    idx = (idx + 1) % numTables;
-    auto buckets = tables[idx].sample(query);
-    double results = 0;
-    auto& bucket = buckets[0];
-    for (int j = 0; j < bucket.SCALES; j ++) {
-        int cnt = bucket.count[j];
-        if (cnt > 0) {
-            VectorXd delta = bucket.sample[j] - query;
-            double c = delta.norm() / binWidth;
-            double p = mathUtils::collisionProb(c, numHash);
-            results += kernel->density(delta) / p * cnt;
-        }
-    }
-    results /= numPoints;
-    return results;
+
+double UniformHBE::sampleBound() {
+    // The buckets of a table hold at most its total count or weight
+    return importanceBound(*kernel, binWidth, numHash, numProbes);
 }
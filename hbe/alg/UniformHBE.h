@@ -1,20 +1,13 @@
 #ifndef HBE_BASELSH_H
 #define HBE_BASELSH_H
 
-#include "HashBucket.h"
-#include "HashTable.h"
-#include "MoMEstimator.h"
+#include "HashEstimator.h"
 
 ///
 /// HBE on Uniform samples
 ///
-class UniformHBE : public MoMEstimator {
+class UniformHBE : public HashEstimator {
 public:
-    ///
-    /// A collection of hash tables for HBE.
-    ///
-    vector<HashTable> tables;
-
     UniformHBE();
 
     ///
@@ -26,27 +19,35 @@ public:
     /// \param subsample build table on a random subsample number of points from the original dataset
     UniformHBE(shared_ptr<MatrixXd> X, int M, double w, int k, shared_ptr<Kernel> ker, int subsample);
 
-protected:
     ///
-    /// Take a biased sample from a hash table via HBE.
-    /// \param query query point
-    /// \return normalized contribution of the biased sample
-    double evaluateQuery(VectorXd query);
-    std::vector<double> MoM(VectorXd query, int L, int m);
+    /// HBE on a weighted dataset. Buckets keep the weight sum of their points and a sample drawn with
+    /// probability proportional to weight; each table is normalized by the total weight it holds.
+    /// \param X dataset
+    /// \param weights weight of each data point, or nullptr for unit weights
+    /// \param M number of samples
+    /// \param w bin width
+    /// \param k number of hash functions
+    /// \param ker kernel function
+    /// \param subsample build table on a random subsample number of points from the original dataset
+    UniformHBE(shared_ptr<MatrixXd> X, shared_ptr<VectorXd> weights, int M, double w, int k,
+            shared_ptr<Kernel> ker, int subsample);
+
+    ///
+    /// \return upper bound on a single sample, the range of the samples sampler() draws
+    double sampleBound() override;
+
+protected:
+    double tableMass(int table) const override {
+        return tableWeights.empty() ? numPoints : tableWeights[table];
+    }
+    bool weighted() const override { return !tableWeights.empty(); }
 
 private:
-    ///
-    /// Number of hash tables
-    ///
-    int numTables;
-    double binWidth;
-    int numHash;
     int numPoints;
-    shared_ptr<Kernel> kernel;
     ///
-    /// Index of hash table that we should sample from next.
+    /// Total weight of the points in each table; empty if the points are unweighted.
     ///
-    int idx = 0;
+    vector<double> tableWeights;
     std::mt19937_64 rng;
 
 };
@@ -7,8 +7,21 @@ naiveKDE::naiveKDE(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k) {
     numPoints = data->rows();
 }
 
+naiveKDE::naiveKDE(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, shared_ptr<Kernel> k) {
+    X = data;
+    W = weights;
+    kernel = k;
+    numPoints = data->rows();
+}
+
 double naiveKDE::query(VectorXd q) {
     double kde = 0;
+    if (W != nullptr) {
+        for (int i = 0; i < numPoints; i++) {
+            kde += (*W)(i) * kernel->density(q, X->row(i));
+        }
+        return kde / W->sum();
+    }
     for (int i = 0; i < numPoints; i++) {
         kde += kernel->density(q, X->row(i));
     }
@@ -14,9 +14,16 @@ using Eigen::VectorXd;
 class naiveKDE {
 public:
     naiveKDE(shared_ptr<MatrixXd> data, shared_ptr<Kernel> k);
+
+    /// Weighted KDE: sum_i w_i k(x_i, q) / sum_i w_i
+    /// \param data dataset
+    /// \param weights weight of each data point, or nullptr for unit weights
+    /// \param k kernel
+    naiveKDE(shared_ptr<MatrixXd> data, shared_ptr<VectorXd> weights, shared_ptr<Kernel> k);
     double query(VectorXd q);
 private:
     shared_ptr<MatrixXd> X;
+    shared_ptr<VectorXd> W;
     int numPoints;
     shared_ptr<Kernel> kernel;
 };
@@ -13,6 +13,17 @@ typedef Eigen::Matrix<double, 1, Eigen::Dynamic> RowVector;
 
 const static IOFormat CSVFormat(Eigen::StreamPrecision, Eigen::DontAlignCols, ", ", "\n");
 
+// Values generated per parallel batch in write(), ~128MB
+const static long BATCH_VALUES = 1L << 24;
+
+// splitmix64 finalizer, to derive independent seeds for the chunks of write()
+static uint64_t mixSeed(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
 GenericInstance::GenericInstance(int p, int c, int s, int d, double density, double spread) {
     std::random_device rd;  //Will be used to obtain a seed for the random number engine
     rng = std::mt19937_64(rd());
@@ -21,46 +32,10 @@ GenericInstance::GenericInstance(int p, int c, int s, int d, double density, dou
     numClusters = c;
     numScales = std::max(s, 2);
     dim = d;
+    this->spread = spread;
 
-    directions.clear();
-    for (int i = 0; i < c; i ++) {
-        VectorXd x = mathUtils::randNormal(d, rng);
-        double n = x.norm();
-        x /= n;
-        directions.push_back(x);
-    }
-
-    double dist = mathUtils::inverseExp(density);
-    // np.linspace(0, dist, num_scales)
-    double scales[numScales];
-    double interval = dist / (numScales - 1);
-    scales[0] = 0;
-    for (int i = 1; i < numScales; i ++) {
-        scales[i] = scales[i - 1] + interval;
-    }
-
-    // Calculate number of points in each scale such that the contribution
-    // of all distance scale is the same up to constant factors
-    int N = 0;
-    int sizes[numScales];
-    for (int i = 0; i < numScales; i ++) {
-        sizes[i] = (int) floor(numPoints * density / mathUtils::expKernel(scales[i]));
-        N += sizes[i];
-    }
-    N *= numClusters;
-
-    // Generate Points
-    int cnt = 0;
-    points = MatrixXd::Zero(N, d);
-    for (int i = 0; i < numClusters; i ++) {
-        for (int j = 0; j < numScales; j ++) {
-            double scale = spread * scales[j] / sqrt(dim);
-            MatrixXd rand = mathUtils::randNormal(sizes[j], dim, rng) * scale;
-            VectorXd vec = directions.at(i) * scales[j];
-            points.block(cnt, 0, sizes[j], d) = rand + MatrixXd::Ones(sizes[j], 1) * vec.transpose();
-            cnt += sizes[j];
-        }
-    }
+    plan(density, mathUtils::inverseExp(density), mathUtils::expKernel);
+    generate();
 }
 
 
@@ -72,48 +47,115 @@ GenericInstance::GenericInstance(int p, int c, int s, int d, double density, dou
     numClusters = c;
     numScales = std::max(s, 2);
     dim = d;
+    this->spread = spread;
+
+    plan(density, kernel->invDensity(density), [&](double x) { return kernel->density(x); });
+    generate();
+}
+
+GenericInstance::GenericInstance(int p, int c, int s, int d, double density, double spread,
+        shared_ptr<Kernel> kernel, uint64_t seed) {
+    rng = std::mt19937_64(seed);
+    this->seed = seed;
+
+    numPoints = p;
+    numClusters = c;
+    numScales = std::max(s, 2);
+    dim = d;
+    this->spread = spread;
+
+    plan(density, kernel->invDensity(density), [&](double x) { return kernel->density(x); });
+}
 
+void GenericInstance::plan(double density, double dist, const std::function<double(double)>& kernelAt) {
     directions.clear();
-    for (int i = 0; i < c; i ++) {
-        VectorXd x = mathUtils::randNormal(d, rng);
+    for (int i = 0; i < numClusters; i ++) {
+        VectorXd x = mathUtils::randNormal(dim, rng);
         double n = x.norm();
         x /= n;
         directions.push_back(x);
     }
 
-    double dist = kernel->invDensity(density);
     // np.linspace(0, dist, num_scales)
-    double scales[numScales];
+    scales.assign(numScales, 0);
     double interval = dist / (numScales - 1);
-    scales[0] = 0;
     for (int i = 1; i < numScales; i ++) {
         scales[i] = scales[i - 1] + interval;
     }
 
     // Calculate number of points in each scale such that the contribution
     // of all distance scale is the same up to constant factors
-    int N = 0;
-    int sizes[numScales];
+    sizes.assign(numScales, 0);
     for (int i = 0; i < numScales; i ++) {
-        sizes[i] = (int) floor(numPoints * density / kernel->density(scales[i]));
-        N += sizes[i];
+        sizes[i] = (long) floor(numPoints * density / kernelAt(scales[i]));
     }
-    N *= numClusters;
+}
 
+void GenericInstance::generate() {
     // Generate Points
     int cnt = 0;
-    points = MatrixXd::Zero(N, d);
+    points = MatrixXd::Zero(size(), dim);
     for (int i = 0; i < numClusters; i ++) {
         for (int j = 0; j < numScales; j ++) {
             double scale = spread * scales[j] / sqrt(dim);
             MatrixXd rand = mathUtils::randNormal(sizes[j], dim, rng) * scale;
             VectorXd vec = directions.at(i) * scales[j];
-            points.block(cnt, 0, sizes[j], d) = rand + MatrixXd::Ones(sizes[j], 1) * vec.transpose();
+            points.block(cnt, 0, sizes[j], dim) = rand + MatrixXd::Ones(sizes[j], 1) * vec.transpose();
             cnt += sizes[j];
         }
     }
 }
 
+long GenericInstance::size() const {
+    long N = 0;
+    for (int i = 0; i < numScales; i ++) {
+        N += sizes[i];
+    }
+    return N * numClusters;
+}
+
+void GenericInstance::write(BinaryDatasetWriter& out, int chunkRows) {
+    struct Chunk { int cluster; int scale; long chunk; int rows; };
+    std::vector<Chunk> batch;
+    std::vector<MatrixXd> blocks;
+    long batchValues = 0;
+
+    auto flush = [&]() {
+        blocks.resize(batch.size());
+#pragma omp parallel for schedule(dynamic)
+        for (size_t t = 0; t < batch.size(); t ++) {
+            const Chunk& c = batch[t];
+            uint64_t s = mixSeed(seed);
+            s = mixSeed(s ^ (uint64_t) c.cluster);
+            s = mixSeed(s ^ (uint64_t) c.scale);
+            s = mixSeed(s ^ (uint64_t) c.chunk);
+            std::mt19937_64 chunkRng(s);
+            double scale = spread * scales[c.scale] / sqrt(dim);
+            VectorXd vec = directions.at(c.cluster) * scales[c.scale];
+            blocks[t] = mathUtils::randNormal(c.rows, dim, chunkRng) * scale;
+            blocks[t].rowwise() += vec.transpose();
+        }
+        for (auto& block : blocks) {
+            out.append(block);
+        }
+        batch.clear();
+        blocks.clear();
+        batchValues = 0;
+    };
+
+    for (int i = 0; i < numClusters; i ++) {
+        for (int j = 0; j < numScales; j ++) {
+            for (long t = 0; t * chunkRows < sizes[j]; t ++) {
+                int rows = (int) std::min((long) chunkRows, sizes[j] - t * chunkRows);
+                batch.push_back({i, j, t, rows});
+                batchValues += (long) rows * dim;
+                if (batchValues >= BATCH_VALUES) { flush(); }
+            }
+        }
+    }
+    flush();
+}
+
 void GenericInstance::merge(MatrixXd data) {
     assert(data.cols() == dim);
 
@@ -2,9 +2,12 @@
 #define HBE_GENERICINSTANCE_H
 
 #include <Eigen/Dense>
+#include <cstdint>
+#include <functional>
 #include <random>
 #include <memory>
 #include "kernel.h"
+#include "BinaryDataset.h"
 
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
@@ -15,6 +18,13 @@ private:
     int numClusters;
     int numScales;
     int dim;
+    double spread;
+    uint64_t seed = 0;
+    std::vector<double> scales;
+    std::vector<long> sizes;
+
+    void plan(double density, double dist, const std::function<double(double)>& kernelAt);
+    void generate();
 
 public:
     std::vector<VectorXd> directions;
@@ -27,6 +37,24 @@ public:
     GenericInstance(int numPoints, int numClusters, int numScales, int dim,
                     double density, double spread, shared_ptr<Kernel> kernel);
 
+    ///
+    /// Plan an instance without generating its points, for instances too large for memory:
+    /// write() then generates the points chunk by chunk. Each chunk is drawn from its own
+    /// generator seeded by (seed, cluster, scale, chunk), so the same seed gives the same
+    /// dataset regardless of the number of threads.
+    GenericInstance(int numPoints, int numClusters, int numScales, int dim,
+                    double density, double spread, shared_ptr<Kernel> kernel, uint64_t seed);
+
+    ///
+    /// \return number of points of the instance
+    long size() const;
+
+    /// Generate the points in parallel chunks and append them to a binary dataset, cluster by
+    /// cluster and scale by scale, in the order the in-memory constructors lay them out.
+    /// \param out binary dataset to append to
+    /// \param chunkRows number of points per chunk
+    void write(BinaryDatasetWriter& out, int chunkRows);
+
     void merge(MatrixXd data);
 
     VectorXd query(double dist, bool correlated);
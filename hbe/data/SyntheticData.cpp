@@ -21,6 +21,27 @@ GenericInstance SyntheticData::genSingle(int pts, int clusters, int dim, double
     return inst;
 }
 
+GenericInstance SyntheticData::writeSingle(std::string fname, int pts, int clusters, int dim, double density,
+        int numScales, double spread, shared_ptr<Kernel> kernel, uint64_t seed, int chunkRows) {
+    GenericInstance inst(pts, clusters, numScales, dim, density, spread, kernel, seed);
+    BinaryDatasetWriter out(fname, dim);
+    inst.write(out, chunkRows);
+    out.close();
+    return inst;
+}
+
+GenericInstance SyntheticData::writeMixed(std::string fname, int uN, int cN, int uC, int cC, int dim,
+        double density, int numScales, double spread, shared_ptr<Kernel> kernel, uint64_t seed, int chunkRows) {
+    GenericInstance uncorrelated(uN, uC, numScales, dim, density, spread, kernel, seed);
+    // A different seed, so the two instances do not share directions
+    GenericInstance correlated(cN, cC, numScales, dim, density, spread, kernel, seed + 1);
+    BinaryDatasetWriter out(fname, dim);
+    uncorrelated.write(out, chunkRows);
+    correlated.write(out, chunkRows);
+    out.close();
+    return uncorrelated;
+}
+
 GenericInstance SyntheticData::genUncorrelated(int n) {
     // Uncorrelated instance
     int numClusters = (int)ceil(sqrt(n));
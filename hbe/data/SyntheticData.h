@@ -12,6 +12,20 @@ public:
             int numScales, double spread, shared_ptr<Kernel> kernel);
 
     static GenericInstance genUncorrelated(int n);
+
+    /// Stream a single instance to a binary dataset (see BinaryDataset) without holding it in memory.
+    /// \param fname output file
+    /// \param seed seed of the instance; the same seed writes the same file
+    /// \param chunkRows number of points generated per chunk
+    /// \return the planned instance, to draw queries from
+    static GenericInstance writeSingle(std::string fname, int pts, int clusters, int dim, double density,
+            int numScales, double spread, shared_ptr<Kernel> kernel, uint64_t seed, int chunkRows);
+
+    /// Stream a mixed instance to a binary dataset: the uncorrelated points followed by the
+    /// correlated ones, as genMixed lays them out.
+    /// \return the planned uncorrelated instance, to draw queries from
+    static GenericInstance writeMixed(std::string fname, int uN, int cN, int uC, int cC, int dim, double density,
+            int numScales, double spread, shared_ptr<Kernel> kernel, uint64_t seed, int chunkRows);
 };
 
 
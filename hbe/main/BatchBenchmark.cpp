@@ -15,6 +15,15 @@
  *
  *  Example usage:
  *      ./hbe conf/shuttle.cfg gaussian
+ *
+ *      ./hbe conf/shuttle.cfg gaussian --serial
+ *          => Answer the queries one at a time (MoMEstimator::query) instead of as one batch
+ *             (MoMEstimator::queryBatch)
+ *
+ *      ./hbe conf/shuttle.cfg gaussian --output=shuttle.res
+ *          => Also write every query of every round (id, algorithm, samples, estimate, exact
+ *             density, nanoseconds) and the run parameters to a columnar binary file
+ *             (utils/ResultWriter.h)
  */
 
 
@@ -23,6 +32,7 @@
 #include <chrono>
 #include "parseConfig.h"
 #include "../utils/DataIngest.h"
+#include "../utils/ResultWriter.h"
 #include "../alg/RS.h"
 #include "../alg/naiveKDE.h"
 #include "../alg/UniformHBE.h"
@@ -32,6 +42,63 @@ double relErr(double est, double exact) {
     return fabs(est - exact) / exact;
 }
 
+double secondsSince(std::chrono::high_resolution_clock::time_point t1) {
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0;
+}
+
+///
+/// Per-query rows of --output, for all algorithms and rounds.
+///
+struct Rows {
+    vector<int64_t> id, alg, nanos;
+    vector<double> samples, estimate, exact;
+
+    /// Run one query and record it.
+    /// \return estimate
+    template <typename F>
+    double run(int j, int a, int n, double exact_val, F query) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        double est = query();
+        auto t2 = std::chrono::high_resolution_clock::now();
+        id.push_back(j);
+        alg.push_back(a);
+        nanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count());
+        samples.push_back(n);
+        estimate.push_back(est);
+        exact.push_back(exact_val);
+        return est;
+    }
+
+    /// Run a batch of queries and record each with an equal share of the batch's time.
+    /// \return estimates
+    template <typename F>
+    VectorXd runBatch(const vector<int>& ids, int a, int n, const vector<double>& exact_vals, F query) {
+        VectorXd est;
+        auto t1 = std::chrono::high_resolution_clock::now();
+        query(est);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        long share = std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count() / max(int(ids.size()), 1);
+        for (size_t j = 0; j < ids.size(); j ++) {
+            id.push_back(ids[j]);
+            alg.push_back(a);
+            nanos.push_back(share);
+            samples.push_back(n);
+            estimate.push_back(est(j));
+            exact.push_back(exact_vals[j]);
+        }
+        return est;
+    }
+};
+
+vector<double> relErrs(const VectorXd& est, const vector<double>& exact) {
+    vector<double> err;
+    for (size_t j = 0; j < exact.size(); j ++) {
+        err.push_back(relErr(est(j), exact[j]));
+    }
+    return err;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         std::cout << "Need config file" << std::endl;
@@ -39,6 +106,16 @@ int main(int argc, char *argv[]) {
     }
 
     char* scope = argv[2];
+    std::string output_path;
+    bool serial = false;
+    for (int i = 3; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--output=") == 0) {
+            output_path = arg.substr(9);
+        } else if (arg == "--serial") {
+            serial = true;
+        }
+    }
     parseConfig cfg(argv[1], scope);
     DataIngest data(cfg, true);
     data.estimateHashParams();
@@ -52,22 +129,29 @@ int main(int argc, char *argv[]) {
     int subsample = int(sqrt(data.N));
     std::cout << "M=" << tables << ",w=" << data.w << ",k=" << data.k << ",samples=" << subsample << std::endl;
     auto t1 = std::chrono::high_resolution_clock::now();
-    UniformHBE hbe(data.X_ptr, tables, data.w, data.k, data.kernel, subsample);
-    auto t2 = std::chrono::high_resolution_clock::now();
-    std::cout << "Uniform Sample Table Init: " <<
-        std::chrono::duration_cast<std::chrono::seconds>(t2-t1).count() << std::endl;
+    UniformHBE hbe(data.X_ptr, data.W_ptr, tables, data.w, data.k, data.kernel, subsample);
+    double uniform_build = secondsSince(t1);
+    std::cout << "Uniform Sample Table Init: " << (int) uniform_build << std::endl;
+
+    // HBS and the RS reservoir treat their input as unweighted: for weighted data,
+    // build them on a sample of the same size drawn with probability proportional to weight.
+    shared_ptr<MatrixXd> X_unweighted = data.X_ptr;
+    if (data.W_ptr != nullptr) {
+        std::random_device rd;
+        std::mt19937_64 rng(rd());
+        vector<int> indices;
+        X_unweighted = dataUtils::downSample(data.X_ptr, mathUtils::cumulative(*data.W_ptr), indices, data.N, rng);
+    }
 
     t1 = std::chrono::high_resolution_clock::now();
-    SketchHBE sketch(data.X_ptr, tables, data.w, data.k, data.kernel);
-    t2 = std::chrono::high_resolution_clock::now();
-    std::cout << "Sketch Table Init: " <<
-        std::chrono::duration_cast<std::chrono::seconds>(t2-t1).count() << std::endl;
+    SketchHBE sketch(X_unweighted, tables, data.w, data.k, data.kernel);
+    double sketch_build = secondsSince(t1);
+    std::cout << "Sketch Table Init: " << (int) sketch_build << std::endl;
 
     t1 = std::chrono::high_resolution_clock::now();
-    SketchHBE sketch4(data.X_ptr, tables, data.w, data.k, 3, data.kernel);
-    t2 = std::chrono::high_resolution_clock::now();
-    std::cout << "Sketch Table Init (3 scales): " <<
-        std::chrono::duration_cast<std::chrono::seconds>(t2-t1).count() << std::endl;
+    SketchHBE sketch4(X_unweighted, tables, data.w, data.k, 3, data.kernel);
+    double sketch3_build = secondsSince(t1);
+    std::cout << "Sketch Table Init (3 scales): " << (int) sketch3_build << std::endl;
 
     double cnt = 0;
     for (auto& t : hbe.tables) {
@@ -77,9 +161,22 @@ int main(int argc, char *argv[]) {
 
     int rs_size = min(int(cnt), data.N);
     std::cout << "RS reservoir size: " << rs_size << std::endl;
-    RS rs(data.X_ptr, data.kernel, rs_size);
+    RS rs(X_unweighted, data.kernel, rs_size);
 
     bool hbe_done = false, hbs_done = false, hbs3_done = false, rs_done = false;
+    Rows rows;
+
+    // Queries above tau, answered together unless --serial
+    vector<int> ids;
+    vector<double> exact;
+    for (int j = 0; j < data.M; j++) {
+        if (data.exact[j * 2] >= data.tau) {
+            ids.push_back(j);
+            exact.push_back(data.exact[j * 2]);
+        }
+    }
+    MatrixXd Q(ids.size(), data.dim);
+    for (size_t j = 0; j < ids.size(); j ++) { Q.row(j) = data.getQuery(ids[j]); }
 
     int samples = 50;
     do {
@@ -95,33 +192,48 @@ int main(int argc, char *argv[]) {
         vector<double> rs_error;
         vector<double> sketch_scale_error;
 
-        for(int j = 0; j < data.M; j++) {
-            int idx = j * 2;
-            VectorXd q = data.X_ptr->row(j);
-            if (data.hasQuery != 0) {
-                q = data.Y_ptr->row(j);
-            } else {
-                if (!data.sequential) {
-                    q = data.X_ptr->row(data.exact[idx + 1]);
-                }
+        int rs_samples = int(samples * data.sample_ratio);
+        if (!serial) {
+            if (!hbe_done) {
+                hbe_error = relErrs(rows.runBatch(ids, 0, samples, exact,
+                        [&](VectorXd& out) { hbe.queryBatch(Q, data.tau, samples, out); }), exact);
+            }
+            if (!hbs_done) {
+                sketch_error = relErrs(rows.runBatch(ids, 1, samples, exact,
+                        [&](VectorXd& out) { sketch.queryBatch(Q, data.tau, samples, out); }), exact);
             }
-            double exact_val = data.exact[idx];
+            if (!hbs3_done) {
+                sketch_scale_error = relErrs(rows.runBatch(ids, 2, samples, exact,
+                        [&](VectorXd& out) { sketch4.queryBatch(Q, data.tau, samples, out); }), exact);
+            }
+            if (!rs_done) {
+                rs_error = relErrs(rows.runBatch(ids, 3, rs_samples, exact,
+                        [&](VectorXd& out) { rs.queryBatch(Q, data.tau, rs_samples, out); }), exact);
+            }
+        }
+
+        for(int j = 0; serial && j < data.M; j++) {
+            VectorXd q = data.getQuery(j);
+            double exact_val = data.exact[j * 2];
             if (exact_val < data.tau) { continue; }
 
             if (!hbe_done) {
-                double hbe_est = hbe.query(q, data.tau, samples);
+                double hbe_est = rows.run(j, 0, samples, exact_val, [&] { return hbe.query(q, data.tau, samples); });
                 hbe_error.push_back(relErr(hbe_est, exact_val));
             }
             if (!hbs_done) {
-                double sketch_est = sketch.query(q, data.tau, samples);
+                double sketch_est = rows.run(j, 1, samples, exact_val,
+                        [&] { return sketch.query(q, data.tau, samples); });
                 sketch_error.push_back(relErr(sketch_est,exact_val));
             }
             if (!hbs3_done) {
-                double sketch_scale_est = sketch4.query(q, data.tau, samples);
+                double sketch_scale_est = rows.run(j, 2, samples, exact_val,
+                        [&] { return sketch4.query(q, data.tau, samples); });
                 sketch_scale_error.push_back(relErr(sketch_scale_est, exact_val));
             }
             if (!rs_done) {
-                double rs_est = rs.query(q, data.tau, int(samples * data.sample_ratio));
+                double rs_est = rows.run(j, 3, rs_samples, exact_val,
+                        [&] { return rs.query(q, data.tau, rs_samples); });
                 rs_error.push_back(relErr(rs_est, exact_val));
             }
 
@@ -164,4 +276,31 @@ int main(int argc, char *argv[]) {
             }
         }
     } while (!hbe_done || !hbs_done || !hbs3_done || !rs_done);
+
+    if (!output_path.empty()) {
+        ResultWriter out(output_path);
+        out.meta("algorithms", "uniform_hbe,sketch_hbe,sketch3_hbe,rs");
+        out.meta("eps", data.eps);
+        out.meta("tau", data.tau);
+        out.meta("h", data.h);
+        out.meta("n", data.N);
+        out.meta("dim", data.dim);
+        out.meta("k", data.k);
+        out.meta("w", data.w);
+        out.meta("tables", tables);
+        out.meta("subsample", subsample);
+        out.meta("rs_size", rs_size);
+        out.meta("sample_ratio", data.sample_ratio);
+        out.meta("uniform_hbe_build_seconds", uniform_build);
+        out.meta("sketch_hbe_build_seconds", sketch_build);
+        out.meta("sketch3_hbe_build_seconds", sketch3_build);
+        out.column("id", rows.id);
+        // Index into the "algorithms" entry
+        out.column("algorithm", rows.alg);
+        out.column("samples", rows.samples);
+        out.column("estimate", rows.estimate);
+        out.column("exact", rows.exact);
+        out.column("nanos", rows.nanos);
+        out.write();
+    }
 }
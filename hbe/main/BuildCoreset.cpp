@@ -0,0 +1,156 @@
+/*
+ *  Coreset export:
+ *      Build an HBS sketch of m weighted points and write it to a binary coreset file (see
+ *      utils/Coreset.h) that downstream services can evaluate the KDE on without the full dataset.
+ *
+ *      By default the dataset is streamed from disk in chunks and never held in memory: one pass
+ *      estimates the diameter (and with it the hashing scheme), one pass hashes the rows into the
+ *      sketch tables in parallel, and one pass collects the sampled points. --in-memory loads the
+ *      dataset with DataIngest instead.
+ *
+ *      --eval reads the file back and reports the relative error of the coreset KDE against the
+ *      exact densities of the config.
+ *
+ *  Example usage:
+ *      ./hbe_coreset conf/shuttle.cfg gaussian 10000 shuttle.coreset
+ *          => Stream shuttle in chunks of 100000 rows into a 10000-point coreset
+ *
+ *      ./hbe_coreset conf/shuttle.cfg gaussian 10000 shuttle.coreset --tables=10 --chunk=20000 --eval
+ */
+
+#include <chrono>
+#include "../alg/HBS.h"
+#include "../utils/ChunkReader.h"
+#include "../utils/Coreset.h"
+#include "../utils/DataIngest.h"
+#include "parseConfig.h"
+
+double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count() / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        std::cout << "Usage: ./hbe_coreset <config> <scope> <m> <output> [--tables=T] [--chunk=rows] "
+                     "[--in-memory] [--eval]" << std::endl;
+        exit(1);
+    }
+
+    char *scope = argv[2];
+    int m = atoi(argv[3]);
+    std::string output = argv[4];
+    int ntbls = 5;
+    int chunk_rows = 100000;
+    bool in_memory = false;
+    bool eval = false;
+    for (int i = 5; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--tables=") == 0) {
+            ntbls = std::max(2, atoi(arg.c_str() + 9));
+        } else if (arg.compare(0, 8, "--chunk=") == 0) {
+            chunk_rows = std::max(1, atoi(arg.c_str() + 8));
+        } else if (arg == "--in-memory") {
+            in_memory = true;
+        } else if (arg == "--eval") {
+            eval = true;
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    parseConfig cfg(argv[1], scope);
+    int n = cfg.getN();
+    int d = cfg.getDim();
+    double h = DataIngest::getBandwidth(cfg);
+    vector<double> bw(d, h);
+    double tau = cfg.getTau();
+    double beta = 0.5;
+    try {
+        beta = cfg.getBeta();
+    } catch (...) {}
+
+    std::random_device rd;
+    std::mt19937_64 rng(rd());
+
+    Coreset coreset;
+    coreset.kernel = cfg.getKernel();
+    coreset.sourceRows = n;
+    coreset.bandwidth = bw;
+    vector<pair<int, double>> samples;
+
+    auto start = std::chrono::steady_clock::now();
+    if (in_memory) {
+        DataIngest data(cfg, false);
+        data.estimateHashParams();
+        std::cout << "k=" << data.k << ", w=" << data.w << std::endl;
+        HBS hbs(data.X_ptr, m, data.w, data.k, ntbls, rng);
+        samples = hbs.final_samples;
+        coreset.points.resize(samples.size(), d);
+        for (size_t i = 0; i < samples.size(); i ++) {
+            coreset.points.row(i) = data.X_ptr->row(samples[i].first) * h;
+        }
+    } else {
+        ChunkReader reader(cfg.getDataFile(), cfg.ignoreHeader(), n, cfg.getStartCol(), cfg.getEndCol(), chunk_rows);
+        MatrixXd chunk;
+
+        // Pass 1: diameter, as in DataIngest::estimateHashParams
+        double radius = 0;
+        while (reader.next(chunk)) {
+            chunk = dataUtils::normalizeBandwidth(chunk, bw);
+            radius = max(radius, chunk.rowwise().norm().maxCoeff());
+        }
+        double diam = min(2 * radius, log(n / tau));
+        int k = dataUtils::getPower(diam, beta);
+        double w = dataUtils::getWidth(k, beta);
+        std::cout << "k=" << k << ", w=" << w << std::endl;
+
+        // Pass 2: hash the rows into the sketch tables
+        reader.rewind();
+        HBS hbs([&](MatrixXd& rows) {
+            if (!reader.next(rows)) { return false; }
+            rows = dataUtils::normalizeBandwidth(rows, bw);
+            return true;
+        }, n, d, m, w, k, ntbls, rng);
+        samples = hbs.final_samples;
+
+        // Pass 3: collect the sampled points
+        vector<pair<int, int>> order;
+        for (size_t i = 0; i < samples.size(); i ++) { order.push_back(make_pair(samples[i].first, i)); }
+        std::sort(order.begin(), order.end());
+        coreset.points.resize(samples.size(), d);
+        reader.rewind();
+        size_t next = 0;
+        while (next < order.size() && reader.next(chunk)) {
+            int end = reader.offset + chunk.rows();
+            for (; next < order.size() && order[next].first < end; next ++) {
+                coreset.points.row(order[next].second) = chunk.row(order[next].first - reader.offset);
+            }
+        }
+    }
+
+    // SketchBench averages the weighted kernel values over the samples; fold the 1/m in
+    coreset.indices.resize(samples.size());
+    coreset.weights.resize(samples.size());
+    for (size_t i = 0; i < samples.size(); i ++) {
+        coreset.indices[i] = samples[i].first;
+        coreset.weights(i) = samples[i].second / samples.size();
+    }
+    coreset.write(output);
+    std::cout << "Coreset of " << coreset.size() << " points written to " << output << " in "
+              << elapsed(start) << "s" << std::endl;
+
+    if (eval) {
+        Coreset c = Coreset::read(output);
+        DataIngest data(cfg, true);
+        vector<double> err;
+        for (int j = 0; j < data.M; j ++) {
+            VectorXd q = data.getQuery(j) * h;
+            double exact_val = data.exact[j * 2];
+            double est = c.density(*data.kernel, q);
+            err.push_back(fabs(est - exact_val) / max(data.tau, exact_val));
+        }
+        std::cout << "Relative error: " << dataUtils::getAvg(err) << "," << dataUtils::getSE(err) << std::endl;
+    }
+}
@@ -10,9 +10,14 @@
  *  Example usage:
  *      ./hbe conf/shuttle.cfg gaussian
  *
+ *      ./hbe conf/shuttle.cfg gaussian --output=shuttle_exact.res
+ *          => Also write the query ids, densities and per-query nanoseconds to a columnar binary
+ *             file (utils/ResultWriter.h)
+ *
  */
 
 #include "../utils/DataIngest.h"
+#include "../utils/ResultWriter.h"
 #include "../alg/naiveKDE.h"
 #include "parseConfig.h"
 #include <chrono>
@@ -25,32 +30,62 @@ int main(int argc, char *argv[]) {
     }
 
     char* scope = argv[2];
+    std::string output_path;
+    for (int i = 3; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--output=") == 0) {
+            output_path = arg.substr(9);
+        }
+    }
     parseConfig cfg(argv[1], scope);
     DataIngest data(cfg, false);
 
     // Random init
     std::random_device rd;  //Will be used to obtain a seed for the random number engine
     std::mt19937_64 rng = std::mt19937_64(rd());
-    std::uniform_int_distribution<int> distribution(0, data.N - 1);
+    // Queries are rows of the dataset as read, before duplicate compaction
+    int n = data.Q_ptr->rows();
+    std::uniform_int_distribution<int> distribution(0, n - 1);
 
     auto t1 = std::chrono::high_resolution_clock::now();
     std::ofstream outfile(cfg.getExactPath());
 
-    naiveKDE kde(data.X_ptr, data.kernel);
-
+    naiveKDE kde(data.X_ptr, data.W_ptr, data.kernel);
+    vector<int64_t> ids, nanos;
+    vector<double> densities;
 
     for (int j = 0; j < data.M; j ++) {
         int idx = j;
         // Get random query
-        if (data.M < data.N && data.hasQuery == 0) {
+        if (data.M < n && data.hasQuery == 0) {
             idx = distribution(rng);
         }
-        outfile << kde.query(data.X_ptr->row(idx)) << "," << idx << "\n";
+        auto q1 = std::chrono::high_resolution_clock::now();
+        double density = kde.query(data.Q_ptr->row(idx));
+        auto q2 = std::chrono::high_resolution_clock::now();
+        outfile << density << "," << idx << "\n";
+        ids.push_back(idx);
+        densities.push_back(density);
+        nanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(q2-q1).count());
     }
     outfile.close();
     auto t2 = std::chrono::high_resolution_clock::now();
 
+    if (!output_path.empty()) {
+        ResultWriter out(output_path);
+        out.meta("algorithm", "exact");
+        out.meta("kernel", cfg.getKernel());
+        out.meta("h", data.h);
+        out.meta("n", data.N);
+        out.meta("dim", data.dim);
+        out.meta("seconds", std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0);
+        out.column("id", ids);
+        out.column("exact", densities);
+        out.column("nanos", nanos);
+        out.write();
+    }
+
     std::cout << data.M << " queries: " <<
         std::chrono::duration_cast<std::chrono::seconds>(t2-t1).count() << " sec" << std::endl;
 
-}
\ No newline at end of file
+}
@@ -3,12 +3,24 @@
  *      This program finds the smallest epsilon for random sampling and HBE that achieves a true relative error < 0.1.
  *      Epsilon is a parameter that controls error in the adaptive sampling procedure.
  *
+ *      With --sweep, instead evaluate a grid of epsilons for both algorithms in one process and output the
+ *      relative error, samples and latency (ms per query) of each, followed by the error-vs-latency Pareto
+ *      frontier. Each algorithm is built once for the smallest epsilon of its grid; larger epsilons reuse a
+ *      prefix of the same hash tables.
+ *
  *  Example usage:
  *      /hbe conf/shuttle.cfg gaussian
+ *
+ *      ./hbe_find conf/shuttle.cfg gaussian --sweep
+ *          => Sweep the default grids
+ *
+ *      ./hbe_find conf/shuttle.cfg gaussian --rs=0.1,0.2,0.3 --hbe=0.5,0.7,0.9
+ *          => Sweep the given grids
  */
 
 
 #include <chrono>
+#include <sstream>
 #include "../alg/RS.h"
 #include "../alg/AdaptiveRS.h"
 #include "../alg/AdaptiveHBE.h"
@@ -20,6 +32,20 @@ void update(vector<double>& results, vector<double> est, double exact) {
     results[1] += est[1];
 }
 
+///
+/// Run all queries against the estimator.
+/// \return average relative error, average samples and average latency (ms) per query
+vector<double> evaluate(shared_ptr<AdaptiveEstimator> est, DataIngest& data) {
+    est->totalTime = 0;
+    vector<double> results(2,0);
+
+    for (int j = 0; j < data.M; j++) {
+        vector<double> vals = est->query(data.getQuery(j));
+        update(results, vals, data.exact[j * 2]);
+    }
+    return {results[0] / data.M, results[1] / data.M, est->totalTime / 1e6 / data.M};
+}
+
 void findEps(bool isRandom, DataIngest& data) {
     double eps = 0.6;
     bool stop = false;
@@ -27,44 +53,28 @@ void findEps(bool isRandom, DataIngest& data) {
 
     double head = 0;
     double tail = 1;
+    HBEOptions opts;
+    opts.weights = data.W_ptr;
 
     shared_ptr<AdaptiveEstimator> est;
     while (!stop) {
         std::cout << "------------------" << std::endl;
         std::cout << "eps = " << eps << std::endl;
         if (isRandom) {
-            est = make_shared<AdaptiveRS>(data.X_ptr, data.kernel, data.tau, eps);
+            est = make_shared<AdaptiveRS>(data.X_ptr, data.W_ptr, data.kernel, data.tau, eps);
         } else {
             auto t1 = std::chrono::high_resolution_clock::now();
-            est = make_shared<AdaptiveHBE>(data.X_ptr,  data.kernel, data.tau, eps, true);
+            est = make_shared<AdaptiveHBE>(data.X_ptr, data.kernel, data.tau, eps, true, opts);
             auto t2 = std::chrono::high_resolution_clock::now();
             std::cout << "Adaptive Table Init: " <<
                       std::chrono::duration_cast<std::chrono::seconds>(t2-t1).count() << std::endl;
         }
-        est->totalTime = 0;
-        vector<double> results(2,0);
-
-        for (int j = 0; j < data.M; j++) {
-            int idx = j * 2;
-            VectorXd q = data.X_ptr->row(j);
-            if (data.hasQuery != 0) {
-                q = data.Y_ptr->row(j);
-                idx = j;
-            } else {
-                if (!data.sequential) {
-                    q = data.X_ptr->row(int(data.exact[idx + 1]));
-                }
-            }
-
-            vector<double> vals = est->query(q);
-            update(results, vals, data.exact[idx]);
-        }
-
+        vector<double> results = evaluate(est, data);
         std::cout << "Sampling total time: " << est->totalTime / 1e9 << std::endl;
-        std::cout << "Average Samples: " << results[1] / data.M << std::endl;
-        std::cout << "Relative Error: " << results[0] / data.M << std::endl;
+        std::cout << "Average Samples: " << results[1] << std::endl;
+        std::cout << "Relative Error: " << results[0] << std::endl;
 
-        double err = results[0] / data.M;
+        double err = results[0];
         if (eps == 0.6) {
             if (err < 0.1) {
                 times = true;
@@ -100,37 +110,20 @@ void findEps(bool isRandom, DataIngest& data) {
         std::cout << "------------------" << std::endl;
         std::cout << "eps = " << eps << std::endl;
         if (isRandom) {
-            est = make_shared<AdaptiveRS>(data.X_ptr, data.kernel, data.tau, eps);
+            est = make_shared<AdaptiveRS>(data.X_ptr, data.W_ptr, data.kernel, data.tau, eps);
         } else {
             auto t1 = std::chrono::high_resolution_clock::now();
-            est = make_shared<AdaptiveHBE>(data.X_ptr, data.kernel, data.tau, eps, true);
+            est = make_shared<AdaptiveHBE>(data.X_ptr, data.kernel, data.tau, eps, true, opts);
             auto t2 = std::chrono::high_resolution_clock::now();
             std::cout << "Adaptive Table Init: " <<
                       std::chrono::duration_cast<std::chrono::seconds>(t2-t1).count() << std::endl;
         }
-        est->totalTime = 0;
-        vector<double> results(2,0);
-
-        for (int j = 0; j < data.M; j++) {
-            int idx = j * 2;
-            VectorXd q = data.X_ptr->row(j);
-            if (data.hasQuery != 0) {
-                q = data.Y_ptr->row(j);
-                idx = j;
-            } else {
-                if (!data.sequential) {
-                    q = data.X_ptr->row(int(data.exact[idx + 1]));
-                }
-            }
-            vector<double> vals = est->query(q);
-            update(results, vals, data.exact[idx]);
-        }
-
+        vector<double> results = evaluate(est, data);
         std::cout << "Sampling total time: " << est->totalTime / 1e9 << std::endl;
-        std::cout << "Average Samples: " << results[1] / data.M << std::endl;
-        std::cout << "Relative Error: " << results[0] / data.M << std::endl;
+        std::cout << "Average Samples: " << results[1] << std::endl;
+        std::cout << "Relative Error: " << results[0] << std::endl;
 
-        double err = results[0] / data.M;
+        double err = results[0];
         if (err < 0.11 && err > 0.09) {
             break;
         } else if (err > 0.1) {
@@ -142,6 +135,60 @@ void findEps(bool isRandom, DataIngest& data) {
 
 }
 
+struct SweepPoint {
+    std::string alg;
+    double eps;
+    double err;
+    double samples;
+    double latency;
+};
+
+vector<double> parseList(const std::string& list) {
+    vector<double> values;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        values.push_back(atof(item.c_str()));
+    }
+    return values;
+}
+
+///
+/// Evaluate every eps in the grid. The index is built once for the smallest eps
+/// and re-targeted to larger eps with setEps, which only uses a prefix of its tables.
+void sweepEps(bool isRandom, vector<double> grid, DataIngest& data, vector<SweepPoint>& points) {
+    std::sort(grid.begin(), grid.end());
+    std::string alg = isRandom ? "RS" : "HBE";
+    HBEOptions opts;
+    opts.weights = data.W_ptr;
+    shared_ptr<AdaptiveRS> rs;
+    shared_ptr<AdaptiveHBE> hbe;
+    shared_ptr<AdaptiveEstimator> est;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    if (isRandom) {
+        rs = make_shared<AdaptiveRS>(data.X_ptr, data.W_ptr, data.kernel, data.tau, grid[0]);
+        est = rs;
+    } else {
+        hbe = make_shared<AdaptiveHBE>(data.X_ptr, data.kernel, data.tau, grid[0], true, opts);
+        est = hbe;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::cout << alg << " Adaptive Table Init (eps = " << grid[0] << "): " <<
+              std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0 << std::endl;
+
+    for (double eps : grid) {
+        if (isRandom) {
+            rs->setEps(eps);
+        } else {
+            hbe->setEps(eps);
+        }
+        vector<double> results = evaluate(est, data);
+        std::cout << "SWEEP alg=" << alg << " eps=" << eps << " err=" << results[0] <<
+                  " samples=" << results[1] << " latency=" << results[2] << std::endl;
+        points.push_back({alg, eps, results[0], results[1], results[2]});
+    }
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         std::cout << "Need config file" << std::endl;
@@ -149,9 +196,45 @@ int main(int argc, char *argv[]) {
     }
 
     char *scope = argv[2];
+    bool sweep = false;
+    vector<double> rs_grid = {0.1, 0.15, 0.2, 0.25, 0.3, 0.4, 0.5, 0.6};
+    vector<double> hbe_grid = {0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.0, 1.2};
+    for (int i = 3; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg == "--sweep") {
+            sweep = true;
+        } else if (arg.compare(0, 5, "--rs=") == 0) {
+            sweep = true;
+            rs_grid = parseList(arg.substr(5));
+        } else if (arg.compare(0, 6, "--hbe=") == 0) {
+            sweep = true;
+            hbe_grid = parseList(arg.substr(6));
+        }
+    }
+
     parseConfig cfg(argv[1], scope);
     DataIngest data(cfg, true);
 
+    if (sweep) {
+        vector<SweepPoint> points;
+        sweepEps(true, rs_grid, data, points);
+        sweepEps(false, hbe_grid, data, points);
+
+        // Pareto frontier: points that no other point beats on both error and latency
+        std::sort(points.begin(), points.end(), [](const SweepPoint& a, const SweepPoint& b) {
+            return a.latency < b.latency || (a.latency == b.latency && a.err < b.err);
+        });
+        double best = INFINITY;
+        for (auto& p : points) {
+            if (p.err < best) {
+                best = p.err;
+                std::cout << "PARETO alg=" << p.alg << " eps=" << p.eps << " err=" << p.err <<
+                          " samples=" << p.samples << " latency=" << p.latency << std::endl;
+            }
+        }
+        return 0;
+    }
+
     std::cout << "RS\n";
     findEps(true, data);
 
@@ -0,0 +1,122 @@
+/*
+ *  K-center benchmark:
+ *      Time the farthest-point traversal used by the SKA sketch (KCenter) for an increasing
+ *      number of centers, against the original implementation that recomputed the distance
+ *      to every chosen center on each iteration (O(N k^2 d)), and against FIGTree's
+ *      KCenterClustering when built with -DHBE_FIGTREE=ON.
+ *
+ *      For each k, we output the time in seconds and the k-center radius (the largest
+ *      distance from a point to its nearest center). The original implementation picks the
+ *      same centers and is only run up to --legacy-max centers. FIGTree starts from a random
+ *      point, so its radius differs slightly.
+ *
+ *  Example usage:
+ *      ./hbe_kcenter conf/shuttle.cfg gaussian
+ *      ./hbe_kcenter conf/shuttle.cfg gaussian --k=100,1000,5000 --legacy-max=1000
+ */
+
+#include <chrono>
+#include <sstream>
+#include "../alg/KCenter.h"
+#include "../utils/DataIngest.h"
+#include "parseConfig.h"
+#ifdef HBE_FIGTREE
+#include "KCenterClustering.h"
+#endif
+
+///
+/// The original greedy loop of KCenter.
+///
+vector<int> legacyCenters(const MatrixXd& X, int k, int seed) {
+    vector<int> centers;
+    centers.push_back(seed);
+    for (int i = 0; i < k - 1; i ++) {
+        int max_idx = 0;
+        double max_dist = 0;
+        for (int j = 0; j < X.rows(); j ++) {
+            double min_dist = INT_MAX;
+            for (size_t c = 0; c < centers.size(); c ++) {
+                min_dist = min(min_dist, (X.row(j) - X.row(centers[c])).norm());
+            }
+            if (min_dist > max_dist) {
+                max_dist = min_dist;
+                max_idx = j;
+            }
+        }
+        centers.push_back(max_idx);
+    }
+    return centers;
+}
+
+/// Largest distance from a point to its nearest center.
+double radius(const RowMatrixXd& X, const vector<int>& centers) {
+    double r = 0;
+    for (int j = 0; j < X.rows(); j ++) {
+        double d = std::numeric_limits<double>::infinity();
+        for (int c : centers) {
+            d = min(d, (X.row(j) - X.row(c)).squaredNorm());
+        }
+        r = max(r, d);
+    }
+    return sqrt(r);
+}
+
+double seconds(std::chrono::steady_clock::time_point t1, std::chrono::steady_clock::time_point t2) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: ./hbe_kcenter <config> <scope> [--k=k1,k2,...] [--legacy-max=K]" << std::endl;
+        exit(1);
+    }
+
+    vector<int> ks = {10, 100, 1000};
+    int legacy_max = 500;
+    for (int i = 3; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 4, "--k=") == 0) {
+            ks.clear();
+            std::stringstream ss(arg.substr(4));
+            std::string tok;
+            while (std::getline(ss, tok, ',')) { ks.push_back(std::stoi(tok)); }
+        } else if (arg.compare(0, 13, "--legacy-max=") == 0) {
+            legacy_max = std::stoi(arg.substr(13));
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    parseConfig cfg(argv[1], argv[2]);
+    DataIngest data(cfg, false);
+    RowMatrixXd X = *data.X_ptr;
+    std::cout << "N=" << X.rows() << ", d=" << X.cols() << std::endl;
+
+    for (int k : ks) {
+        k = min(k, int(X.rows()));
+        auto t1 = std::chrono::steady_clock::now();
+        vector<int> centers = KCenter::farthestPoints(X, k, 1);
+        auto t2 = std::chrono::steady_clock::now();
+        std::cout << "KCENTER alg=kcenter k=" << k << " time=" << seconds(t1, t2)
+            << " radius=" << radius(X, centers) << std::endl;
+
+        if (k <= legacy_max) {
+            t1 = std::chrono::steady_clock::now();
+            vector<int> legacy = legacyCenters(*data.X_ptr, k, 1);
+            t2 = std::chrono::steady_clock::now();
+            std::cout << "KCENTER alg=legacy k=" << k << " time=" << seconds(t1, t2)
+                << " radius=" << radius(X, legacy) << " same_centers=" << (legacy == centers) << std::endl;
+        }
+
+#ifdef HBE_FIGTREE
+        vector<int> cluster(X.rows(), 0);
+        t1 = std::chrono::steady_clock::now();
+        KCenterClustering figtree(X.cols(), X.rows(), X.data(), cluster.data(), k);
+        figtree.Cluster();
+        t2 = std::chrono::steady_clock::now();
+        std::cout << "KCENTER alg=figtree k=" << k << " time=" << seconds(t1, t2)
+            << " radius=" << figtree.MaxClusterRadius << std::endl;
+#endif
+    }
+}
@@ -0,0 +1,168 @@
+/*
+ *  Load test:
+ *     Build an adaptive estimator (HBE or RS) and replay the queries of the config file against it,
+ *     either as fast as possible from N threads (closed loop) or at a fixed arrival rate (open loop).
+ *     Reports achieved QPS and p50/p90/p99/p99.9 latency and samples per query, overall and split
+ *     by the adaptive level each query stopped at.
+ *
+ *     In open loop mode, query i is scheduled at start + i / qps and its latency is measured from the
+ *     scheduled time, so time spent waiting for a free thread counts towards the latency.
+ *
+ *  Example usage:
+ *      ./hbe_load conf/shuttle.cfg gaussian 0.9 --threads=8 --queries=100000
+ *          => Closed loop with 8 threads against HBE with eps=0.9
+ *
+ *      ./hbe_load conf/shuttle.cfg gaussian 0.9 --qps=2000 --threads=4
+ *          => Open loop at 2000 queries per second served by 4 threads
+ *
+ *      ./hbe_load conf/shuttle.cfg gaussian 0.2 true --threads=8
+ *          => Closed loop against RS with eps=0.2
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "../alg/AdaptiveRS.h"
+#include "../alg/AdaptiveHBE.h"
+#include "../utils/DataIngest.h"
+#include "parseConfig.h"
+
+struct QueryResult {
+    double latency;
+    double samples;
+    int level;
+};
+
+/// Nearest-rank percentile.
+/// \param sorted values in ascending order
+/// \param pct percentile in [0, 100]
+double percentile(const vector<double>& sorted, double pct) {
+    if (sorted.empty()) { return 0; }
+    size_t rank = (size_t) ceil(pct / 100 * sorted.size());
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+void printLatency(const std::string& level, vector<QueryResult>& results, double seconds) {
+    vector<double> latency;
+    double samples = 0;
+    for (auto& r : results) {
+        latency.push_back(r.latency);
+        samples += r.samples;
+    }
+    std::sort(latency.begin(), latency.end());
+    std::cout << "LATENCY level=" << level << " queries=" << results.size()
+        << " qps=" << results.size() / seconds
+        << " p50=" << percentile(latency, 50) << " p90=" << percentile(latency, 90)
+        << " p99=" << percentile(latency, 99) << " p99.9=" << percentile(latency, 99.9)
+        << " samples=" << (results.empty() ? 0 : samples / results.size()) << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: ./hbe_load <config> <scope> <eps> [rs] [--threads=N] [--qps=Q] [--queries=N]" << std::endl;
+        exit(1);
+    }
+
+    char *scope = argv[2];
+    double eps = atof(argv[3]);
+    bool random = false;
+    int threads = 1;
+    double qps = 0;
+    long nqueries = 0;
+    HBEOptions opts;
+    for (int i = 4; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 10, "--threads=") == 0) {
+            threads = std::max(1, atoi(arg.c_str() + 10));
+        } else if (arg.compare(0, 6, "--qps=") == 0) {
+            qps = atof(arg.c_str() + 6);
+        } else if (arg.compare(0, 10, "--queries=") == 0) {
+            nqueries = atol(arg.c_str() + 10);
+        } else if (arg.compare(0, 9, "--budget=") == 0) {
+            opts.memoryBudget = size_t(atof(arg.c_str() + 9) * 1e6);
+        } else if (arg.compare(0, 9, "--probes=") == 0) {
+            opts.probes = atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 13, "--probe-gain=") == 0) {
+            opts.probeGain = atof(arg.c_str() + 13);
+        } else if (arg == "--pyramid") {
+            opts.pyramid = true;
+        } else {
+            random = true;
+        }
+    }
+
+    parseConfig cfg(argv[1], scope);
+    DataIngest data(cfg, true);
+    opts.weights = data.W_ptr;
+
+    shared_ptr<AdaptiveEstimator> est;
+    std::cout << "eps = " << eps << std::endl;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    if (random) {
+        std::cout << "RS" << std::endl;
+        est = make_shared<AdaptiveRS>(data.X_ptr, data.W_ptr, data.kernel, data.tau, eps);
+    } else {
+        std::cout << "HBE" << std::endl;
+        est = make_shared<AdaptiveHBE>(data.X_ptr, data.kernel, data.tau, eps, true, opts);
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::cout << "Adaptive Table Init: " <<
+              std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0 << std::endl;
+
+    vector<VectorXd> queries;
+    for (int j = 0; j < data.M; j++) {
+        queries.push_back(data.getQuery(j));
+    }
+    if (nqueries <= 0) { nqueries = queries.size(); }
+
+    if (qps > 0) {
+        std::cout << "Open loop: target qps=" << qps << ", threads=" << threads << std::endl;
+    } else {
+        std::cout << "Closed loop: threads=" << threads << std::endl;
+    }
+
+    // Replay queries in order, cycling through the query set; each thread takes the next one.
+    std::atomic<long> next(0);
+    vector<vector<QueryResult>> results(threads);
+    auto start = std::chrono::steady_clock::now();
+    auto worker = [&](int t) {
+        while (true) {
+            long i = next++;
+            if (i >= nqueries) { break; }
+            auto begin = std::chrono::steady_clock::now();
+            if (qps > 0) {
+                auto scheduled = start + std::chrono::nanoseconds((long) (i * 1e9 / qps));
+                std::this_thread::sleep_until(scheduled);
+                begin = scheduled;
+            }
+            vector<double> r = est->estimate(queries[i % queries.size()], nullptr);
+            auto end = std::chrono::steady_clock::now();
+            double ms = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / 1e6;
+            results[t].push_back({ms, r[1], (int) r[2]});
+        }
+    };
+    vector<std::thread> pool;
+    for (int t = 0; t < threads; t ++) {
+        pool.push_back(std::thread(worker, t));
+    }
+    for (auto& t : pool) { t.join(); }
+    auto stop = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / 1e9;
+
+    vector<QueryResult> all;
+    vector<vector<QueryResult>> by_level(est->levels());
+    for (auto& rs : results) {
+        for (auto& r : rs) {
+            all.push_back(r);
+            by_level[r.level].push_back(r);
+        }
+    }
+
+    std::cout << "Elapsed (s): " << seconds << ", latency in ms" << std::endl;
+    printLatency("all", all, seconds);
+    for (size_t l = 0; l < by_level.size(); l ++) {
+        if (by_level[l].empty()) { continue; }
+        printLatency(std::to_string(l), by_level[l], seconds);
+    }
+}
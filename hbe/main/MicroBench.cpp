@@ -0,0 +1,203 @@
+/*
+ *  Microbenchmarks:
+ *      Time the primitives on the HBE query and build paths over a grid of dimension d,
+ *      number of hash functions k and number of hash tables. Data are drawn from a
+ *      Gaussian scaled so that pairwise distances are O(1) in every dimension; the bin
+ *      width follows dataUtils::getWidth(k, 0.5) as in the adaptive estimators.
+ *
+ *      Benchmarks:
+ *          hashtable_build     building one HashTable on n points (ns per table)
+ *          hashtable_probe     hashing a query and looking up its bucket (ns per probe)
+ *          getkey              turning a projection into a hash key (ns per key)
+ *          bucket_update       HashBucket::update with reservoir sampling (ns per insert)
+ *          sketch_sample       SketchTable::sample (ns per sample)
+ *          collision_prob      mathUtils::collisionProb (ns per call)
+ *          gaussian_density    Gaussiankernel::density (ns per call)
+ *          exp_density         Expkernel::density (ns per call)
+ *          median              refilling n values and taking mathUtils::median (ns per call)
+ *          uniform_hbe_query   UniformHBE query with one sample per table (ns per query)
+ *          sketch_hbe_query    SketchHBE query with one sample per table (ns per query)
+ *
+ *      Each benchmark is run --repeats times; we output the median and minimum ns per
+ *      operation, one CSV row (default) or one JSON object (--json) per configuration.
+ *
+ *  Example usage:
+ *      ./hbe_microbench
+ *      ./hbe_microbench --json --repeats=10 > microbench.jsonl
+ *      ./hbe_microbench --quick
+ */
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include "../alg/HashTable.h"
+#include "../alg/SketchTable.h"
+#include "../alg/UniformHBE.h"
+#include "../alg/SketchHBE.h"
+#include "dataUtils.h"
+#include "expkernel.h"
+#include "gaussiankernel.h"
+
+bool json = false;
+int repeats = 5;
+
+///
+/// Keeps benchmarked results alive so that the compiler does not drop the work.
+///
+volatile double sink = 0;
+
+/// Time a benchmark and print one result line.
+/// \param name benchmark name
+/// \param d dimension
+/// \param k number of hash functions (0 if not applicable)
+/// \param tables number of hash tables (0 if not applicable)
+/// \param n size of the input (points per table, samples or values; 0 if not applicable)
+/// \param ops number of operations performed by one call of run
+/// \param run the benchmark body
+void bench(const std::string& name, int d, int k, int tables, int n, int ops, std::function<void()> run) {
+    // Warm up caches and the allocator
+    run();
+    std::vector<double> times;
+    for (int r = 0; r < repeats; r ++) {
+        auto t1 = std::chrono::steady_clock::now();
+        run();
+        auto t2 = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / double(ops));
+    }
+    double best = *std::min_element(times.begin(), times.end());
+    double med = mathUtils::median(times);
+    if (json) {
+        std::cout << "{\"bench\":\"" << name << "\",\"d\":" << d << ",\"k\":" << k << ",\"tables\":" << tables
+            << ",\"n\":" << n << ",\"ns_per_op\":" << med << ",\"ns_min\":" << best << "}" << std::endl;
+    } else {
+        std::cout << name << "," << d << "," << k << "," << tables << "," << n << ","
+            << med << "," << best << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    vector<int> dims = {8, 32, 128};
+    vector<int> powers = {2, 5, 10};
+    vector<int> ntables = {10, 100};
+    int n = 4096;
+    int nqueries = 256;
+
+    for (int i = 1; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg == "--json") {
+            json = true;
+        } else if (arg == "--quick") {
+            dims = {8};
+            powers = {5};
+            ntables = {10};
+            n = 1024;
+        } else if (arg.compare(0, 10, "--repeats=") == 0) {
+            repeats = std::max(1, std::stoi(arg.substr(10)));
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    if (!json) {
+        std::cout << "bench,d,k,tables,n,ns_per_op,ns_min" << std::endl;
+    }
+
+    std::mt19937_64 rng(0);
+    for (int d : dims) {
+        shared_ptr<MatrixXd> X = make_shared<MatrixXd>(mathUtils::randNormal(n, d, rng) * (2 / sqrt(d)));
+        MatrixXd Q = mathUtils::randNormal(nqueries, d, rng) * (2 / sqrt(d));
+        shared_ptr<Kernel> gaussian = make_shared<Gaussiankernel>(d);
+        shared_ptr<Kernel> expk = make_shared<Expkernel>(d);
+
+        // Kernel evaluations
+        bench("gaussian_density", d, 0, 0, 0, n, [&]() {
+            double s = 0;
+            for (int i = 0; i < n; i ++) { s += gaussian->density(Q.row(i % nqueries), X->row(i)); }
+            sink = s;
+        });
+        bench("exp_density", d, 0, 0, 0, n, [&]() {
+            double s = 0;
+            for (int i = 0; i < n; i ++) { s += expk->density(Q.row(i % nqueries), X->row(i)); }
+            sink = s;
+        });
+
+        // Reservoir updates into a single bucket
+        bench("bucket_update", d, 0, 0, 0, n, [&]() {
+            HashBucket bucket(X->row(0));
+            for (int i = 1; i < n; i ++) { bucket.update(X->row(i), rng); }
+            sink = bucket.count[0];
+        });
+
+        for (int k : powers) {
+            double w = dataUtils::getWidth(k, 0.5);
+
+            bench("hashtable_build", d, k, 1, n, 1, [&]() {
+                HashTable t(X, w, k, rng);
+                sink = t.bucket_count;
+            });
+
+            HashTable t(X, w, k, rng);
+            bench("hashtable_probe", d, k, 1, n, nqueries, [&]() {
+                double s = 0;
+                for (int i = 0; i < nqueries; i ++) {
+                    vector<size_t> keys = t.hashfunction(Q.row(i));
+                    const HashBucket* bucket = t.find(keys[0]);
+                    if (bucket != nullptr) { s += bucket->count[0]; }
+                }
+                sink = s;
+            });
+
+            VectorXd v = mathUtils::randNormal(k, rng) * 10;
+            bench("getkey", d, k, 1, 0, nqueries, [&]() {
+                size_t s = 0;
+                for (int i = 0; i < nqueries; i ++) {
+                    v(i % k) += 1;
+                    s += t.getkey(v)[0];
+                }
+                sink = s;
+            });
+
+            SketchTable sketch(X, w, k, rng);
+            bench("sketch_sample", d, k, 1, n, nqueries, [&]() {
+                vector<pair<int, double>> samples = sketch.sample(nqueries, rng);
+                sink = samples.back().second;
+            });
+
+            bench("collision_prob", d, k, 0, 0, nqueries, [&]() {
+                double s = 0;
+                for (int i = 0; i < nqueries; i ++) { s += mathUtils::collisionProb(0.01 * (i + 1), w, k); }
+                sink = s;
+            });
+
+            for (int m : ntables) {
+                UniformHBE uniform(X, m, w, k, gaussian, int(sqrt(n)));
+                bench("uniform_hbe_query", d, k, m, int(sqrt(n)), nqueries, [&]() {
+                    double s = 0;
+                    for (int i = 0; i < nqueries; i ++) { s += uniform.query(Q.row(i), 0, m); }
+                    sink = s;
+                });
+
+                SketchHBE hbs(X, m, w, k, gaussian);
+                bench("sketch_hbe_query", d, k, m, int(sqrt(n)), nqueries, [&]() {
+                    double s = 0;
+                    for (int i = 0; i < nqueries; i ++) { s += hbs.query(Q.row(i), 0, m); }
+                    sink = s;
+                });
+            }
+        }
+    }
+
+    // Median over the number of means used by the estimators
+    for (int L : {3, 11, 101}) {
+        vector<double> values(L);
+        bench("median", 0, 0, 0, L, nqueries, [&]() {
+            double s = 0;
+            for (int i = 0; i < nqueries; i ++) {
+                for (int j = 0; j < L; j ++) { values[j] = (j * 7919 + i) % L; }
+                s += mathUtils::median(values);
+            }
+            sink = s;
+        });
+    }
+}
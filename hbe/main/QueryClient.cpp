@@ -0,0 +1,163 @@
+/*
+ *  Query client:
+ *     Send the queries of a config file to hbe_server in batches and compare the answers with the
+ *     exact densities. --connections clients send batches concurrently; a batch answered BUSY is
+ *     retried after an exponential backoff. Prints one RESULT line per query, as hbe does, then
+ *     the throughput, the batch latency seen by the client and by the server, and the number of
+ *     busy responses.
+ *
+ *  Example usage:
+ *      ./hbe_client conf/shuttle.cfg gaussian /tmp/hbe.sock
+ *          => One connection, batches of 100 queries
+ *
+ *      ./hbe_client conf/shuttle.cfg gaussian /tmp/hbe.sock --batch=1000 --connections=8 --repeat=10
+ *          => 8 concurrent connections sending the queries 10 times over
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "../utils/DataIngest.h"
+#include "../utils/QueryProtocol.h"
+#include "../utils/SocketIO.h"
+#include "parseConfig.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct BatchTiming {
+    double clientMs;
+    double serverMs;
+    double queueMs;
+};
+
+double percentile(vector<double> values, double pct) {
+    if (values.empty()) { return 0; }
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t) ceil(pct / 100 * values.size());
+    return values[std::max((size_t) 1, rank) - 1];
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: ./hbe_client <config> <scope> <socket> [--batch=B] [--connections=C] [--repeat=R]"
+                  << std::endl;
+        exit(1);
+    }
+
+    char *scope = argv[2];
+    std::string path = argv[3];
+    int batch_size = 100;
+    int connections = 1;
+    int repeat = 1;
+    for (int i = 4; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--batch=") == 0) {
+            batch_size = std::max(1, atoi(arg.c_str() + 8));
+        } else if (arg.compare(0, 14, "--connections=") == 0) {
+            connections = std::max(1, atoi(arg.c_str() + 14));
+        } else if (arg.compare(0, 9, "--repeat=") == 0) {
+            repeat = std::max(1, atoi(arg.c_str() + 9));
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    parseConfig cfg(argv[1], scope);
+    DataIngest data(cfg, true);
+    int dim = data.dim;
+    int M = data.M;
+    // The server takes queries in the units of the source dataset
+    vector<double> queries((size_t) M * dim);
+    for (int j = 0; j < M; j ++) {
+        VectorXd q = data.getQuery(j) * data.h;
+        std::copy(q.data(), q.data() + dim, &queries[(size_t) j * dim]);
+    }
+
+    int batches = (M + batch_size - 1) / batch_size * repeat;
+    vector<QueryProtocol::QueryResult> results(M);
+    vector<BatchTiming> timings(batches);
+    std::atomic<int> next(0);
+    std::atomic<long> busy(0);
+    std::atomic<bool> failed(false);
+
+    auto start = Clock::now();
+    vector<std::thread> clients;
+    for (int c = 0; c < connections; c ++) {
+        clients.push_back(std::thread([&] {
+            int fd;
+            try {
+                fd = SocketIO::connectUnix(path);
+            } catch (std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                failed = true;
+                return;
+            }
+            vector<QueryProtocol::QueryResult> answers(batch_size);
+            for (int b = next ++; b < batches && !failed; b = next ++) {
+                int first = (b % ((M + batch_size - 1) / batch_size)) * batch_size;
+                int count = std::min(batch_size, M - first);
+                QueryProtocol::RequestHeader req = {QueryProtocol::REQUEST_MAGIC, (uint32_t) count, (uint32_t) dim, 0};
+                QueryProtocol::ResponseHeader resp;
+                auto t1 = Clock::now();
+                int backoff = 1;
+                while (true) {
+                    // A rejected request is answered before the server reads the queries, so read the
+                    // response even if sending them failed
+                    if (SocketIO::writeAll(fd, &req, sizeof(req))) {
+                        SocketIO::writeAll(fd, &queries[(size_t) first * dim], (size_t) count * dim * sizeof(double));
+                    }
+                    if (!SocketIO::readAll(fd, &resp, sizeof(resp)) || resp.magic != QueryProtocol::RESPONSE_MAGIC) {
+                        std::cerr << "Connection to " << path << " lost" << std::endl;
+                        failed = true;
+                        break;
+                    }
+                    if (resp.status != QueryProtocol::BUSY) { break; }
+                    busy ++;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+                    backoff = std::min(backoff * 2, 100);
+                }
+                if (failed) { break; }
+                if (resp.status != QueryProtocol::OK) {
+                    std::cerr << "Request failed with status " << resp.status << std::endl;
+                    failed = true;
+                    break;
+                }
+                if (!SocketIO::readAll(fd, answers.data(), count * sizeof(QueryProtocol::QueryResult))) {
+                    failed = true;
+                    break;
+                }
+                timings[b].clientMs = std::chrono::duration_cast<std::chrono::microseconds>(
+                        Clock::now() - t1).count() / 1e3;
+                timings[b].serverMs = resp.serverNanos / 1e6;
+                timings[b].queueMs = resp.queueNanos / 1e6;
+                // Repeats overwrite the same queries
+                std::copy(answers.begin(), answers.begin() + count, results.begin() + first);
+            }
+            close(fd);
+        }));
+    }
+    for (auto& t : clients) { t.join(); }
+    double secs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count() / 1e6;
+    if (failed) { exit(1); }
+
+    vector<double> err;
+    for (int j = 0; j < M; j ++) {
+        double exact_val = data.exact[j * 2];
+        std::cout << "RESULT id=" << j << " est=" << results[j].estimate << " samples=" << results[j].samples
+                  << " time=" << results[j].nanos / 1e6 << std::endl;
+        err.push_back(fabs(results[j].estimate - exact_val) / max(data.tau, exact_val));
+    }
+    vector<double> client_ms, server_ms, queue_ms;
+    for (auto& t : timings) {
+        client_ms.push_back(t.clientMs);
+        server_ms.push_back(t.serverMs);
+        queue_ms.push_back(t.queueMs);
+    }
+    std::cout << "Queries: " << (long) M * repeat << " in " << secs << "s (" << M * repeat / secs << " QPS), "
+              << batches << " batches of up to " << batch_size << ", busy responses: " << busy << std::endl;
+    std::cout << "Batch latency (ms) client p50/p99: " << percentile(client_ms, 50) << "/" << percentile(client_ms, 99)
+              << ", server p50/p99: " << percentile(server_ms, 50) << "/" << percentile(server_ms, 99)
+              << ", queued p50/p99: " << percentile(queue_ms, 50) << "/" << percentile(queue_ms, 99) << std::endl;
+    std::cout << "Relative error: " << dataUtils::getAvg(err) << "," << dataUtils::getSE(err) << std::endl;
+}
@@ -0,0 +1,383 @@
+/*
+ *  Query server:
+ *     Build an adaptive estimator (HBE or RS, optionally sharded) from a config once, or load a
+ *     coreset written by hbe_coreset, and answer batches of queries sent over a Unix domain socket
+ *     until interrupted. The binary protocol is described in utils/QueryProtocol.h; queries are in
+ *     the units of the source dataset. hbe_client is a matching client.
+ *
+ *     Every query of an admitted batch becomes a task for a pool of --threads workers, so one large
+ *     batch is answered in parallel and batches from several connections share the workers. At most
+ *     --max-pending queries are admitted at a time; a batch that does not fit is answered BUSY
+ *     right away rather than queued (back-pressure), and the client retries.
+ *
+ *  Example usage:
+ *      ./hbe_server conf/shuttle.cfg gaussian 0.9 /tmp/hbe.sock --threads=4
+ *          => Serve HBE with eps=0.9 on /tmp/hbe.sock
+ *
+ *      ./hbe_server conf/shuttle.cfg gaussian 0.2 /tmp/hbe.sock true --max-pending=10000
+ *          => Serve RS with eps=0.2, admitting at most 10000 queries at a time
+ *
+ *      ./hbe_server conf/shuttle.cfg gaussian 0.9 /tmp/hbe.sock --shards=4 --budget=512
+ *
+ *      ./hbe_server conf/shuttle.cfg gaussian 0.9 /tmp/hbe.sock --background --rebuild-every=600
+ *          => Start answering with RS at once, build HBE in the background and swap it in when ready
+ *             (HotSwapEstimator); every 600s, reload the dataset and rebuild the index the same way
+ *
+ *      ./hbe_server conf/shuttle.cfg gaussian 0 /tmp/hbe.sock --coreset=shuttle.coreset
+ *          => Serve the KDE of a coreset; eps is ignored
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <mutex>
+#include <poll.h>
+#include <set>
+#include <thread>
+#include "../alg/AdaptiveRS.h"
+#include "../alg/AdaptiveHBE.h"
+#include "../alg/ShardedEstimator.h"
+#include "../alg/HotSwapEstimator.h"
+#include "../utils/Coreset.h"
+#include "../utils/DataIngest.h"
+#include "../utils/QueryProtocol.h"
+#include "../utils/SocketIO.h"
+#include "parseConfig.h"
+
+typedef std::chrono::steady_clock Clock;
+
+std::atomic<bool> stopping(false);
+
+void onSignal(int) {
+    stopping = true;
+}
+
+long nanosSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+///
+/// An admitted request: its queries, filled in results and a countdown of unfinished queries.
+///
+struct Batch {
+    int dim;
+    vector<double> queries;
+    vector<QueryProtocol::QueryResult> results;
+    Clock::time_point admitted;
+    std::atomic<long> firstStart{-1};
+    ///
+    /// Whether estimating any of the queries threw
+    ///
+    std::atomic<bool> failed{false};
+    int remaining;
+    std::mutex lock;
+    std::condition_variable done;
+};
+
+struct Task {
+    Batch* batch;
+    int index;
+};
+
+///
+/// Admission control and the worker pool.
+///
+class Server {
+public:
+    /// \param estimate answers one query, given in the units of the source dataset
+    /// \param dim dimension of the queries
+    /// \param threads number of workers
+    /// \param maxPending maximum number of queries admitted and not yet answered
+    Server(std::function<vector<double>(const VectorXd&)> estimate, int dim, int threads, int maxPending) :
+            estimate(estimate), dim(dim), maxPending(maxPending) {
+        for (int i = 0; i < threads; i ++) {
+            workers.push_back(std::thread(&Server::work, this));
+        }
+    }
+
+    ~Server() {
+        // Unblock the connections waiting for requests and let them finish their last response
+        std::unique_lock<std::mutex> wait(lock);
+        for (int fd : connections) { shutdown(fd, SHUT_RD); }
+        closed.wait(wait, [&] { return connections.empty(); });
+        stopped = true;
+        wait.unlock();
+        ready.notify_all();
+        for (auto& t : workers) { t.join(); }
+    }
+
+    ///
+    /// Serve a new connection on its own thread.
+    void accept(int fd) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            connections.insert(fd);
+        }
+        std::thread(&Server::serve, this, fd).detach();
+    }
+
+    std::atomic<long> served{0};
+    std::atomic<long> busy{0};
+
+private:
+    std::function<vector<double>(const VectorXd&)> estimate;
+    int dim;
+    int maxPending;
+    int pending = 0;
+    bool stopped = false;
+    std::deque<Task> tasks;
+    std::set<int> connections;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::condition_variable closed;
+    vector<std::thread> workers;
+
+    /// Read requests from a connection and answer them until the client hangs up.
+    /// \param fd connected socket
+    void serve(int fd) {
+        QueryProtocol::RequestHeader req;
+        while (SocketIO::readAll(fd, &req, sizeof(req))) {
+            QueryProtocol::ResponseHeader resp = {QueryProtocol::RESPONSE_MAGIC, QueryProtocol::OK, 0, 0, 0, 0};
+            if (req.magic != QueryProtocol::REQUEST_MAGIC || (int) req.dim != dim || req.count > (uint32_t) maxPending) {
+                // Refuse to read the queries, and with them lose track of the stream
+                resp.status = QueryProtocol::BAD_REQUEST;
+                SocketIO::writeAll(fd, &resp, sizeof(resp));
+                break;
+            }
+            Batch batch;
+            batch.dim = req.dim;
+            batch.queries.resize((size_t) req.count * req.dim);
+            if (!SocketIO::readAll(fd, batch.queries.data(), batch.queries.size() * sizeof(double))) { break; }
+
+            if (!admit(batch, req.count)) {
+                resp.status = QueryProtocol::BUSY;
+                busy ++;
+            } else {
+                std::unique_lock<std::mutex> wait(batch.lock);
+                batch.done.wait(wait, [&] { return batch.remaining == 0; });
+                resp.serverNanos = nanosSince(batch.admitted);
+                resp.queueNanos = std::max(0L, batch.firstStart.load());
+                if (batch.failed) {
+                    resp.status = QueryProtocol::ERROR;
+                } else {
+                    resp.count = req.count;
+                    served += req.count;
+                }
+            }
+            if (!SocketIO::writeAll(fd, &resp, sizeof(resp)) ||
+                    !SocketIO::writeAll(fd, batch.results.data(), resp.count * sizeof(QueryProtocol::QueryResult))) {
+                break;
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        close(fd);
+        connections.erase(fd);
+        closed.notify_all();
+    }
+
+    ///
+    /// Queue the queries of the batch, unless that would exceed maxPending.
+    bool admit(Batch& batch, int count) {
+        batch.results.resize(count);
+        batch.remaining = count;
+        batch.admitted = Clock::now();
+        if (count == 0) { return true; }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (pending + count > maxPending) { return false; }
+            pending += count;
+            for (int i = 0; i < count; i ++) {
+                tasks.push_back({&batch, i});
+            }
+        }
+        ready.notify_all();
+        return true;
+    }
+
+    void work() {
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> wait(lock);
+                ready.wait(wait, [&] { return stopped || !tasks.empty(); });
+                if (stopped) { return; }
+                task = tasks.front();
+                tasks.pop_front();
+            }
+            Batch& batch = *task.batch;
+            long expected = -1;
+            batch.firstStart.compare_exchange_strong(expected, nanosSince(batch.admitted));
+
+            VectorXd q = Eigen::Map<VectorXd>(&batch.queries[(size_t) task.index * batch.dim], batch.dim);
+            auto t1 = Clock::now();
+            try {
+                vector<double> returns = estimate(q);
+                auto& result = batch.results[task.index];
+                result.nanos = nanosSince(t1);
+                result.estimate = returns[0];
+                result.samples = returns[1];
+                result.level = returns[2];
+            } catch (const std::exception& e) {
+                // Fail the batch rather than the server
+                std::cout << "Query failed: " << e.what() << std::endl;
+                batch.failed = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                pending --;
+            }
+            std::lock_guard<std::mutex> guard(batch.lock);
+            if (-- batch.remaining == 0) {
+                batch.done.notify_all();
+            }
+        }
+    }
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        std::cout << "Usage: ./hbe_server <config> <scope> <eps> <socket> [true] [--threads=T] [--max-pending=Q] "
+                     "[--budget=MB] [--probes=P] [--probe-gain=G] [--pyramid] [--shards=S] [--background] [--rebuild-every=seconds] "
+                     "[--coreset=file]" << std::endl;
+        exit(1);
+    }
+
+    char *scope = argv[2];
+    double eps = atof(argv[3]);
+    std::string path = argv[4];
+    bool random = false;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int max_pending = 100000;
+    int shards = 1;
+    bool background = false;
+    double rebuild_every = 0;
+    std::string coreset_path;
+    HBEOptions opts;
+    for (int i = 5; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 10, "--threads=") == 0) {
+            threads = std::max(1, atoi(arg.c_str() + 10));
+        } else if (arg.compare(0, 14, "--max-pending=") == 0) {
+            max_pending = std::max(1, atoi(arg.c_str() + 14));
+        } else if (arg.compare(0, 9, "--budget=") == 0) {
+            opts.memoryBudget = size_t(atof(arg.c_str() + 9) * 1e6);
+        } else if (arg.compare(0, 9, "--probes=") == 0) {
+            opts.probes = atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 13, "--probe-gain=") == 0) {
+            opts.probeGain = atof(arg.c_str() + 13);
+        } else if (arg == "--pyramid") {
+            opts.pyramid = true;
+        } else if (arg.compare(0, 9, "--shards=") == 0) {
+            shards = std::max(1, atoi(arg.c_str() + 9));
+        } else if (arg == "--background") {
+            background = true;
+        } else if (arg.compare(0, 16, "--rebuild-every=") == 0) {
+            background = true;
+            rebuild_every = atof(arg.c_str() + 16);
+        } else if (arg.compare(0, 10, "--coreset=") == 0) {
+            coreset_path = arg.substr(10);
+        } else if (arg == "true") {
+            random = true;
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    parseConfig cfg(argv[1], scope);
+    int dim = cfg.getDim();
+
+    // Hashing schemes chosen by hbe_tune, if any
+    try {
+        for (double k : cfg.getList("hash_k")) { opts.hashK.push_back(int(k)); }
+        opts.hashW = cfg.getList("hash_w");
+        opts.relVar = cfg.getList("hash_relvar");
+    } catch (...) {}
+    std::function<vector<double>(const VectorXd&)> estimate;
+    shared_ptr<AdaptiveEstimator> est;
+    shared_ptr<HotSwapEstimator> swapping;
+    shared_ptr<Coreset> coreset;
+    shared_ptr<Kernel> kernel;
+    auto t1 = Clock::now();
+    if (!coreset_path.empty()) {
+        coreset = make_shared<Coreset>(Coreset::read(coreset_path));
+        if (coreset->dim() != dim) {
+            std::cout << "Coreset has dimension " << coreset->dim() << ", config " << dim << std::endl;
+            exit(1);
+        }
+        if (coreset->kernel == "gaussian") {
+            kernel = make_shared<Gaussiankernel>(dim);
+        } else {
+            kernel = make_shared<Expkernel>(dim);
+        }
+        std::cout << "Coreset of " << coreset->size() << " points" << std::endl;
+        // A coreset is evaluated exactly: one sample per point, no levels
+        estimate = [&](const VectorXd& q) {
+            return vector<double>{coreset->density(*kernel, q), (double) coreset->size(), 0};
+        };
+    } else {
+        // Shards read their own rows of the dataset
+        DataIngest data(cfg, false, shards == 1);
+        double h = data.h;
+        if (shards > 1) {
+            ShardOptions shard_opts;
+            shard_opts.random = random;
+            shard_opts.hbe = opts;
+            est = make_shared<ShardedEstimator>((long) data.N, ShardedEstimator::fileLoader(
+                    cfg.getDataFile(), cfg.ignoreHeader(), cfg.getStartCol(), cfg.getEndCol(), data.bandwidth,
+                    data.weightCol), shards, data.kernel, data.tau, eps, shard_opts);
+        } else if (random) {
+            est = make_shared<AdaptiveRS>(data.X_ptr, data.W_ptr, data.kernel, data.tau, eps);
+        } else if (background) {
+            HotSwapOptions swap_opts;
+            swap_opts.hbe = opts;
+            swap_opts.rebuildEvery = std::chrono::milliseconds(long(rebuild_every * 1e3));
+            // Periodic rebuilds reload the dataset, which may have changed since
+            HotSwapEstimator::DataLoader load = [&cfg](shared_ptr<MatrixXd>& X, shared_ptr<VectorXd>& W) {
+                DataIngest fresh(cfg, false);
+                X = fresh.X_ptr;
+                W = fresh.W_ptr;
+            };
+            swapping = make_shared<HotSwapEstimator>(data.X_ptr, data.W_ptr, data.kernel, data.tau, eps,
+                    swap_opts, load);
+            est = swapping;
+        } else {
+            opts.weights = data.W_ptr;
+            est = make_shared<AdaptiveHBE>(data.X_ptr, data.kernel, data.tau, eps, true, opts);
+        }
+        std::cout << (random ? "RS" : background ? "RS until HBE is built" : "HBE") << ", eps = " << eps
+                  << std::endl;
+        estimate = [est, h](const VectorXd& q) {
+            return est->estimate(q / h, nullptr);
+        };
+    }
+    std::cout << "Adaptive Table Init: " << nanosSince(t1) / 1e9 << std::endl;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    int listen_fd = SocketIO::listenUnix(path, 128);
+    std::cout << "Listening on " << path << " with " << threads << " threads" << std::endl;
+
+    {
+        Server server(estimate, dim, threads, max_pending);
+        pollfd pfd = {listen_fd, POLLIN, 0};
+        int generation = 0;
+        while (!stopping) {
+            if (swapping != nullptr && swapping->generation() != generation) {
+                generation = swapping->generation();
+                std::cout << "Swapped in HBE index " << generation << " after " << nanosSince(t1) / 1e9 << "s"
+                          << std::endl;
+            }
+            // Wake up regularly to notice signals
+            if (poll(&pfd, 1, 200) <= 0) { continue; }
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) { server.accept(fd); }
+        }
+        std::cout << "Served " << server.served << " queries, " << server.busy << " busy responses" << std::endl;
+    }
+    close(listen_fd);
+    unlink(path.c_str());
+}
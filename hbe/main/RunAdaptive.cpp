@@ -10,73 +10,390 @@
  *      ./hbe conf/shuttle.cfg gaussian 0.9
  *          => Run adaptive sampling with HBE, with eps=0.9
  *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --budget=512
+ *          => Run adaptive sampling with HBE, capping the hash tables at 512MB
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --probes=4
+ *          => Run adaptive sampling with HBE, probing 4 cells per hash table (multi-probe LSH). With
+ *             --probe-gain=G, also assume probing lowers the variance of a sample G times and build
+ *             G times fewer tables, giving up the guarantee on the error
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --pyramid
+ *          => Run adaptive sampling with HBE, sampling each level's tables from a multi-resolution
+ *             sketch hashed at that level's scale
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --shards=4
+ *          => Split the dataset into 4 shards, each read and indexed by HBE in its own worker process,
+ *             and combine the shards' estimates
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --lazy
+ *          => Build the hash tables of each level when the first query reaches it, answering queries
+ *             by random sampling at levels another thread is still building. --prewarm also builds
+ *             the levels on a background thread from the start
+ *
+ *      ./hbe shuttle_tuned.cfg gaussian 0.9
+ *          => Use the hashing scheme and relative variance of each level from the config's hash_k, hash_w
+ *             and hash_relvar entries, as written by hbe_tune
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --dry-run
+ *          => Only print the predicted memory footprint of the HBE index
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --trace=trace.jsonl
+ *          => Also write a per-query execution trace (levels visited, probes, samples, time per phase)
+ *             as one JSON object per line
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --sequential=0.05
+ *          => Stop sampling each level as soon as an empirical Bernstein bound certifies its estimate,
+ *             failing with probability at most 0.05 per level (default 0.05 with --sequential)
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --deadline-us=200
+ *          => Answer each query within 200us (or --max-samples=S samples) with the best estimate available
+ *             and a 95% confidence interval, instead of finishing the adaptive walk
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --threshold=1e-3 --delta=0.01
+ *          => Only decide whether each query's density is at least 1e-3 (e.g. to flag outliers), stopping
+ *             as soon as a 99% confidence interval excludes the threshold. --delta also sets the
+ *             failure probability of the --deadline-us intervals (default 0.05)
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --batch=1024
+ *          => Answer the queries in blocks of 1024, advancing each block through the levels together
+ *             (AdaptiveEstimator::estimateBatch); the time of a query is its block's time divided by
+ *             the block size
+ *
+ *      ./hbe conf/shuttle.cfg gaussian 0.9 --output=shuttle.res
+ *          => Write the per-query results (id, estimate, exact density, samples, level, nanoseconds)
+ *             and the run parameters to a columnar binary file (utils/ResultWriter.h) instead of
+ *             printing RESULT lines
+ *
  */
 
 #include <chrono>
 #include "../alg/RS.h"
 #include "../alg/AdaptiveRS.h"
 #include "../alg/AdaptiveHBE.h"
+#include "../alg/ShardedEstimator.h"
 #include "../utils/DataIngest.h"
+#include "../utils/ResultWriter.h"
 #include "parseConfig.h"
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        std::cout << "Need config file" << std::endl;
-        exit(1);
+void printMemory(const char* title, const IndexMemory& mem) {
+    std::cout << title << " (MB): " << mem.current() / 1e6 <<
+              ", peak during construction: " << mem.peak() / 1e6 << std::endl;
+    for (size_t i = 0; i < mem.levels.size(); i ++) {
+        auto& l = mem.levels[i];
+        std::cout << "  Level " << i << ": tables=" << l.tables << " hashing=" << l.hashing / 1e6 <<
+                  " buckets=" << l.buckets / 1e6 << " samples=" << l.samples / 1e6;
+        if (l.tables == 0) { std::cout << " (RS)"; }
+        std::cout << std::endl;
+    }
+    if (mem.sketch.tables > 0) {
+        std::cout << "  Sketch: tables=" << mem.sketch.tables << " hashing=" << mem.sketch.hashing / 1e6 <<
+                  " buckets=" << mem.sketch.buckets / 1e6 << " samples=" << mem.sketch.samples / 1e6;
+        if (!mem.sketchHeld) { std::cout << " (freed)"; }
+        std::cout << std::endl;
     }
+}
+
+void usage() {
+    std::cout << "Usage: ./hbe <config> <scope> <eps> [true] [--budget=MB] [--probes=P] [--probe-gain=G] "
+                 "[--pyramid] [--lazy] [--prewarm] [--shards=S] [--sequential[=delta]] [--deadline-us=us] "
+                 "[--max-samples=S] [--threshold=t] [--delta=d] [--batch=B] [--trace=file] [--output=file] "
+                 "[--dry-run]" << std::endl;
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) { usage(); }
 
     char *scope = argv[2];
     double eps = atof(argv[3]);
-    bool random = (argc > 4);
+    bool random = false;
+    bool dry_run = false;
+    int shards = 1;
+    double sequential = 0;
+    QueryBudget budget;
+    double threshold = 0;
+    int batch = 0;
+    std::string trace_path;
+    std::string output_path;
+    HBEOptions opts;
+    for (int i = 4; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--budget=") == 0) {
+            opts.memoryBudget = size_t(atof(arg.c_str() + 9) * 1e6);
+        } else if (arg.compare(0, 9, "--probes=") == 0) {
+            opts.probes = atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 13, "--probe-gain=") == 0) {
+            opts.probeGain = atof(arg.c_str() + 13);
+        } else if (arg.compare(0, 8, "--trace=") == 0) {
+            trace_path = arg.substr(8);
+        } else if (arg.compare(0, 9, "--output=") == 0) {
+            output_path = arg.substr(9);
+        } else if (arg == "--pyramid") {
+            opts.pyramid = true;
+        } else if (arg == "--lazy") {
+            opts.lazy = true;
+        } else if (arg == "--prewarm") {
+            opts.lazy = true;
+            opts.prewarm = true;
+        } else if (arg.compare(0, 9, "--shards=") == 0) {
+            shards = std::max(1, atoi(arg.c_str() + 9));
+        } else if (arg == "--sequential") {
+            sequential = 0.05;
+        } else if (arg.compare(0, 13, "--sequential=") == 0) {
+            sequential = atof(arg.c_str() + 13);
+        } else if (arg.compare(0, 14, "--deadline-us=") == 0) {
+            budget.nanos = long(atof(arg.c_str() + 14) * 1e3);
+        } else if (arg.compare(0, 14, "--max-samples=") == 0) {
+            budget.samples = atol(arg.c_str() + 14);
+        } else if (arg.compare(0, 12, "--threshold=") == 0) {
+            threshold = atof(arg.c_str() + 12);
+        } else if (arg.compare(0, 8, "--batch=") == 0) {
+            batch = atoi(arg.c_str() + 8);
+        } else if (arg.compare(0, 8, "--delta=") == 0) {
+            budget.delta = atof(arg.c_str() + 8);
+        } else if (arg == "--dry-run") {
+            dry_run = true;
+        } else if (arg == "true") {
+            random = true;
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            usage();
+        }
+    }
 
-    std::cout << argc << std::endl;
+    // Shards walk their levels in the workers, so the parent has no level samplers to draw from
+    if (shards > 1 && (budget.nanos > 0 || budget.samples > 0)) {
+        std::cout << "--deadline-us and --max-samples cannot be combined with --shards" << std::endl;
+        exit(1);
+    }
+    if (shards > 1 && threshold > 0) {
+        std::cout << "--threshold cannot be combined with --shards" << std::endl;
+        exit(1);
+    }
+
+    // Only the adaptive walk of query() fills a trace
+    if (!trace_path.empty() && (threshold > 0 || budget.nanos > 0 || budget.samples > 0 || batch > 0)) {
+        std::cout << "--trace cannot be combined with --threshold, --deadline-us, --max-samples or --batch"
+                  << std::endl;
+        exit(1);
+    }
 
     parseConfig cfg(argv[1], scope);
-    DataIngest data(cfg, true);
+    // Shards read their own rows of the dataset
+    DataIngest data(cfg, true, shards == 1);
+    opts.weights = data.W_ptr;
+
+    // Hashing schemes chosen by hbe_tune, if any
+    try {
+        for (double k : cfg.getList("hash_k")) { opts.hashK.push_back(int(k)); }
+        opts.hashW = cfg.getList("hash_w");
+        opts.relVar = cfg.getList("hash_relvar");
+    } catch (...) {}
 
     shared_ptr<AdaptiveEstimator> est;
+    shared_ptr<AdaptiveHBE> lazy;
+    double build_time = 0;
+    vector<int64_t> level_tables;
     std::cout << "eps = " << eps << std::endl;
-    if (random) {
+    if (shards > 1) {
+        std::cout << (random ? "RS" : "HBE") << ", " << shards << " shards" << std::endl;
+        ShardOptions shard_opts;
+        shard_opts.random = random;
+        shard_opts.hbe = opts;
+        shard_opts.sequential = sequential;
+        auto t1 = std::chrono::high_resolution_clock::now();
+        auto sharded = make_shared<ShardedEstimator>((long) data.N, ShardedEstimator::fileLoader(
+                cfg.getDataFile(), cfg.ignoreHeader(), cfg.getStartCol(), cfg.getEndCol(), data.bandwidth,
+                data.weightCol), shards, data.kernel, data.tau, eps, shard_opts);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        build_time = std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0;
+        std::cout << "Adaptive Table Init: " << build_time << std::endl;
+        if (!random) {
+            vector<size_t> bytes = sharded->shardIndexBytes();
+            for (size_t s = 0; s < bytes.size(); s ++) {
+                std::cout << "  Shard " << s << " index memory (MB): " << bytes[s] / 1e6 << std::endl;
+            }
+        }
+        est = sharded;
+    } else if (random) {
         std::cout << "RS" << std::endl;
         auto t1 = std::chrono::high_resolution_clock::now();
-        est = make_shared<AdaptiveRS>(data.X_ptr, data.kernel, data.tau, eps);
+        est = make_shared<AdaptiveRS>(data.X_ptr, data.W_ptr, data.kernel, data.tau, eps);
         auto t2 = std::chrono::high_resolution_clock::now();
-        std::cout << "Adaptive Table Init: " <<
-                  std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0 << std::endl;
+        build_time = std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0;
+        std::cout << "Adaptive Table Init: " << build_time << std::endl;
     } else {
         std::cout << "HBE" << std::endl;
+        printMemory("Estimated index memory",
+                AdaptiveHBE::estimateMemory(data.N, data.dim, data.tau, eps, true, data.kernel, opts));
+        if (dry_run) { return 0; }
         auto t1 = std::chrono::high_resolution_clock::now();
-        est = make_shared<AdaptiveHBE>(data.X_ptr, data.kernel, data.tau, eps, true);
+        auto hbe = make_shared<AdaptiveHBE>(data.X_ptr, data.kernel, data.tau, eps, true, opts);
         auto t2 = std::chrono::high_resolution_clock::now();
-        std::cout << "Adaptive Table Init: " <<
-                  std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0 << std::endl;
+        build_time = std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() / 1000.0;
+        std::cout << "Adaptive Table Init: " << build_time << std::endl;
+        IndexMemory mem = hbe->memoryUsage();
+        if (opts.lazy) {
+            std::cout << "Index memory (MB): " << mem.resident() / 1e6 << ", levels built on first use" << std::endl;
+        } else {
+            printMemory("Index memory", mem);
+        }
+        for (auto& l : mem.levels) { level_tables.push_back(l.tables); }
+        est = hbe;
+        if (opts.lazy) { lazy = hbe; }
+    }
+
+    if (sequential > 0 && shards == 1) {
+        est->setSequential(sequential);
+        std::cout << "Sequential levels, delta = " << sequential << std::endl;
     }
 
     est->totalTime = 0;
     vector<double> estimate;
     vector<double> samples;
-    vector<double> times;
+    vector<double> levels;
+    vector<int64_t> nanos;
 
-    for (int j = 0; j < data.M; j++) {
-        int idx = j * 2;
-        VectorXd q = data.X_ptr->row(j);
-        if (data.hasQuery != 0) {
-            q = data.Y_ptr->row(j);
-        } else {
-            if (!data.sequential) {
-                q = data.X_ptr->row(data.exact[idx + 1]);
-            }
+    std::ofstream trace_file;
+    QueryTrace trace;
+    QueryTrace* tracing = nullptr;
+    if (!trace_path.empty()) {
+        trace_file.open(trace_path);
+        tracing = &trace;
+    }
+
+    bool anytime = budget.nanos > 0 || budget.samples > 0;
+    vector<double> lower, upper;
+    vector<int64_t> above, certain;
+    int complete = 0;
+    for (int j = 0; batch > 0 && j < data.M; j += batch) {
+        int n = std::min(batch, data.M - j);
+        MatrixXd Q(n, data.dim);
+        for (int i = 0; i < n; i ++) { Q.row(i) = data.getQuery(j + i); }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        vector<vector<double>> results = est->estimateBatch(Q);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count();
+        for (auto& r : results) {
+            estimate.push_back(r[0]);
+            samples.push_back(r[1]);
+            levels.push_back(r[2]);
+            nanos.push_back(elapsed / n);
         }
+    }
+    for (int j = 0; batch == 0 && j < data.M; j++) {
+        VectorXd q = data.getQuery(j);
         auto t1 = std::chrono::high_resolution_clock::now();
-        vector<double> estimates = est->query(q);
+        vector<double> estimates;
+        if (threshold > 0) {
+            ThresholdDecision d = est->isAbove(q, threshold, budget.delta);
+            estimates = {d.estimate, d.samples, (double) est->thresholdLevel(threshold)};
+            lower.push_back(d.lower);
+            upper.push_back(d.upper);
+            above.push_back(d.above);
+            certain.push_back(d.certain);
+        } else if (anytime) {
+            AnytimeEstimate a = est->queryWithin(q, budget);
+            estimates = {a.estimate, a.samples, (double) a.level};
+            lower.push_back(a.lower);
+            upper.push_back(a.upper);
+            complete += a.complete;
+        } else {
+            estimates = est->query(q, tracing);
+        }
         auto t2 = std::chrono::high_resolution_clock::now();
+        if (tracing != nullptr) {
+            trace.id = j;
+            trace_file << trace.toJSON() << "\n";
+        }
         estimate.push_back(estimates[0]);
         samples.push_back(estimates[1]);
-        times.push_back((t2-t1).count() / 1e6);
+        levels.push_back(estimates[2]);
+        nanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count());
+    }
+
+    if (lazy != nullptr) {
+        IndexMemory mem = lazy->memoryUsage();
+        std::cout << "Lazy: " << lazy->builtLevels() << " hashed levels built by the queries" << std::endl;
+        printMemory("Index memory after queries", mem);
+        level_tables.clear();
+        for (auto& l : mem.levels) { level_tables.push_back(l.tables); }
     }
 
-    for (int i = 0; i < data.M; i++) {
-        std::cout << "RESULT id=" << i << " est=" << estimate[i] << " samples=" << samples[i] << " time=" << times[i] << std::endl;
+    if (threshold > 0) {
+        int n_above = 0, n_certain = 0, wrong = 0;
+        double total_samples = 0;
+        for (int i = 0; i < data.M; i++) {
+            n_above += above[i];
+            n_certain += certain[i];
+            wrong += above[i] != (data.exact[i * 2] >= threshold);
+            total_samples += samples[i];
+        }
+        std::cout << "Threshold " << threshold << ": " << n_above << " of " << data.M << " queries above, "
+                  << n_certain << " decided with certainty, " << wrong << " disagree with the exact density, "
+                  << total_samples / data.M << " samples per query" << std::endl;
+    } else if (anytime) {
+        int covered = 0;
+        for (int i = 0; i < data.M; i++) {
+            covered += lower[i] <= data.exact[i * 2] && data.exact[i * 2] <= upper[i];
+        }
+        std::cout << "Anytime: " << complete << " of " << data.M << " queries finished within budget, "
+                  << covered << " intervals hold the exact density" << std::endl;
+    }
+
+    if (output_path.empty()) {
+        for (int i = 0; i < data.M; i++) {
+            std::cout << "RESULT id=" << i << " est=" << estimate[i] << " samples=" << samples[i] << " time=" << nanos[i] / 1e6 << std::endl;
+        }
+    } else {
+        ResultWriter out(output_path);
+        out.meta("algorithm", random ? "rs" : "hbe");
+        out.meta("eps", eps);
+        out.meta("tau", data.tau);
+        out.meta("h", data.h);
+        out.meta("n", data.N);
+        out.meta("dim", data.dim);
+        out.meta("shards", shards);
+        out.meta("sequential", sequential);
+        out.meta("batch", batch);
+        out.meta("levels", est->levels());
+        out.meta("build_seconds", build_time);
+        if (!level_tables.empty()) {
+            std::ostringstream tables;
+            for (size_t i = 0; i < level_tables.size(); i ++) {
+                tables << (i > 0 ? "," : "") << level_tables[i];
+            }
+            out.meta("tables", tables.str());
+            out.meta("probes", opts.probes);
+            out.meta("probe_gain", opts.probeGain);
+        }
+        vector<int64_t> ids(data.M);
+        vector<double> exact(data.M);
+        for (int i = 0; i < data.M; i++) {
+            ids[i] = i;
+            exact[i] = data.exact[i * 2];
+        }
+        out.column("id", ids);
+        out.column("estimate", estimate);
+        out.column("exact", exact);
+        out.column("samples", samples);
+        out.column("level", levels);
+        out.column("nanos", nanos);
+        if (threshold > 0) {
+            out.meta("threshold", threshold);
+            out.meta("delta", budget.delta);
+            out.column("above", above);
+            out.column("certain", certain);
+            out.column("lower", lower);
+            out.column("upper", upper);
+        } else if (anytime) {
+            out.meta("deadline_nanos", budget.nanos);
+            out.meta("max_samples", budget.samples);
+            out.column("lower", lower);
+            out.column("upper", upper);
+        }
+        out.write();
     }
 
     //std::cout << "Sampling total time: " << est->totalTime / 1e9 << std::endl;
@@ -0,0 +1,280 @@
+/*
+ *  Scalability benchmark:
+ *      Sweep the number of points n, the dimension d and the minimum density tau over synthetic
+ *      "worst-case" instances (data/SyntheticData.h, with density tau) and measure, for adaptive HBE
+ *      with an HBS sketch (hbe), adaptive HBE with a uniform sketch (hbe_uniform) and adaptive RS (rs):
+ *
+ *          build_s         construction time of the estimator
+ *          index_mb        heap footprint of the hash tables (AdaptiveHBE::memoryUsage; 0 for RS)
+ *          peak_rss_mb     peak resident set size while building and querying (Linux): the index plus
+ *                          the pages of the shared dataset the algorithm touched
+ *          data_mb         resident set size of the driver with only the dataset generated
+ *          query_ms_*      mean, median and 99th percentile query latency
+ *          samples         mean number of samples per query
+ *          rel_err         mean relative error against the exact densities (--error only, else -1)
+ *
+ *      Each instance is generated once; every algorithm is then built and queried in a forked child,
+ *      so peak RSS is measured per algorithm. Configurations whose dataset, or whose predicted HBE
+ *      index (AdaptiveHBE::estimateMemory), exceed --max-gb are skipped with a note on stderr.
+ *
+ *      Outputs one CSV row (default, with a header line) or one JSON object (--json) per
+ *      configuration and algorithm.
+ *
+ *  Example usage:
+ *      ./hbe_scale
+ *          => n in 1e4..1e6, d in 3,10,100, tau in 1e-3,1e-4 with eps=0.5
+ *
+ *      ./hbe_scale --n=1e4,1e5,1e6,1e7,1e8 --d=3,10,100,1000 --tau=1e-3 --max-gb=64 --json > scale.jsonl
+ *
+ *      ./hbe_scale --n=1e5 --d=10 --tau=1e-2,1e-3,1e-4 --alg=hbe,rs --error
+ */
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../alg/AdaptiveRS.h"
+#include "../alg/AdaptiveHBE.h"
+#include "../data/SyntheticData.h"
+#include "dataUtils.h"
+#include "gaussiankernel.h"
+#include "expkernel.h"
+
+const double spread = 0.001;
+const int scales = 4;
+
+bool json = false;
+
+///
+/// Measurements of one algorithm on one instance, sent from the child to the parent.
+///
+struct Result {
+    double build = 0;
+    double index = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double samples = 0;
+    double err = -1;
+};
+
+vector<double> parseList(const std::string& list) {
+    vector<double> values;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        values.push_back(atof(item.c_str()));
+    }
+    return values;
+}
+
+double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+/// Build an estimator and answer the queries.
+/// \param alg hbe, hbe_uniform or rs
+/// \param X dataset
+/// \param kernel kernel
+/// \param tau minimum density
+/// \param eps relative error
+/// \param queries queries
+/// \param exact exact densities of the queries, or empty
+Result run(const std::string& alg, shared_ptr<MatrixXd> X, shared_ptr<Kernel> kernel, double tau, double eps,
+           const vector<VectorXd>& queries, const vector<double>& exact) {
+    Result res;
+    shared_ptr<AdaptiveEstimator> est;
+    auto start = std::chrono::steady_clock::now();
+    if (alg == "rs") {
+        est = make_shared<AdaptiveRS>(X, kernel, tau, eps);
+        res.build = elapsed(start);
+    } else {
+        auto hbe = make_shared<AdaptiveHBE>(X, kernel, tau, eps, alg == "hbe");
+        res.build = elapsed(start);
+        res.index = hbe->memoryUsage().resident();
+        est = hbe;
+    }
+
+    vector<double> times;
+    vector<double> err;
+    for (size_t j = 0; j < queries.size(); j ++) {
+        auto t1 = std::chrono::steady_clock::now();
+        vector<double> estimates = est->query(queries[j]);
+        times.push_back(elapsed(t1) * 1e3);
+        res.samples += estimates[1] / queries.size();
+        if (!exact.empty()) {
+            err.push_back(fabs(estimates[0] - exact[j]) / max(tau, exact[j]));
+        }
+    }
+    res.mean = dataUtils::getAvg(times);
+    std::sort(times.begin(), times.end());
+    res.p50 = times[times.size() / 2];
+    res.p99 = times[std::min(times.size() - 1, size_t(ceil(times.size() * 0.99)) - 1)];
+    if (!err.empty()) {
+        res.err = dataUtils::getAvg(err);
+    }
+    return res;
+}
+
+void print(const std::string& alg, long n, int d, double tau, double eps, int clusters, const Result& res,
+           double rss, double data) {
+    if (json) {
+        std::cout << "{\"alg\":\"" << alg << "\",\"n\":" << n << ",\"d\":" << d << ",\"tau\":" << tau
+                  << ",\"eps\":" << eps << ",\"clusters\":" << clusters << ",\"build_s\":" << res.build
+                  << ",\"index_mb\":" << res.index / 1e6 << ",\"peak_rss_mb\":" << rss << ",\"data_mb\":" << data
+                  << ",\"query_ms_mean\":" << res.mean << ",\"query_ms_p50\":" << res.p50
+                  << ",\"query_ms_p99\":" << res.p99 << ",\"samples\":" << res.samples
+                  << ",\"rel_err\":" << res.err << "}" << std::endl;
+    } else {
+        std::cout << alg << "," << n << "," << d << "," << tau << "," << eps << "," << clusters << ","
+                  << res.build << "," << res.index / 1e6 << "," << rss << "," << data << ","
+                  << res.mean << "," << res.p50 << "," << res.p99 << "," << res.samples << ","
+                  << res.err << std::endl;
+    }
+}
+
+/// Current RSS of the calling process in MB. Unlike the peak, it drops once the previous instance is freed.
+double currentRSS() {
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    vector<double> ns = {1e4, 1e5, 1e6};
+    vector<double> dims = {3, 10, 100};
+    vector<double> taus = {1e-3, 1e-4};
+    vector<std::string> algs = {"hbe", "hbe_uniform", "rs"};
+    double eps = 0.5;
+    int clusters = 10;
+    int nqueries = 100;
+    double max_gb = 16;
+    bool error = false;
+    std::string kernel_name = "gaussian";
+    for (int i = 1; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 4, "--n=") == 0) {
+            ns = parseList(arg.substr(4));
+        } else if (arg.compare(0, 4, "--d=") == 0) {
+            dims = parseList(arg.substr(4));
+        } else if (arg.compare(0, 6, "--tau=") == 0) {
+            taus = parseList(arg.substr(6));
+        } else if (arg.compare(0, 6, "--alg=") == 0) {
+            algs.clear();
+            std::stringstream ss(arg.substr(6));
+            std::string item;
+            while (std::getline(ss, item, ',')) { algs.push_back(item); }
+        } else if (arg.compare(0, 6, "--eps=") == 0) {
+            eps = atof(arg.c_str() + 6);
+        } else if (arg.compare(0, 11, "--clusters=") == 0) {
+            clusters = std::max(1, atoi(arg.c_str() + 11));
+        } else if (arg.compare(0, 10, "--queries=") == 0) {
+            nqueries = std::max(1, atoi(arg.c_str() + 10));
+        } else if (arg.compare(0, 9, "--max-gb=") == 0) {
+            max_gb = atof(arg.c_str() + 9);
+        } else if (arg.compare(0, 9, "--kernel=") == 0) {
+            kernel_name = arg.substr(9);
+        } else if (arg == "--error") {
+            error = true;
+        } else if (arg == "--json") {
+            json = true;
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+    for (auto& alg : algs) {
+        if (alg != "hbe" && alg != "hbe_uniform" && alg != "rs") {
+            std::cout << "Unknown algorithm " << alg << std::endl;
+            exit(1);
+        }
+    }
+
+    if (!json) {
+        std::cout << "alg,n,d,tau,eps,clusters,build_s,index_mb,peak_rss_mb,data_mb,"
+                     "query_ms_mean,query_ms_p50,query_ms_p99,samples,rel_err" << std::endl;
+    }
+    uint64_t seed = 0;
+    for (double nd : ns) {
+        for (double dd : dims) {
+            for (double tau : taus) {
+                long n = (long) nd;
+                int d = (int) dd;
+                seed ++;
+                if (n * d * sizeof(double) > max_gb * 1e9) {
+                    std::cerr << "Skipping n=" << n << " d=" << d << ": dataset exceeds --max-gb" << std::endl;
+                    continue;
+                }
+                shared_ptr<Kernel> kernel;
+                if (kernel_name == "exp") {
+                    kernel = make_shared<Expkernel>(d);
+                } else {
+                    kernel = make_shared<Gaussiankernel>(d);
+                }
+
+                // Size the clusters so that the instance has about n points
+                const int probe = 1000000;
+                GenericInstance plan(probe, clusters, scales, d, tau, spread, kernel, seed);
+                int pts = std::max(1, (int) round(probe * (double) n / plan.size()));
+                GenericInstance inst = SyntheticData::genSingle(pts, clusters, d, tau, scales, spread, kernel);
+                auto X = make_shared<MatrixXd>(std::move(inst.points));
+                long N = X->rows();
+
+                vector<VectorXd> queries;
+                vector<double> exact;
+                for (int j = 0; j < nqueries; j ++) {
+                    queries.push_back(inst.query(0.5, false));
+                }
+                if (error) {
+                    for (auto& q : queries) {
+                        Eigen::ArrayXd sq = (X->rowwise() - q.transpose()).rowwise().squaredNorm().array();
+                        kernel->densityFromSquared(sq);
+                        exact.push_back(sq.sum() / N);
+                    }
+                }
+                double data_mb = currentRSS();
+
+                for (auto& alg : algs) {
+                    if (alg != "rs") {
+                        IndexMemory predicted = AdaptiveHBE::estimateMemory(N, d, tau, eps, alg == "hbe", kernel,
+                                HBEOptions());
+                        if (data_mb * 1e6 + predicted.peak() > max_gb * 1e9) {
+                            std::cerr << "Skipping " << alg << " n=" << N << " d=" << d << " tau=" << tau
+                                      << ": predicted index exceeds --max-gb" << std::endl;
+                            continue;
+                        }
+                    }
+                    int fds[2];
+                    if (pipe(fds) != 0) {
+                        perror("pipe");
+                        exit(1);
+                    }
+                    std::cout.flush();
+                    pid_t pid = fork();
+                    if (pid == 0) {
+                        close(fds[0]);
+                        Result res = run(alg, X, kernel, tau, eps, queries, exact);
+                        ssize_t written = write(fds[1], &res, sizeof(res));
+                        _exit(written == sizeof(res) ? 0 : 1);
+                    }
+                    close(fds[1]);
+                    Result res;
+                    bool ok = read(fds[0], &res, sizeof(res)) == sizeof(res);
+                    close(fds[0]);
+                    int status;
+                    struct rusage usage;
+                    wait4(pid, &status, 0, &usage);
+                    if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                        std::cerr << "Failed " << alg << " n=" << N << " d=" << d << " tau=" << tau << std::endl;
+                        continue;
+                    }
+                    print(alg, N, d, tau, eps, clusters, res, usage.ru_maxrss / 1e3, data_mb);
+                }
+            }
+        }
+    }
+}
@@ -1,40 +1,42 @@
 /*
  *  Main program for generating "worst-case" and "D-strucutured" instances.
  *
+ *      The points are generated in parallel chunks and streamed to a binary dataset (see
+ *      utils/BinaryDataset.h), so instances of 10^8-10^9 points never have to fit in memory.
+ *      Every chunk has its own seed derived from --seed, so the same seed writes the same file
+ *      on any number of threads. Queries are written as CSV.
+ *
+ *      --mixed=uN,uC,cN,cC generates a mixed instance: uC clusters of uN points per cluster
+ *      ("uncorrelated") followed by cC clusters of cN points per cluster ("correlated"), and
+ *      ignores <pts per cluster> and <clusters>.
+ *
+ *  Example usage:
+ *      ./hbe_gen generic_1000.bin query_1000.txt 1000 1000
+ *          => 1000 clusters in 100 dimensions, ~1000 points per cluster at the outermost scale
+ *
+ *      ./hbe_gen worst.bin worst_query.txt 100000 10000 --dim=50 --seed=7 --threads=16
+ *          => ~10^9 points, generated with 16 threads
+ *
+ *      ./hbe_gen mixed.bin mixed_query.txt 0 0 --mixed=100,5000,50000,10 --dim=10
  */
 
-
-#include "expkernel.h"
-#include "mathUtils.h"
-#include "dataUtils.h"
-#include "math.h"
-#include "kernel.h"
 #include "expkernel.h"
 #include "gaussiankernel.h"
-#include "bandwidth.h"
 #include "../data/SyntheticData.h"
 #include <chrono>
+#include <iostream>
+#include <fstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-using Eigen::IOFormat;
-
-const int uN = 100;         // #pts (per cluster) for "uncorrelated"
-const int uC = 5000;        // #clusters for "uncorrelated"
-const int cN = 50000;       // #pts (per cluster) for "correlated"
-const int cC = 10;          // #clusters for "correlated"
 const int scales = 4;
-const int dim = 10;
 const double spread = 0.001;
 const double mu = 1.0 / 1000;
 
-const int nqueries = 10000;
-const int N = 1000000;
-
-//int dims[] = {5, 10, 20, 50, 100, 200, 500};
-int clusters[] = {1, 10, 100, 1000, 10000, 100000};
-
-void genQuery(std::ofstream &outfile, GenericInstance &data, int dim) {
+void genQuery(std::ofstream &outfile, GenericInstance &data, int dim, int nqueries, bool correlated) {
     for (int i = 0; i < nqueries; i ++) {
-        VectorXd q = data.query(0.5, false);
+        VectorXd q = data.query(0.5, correlated);
         for (int j = 0; j < dim - 1; j ++) {
             outfile << q[j] << ",";
         }
@@ -42,31 +44,93 @@ void genQuery(std::ofstream &outfile, GenericInstance &data, int dim) {
     }
 }
 
-int main() {
-//    for (size_t i = 0; i < sizeof(dims)/sizeof(dims[0]); i ++) {
-    for (size_t i = 0; i < sizeof(clusters)/sizeof(clusters[0]); i ++) {
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        std::cout << "Usage: ./hbe_gen <data.bin> <query.txt> <pts per cluster> <clusters> [--dim=100] "
+                     "[--scales=4] [--mixed=uN,uC,cN,cC] [--kernel=gaussian|exp] [--seed=S] [--queries=10000] "
+                     "[--correlated] [--chunk=rows] [--threads=T]" << std::endl;
+        exit(1);
+    }
 
-        std::cout << "-------------------------------------------------------" << std::endl;
-        int dim = 100;
-        //int dim = dims[i];
-        std::cout << "dim = " << dim << std::endl;
-        int k = clusters[i];
-        int n = N / k;
-        std::cout << "#pts (per cluster) = " << n << ", #clusters = " << k << std::endl;
-        shared_ptr<Kernel> kernel = make_shared<Gaussiankernel>(dim);
-        // Generate an instance
-        GenericInstance data = SyntheticData::genSingle(n, k, dim, mu, scales, spread, kernel);
-        // Generate a mixed instance
-        //GenericInstance data = SyntheticData::genMixed(uN, cN, uC, cC, dim, mu, scales, spread, kernel);
-        data.output("../resources/data/generic_" +
-            std::to_string(k) + ".txt");
-        std::cout <<  "N=" << data.points.rows() << std::endl;
+    std::string data_file = argv[1];
+    std::string query_file = argv[2];
+    int n = atoi(argv[3]);
+    int k = atoi(argv[4]);
+    int dim = 100;
+    int num_scales = scales;
+    int uN = 0, uC = 0, cN = 0, cC = 0;
+    bool mixed = false;
+    std::string kernel_name = "gaussian";
+    uint64_t seed = std::random_device()();
+    int nqueries = 10000;
+    bool correlated = false;
+    int chunk_rows = 0;
+    for (int i = 5; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 6, "--dim=") == 0) {
+            dim = atoi(arg.c_str() + 6);
+        } else if (arg.compare(0, 9, "--scales=") == 0) {
+            num_scales = atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 8, "--mixed=") == 0) {
+            mixed = sscanf(arg.c_str() + 8, "%d,%d,%d,%d", &uN, &uC, &cN, &cC) == 4;
+            if (!mixed) {
+                std::cout << "Expected --mixed=uN,uC,cN,cC" << std::endl;
+                exit(1);
+            }
+        } else if (arg.compare(0, 9, "--kernel=") == 0) {
+            kernel_name = arg.substr(9);
+        } else if (arg.compare(0, 7, "--seed=") == 0) {
+            seed = strtoull(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.compare(0, 10, "--queries=") == 0) {
+            nqueries = atoi(arg.c_str() + 10);
+        } else if (arg == "--correlated") {
+            correlated = true;
+        } else if (arg.compare(0, 8, "--chunk=") == 0) {
+            chunk_rows = std::max(1, atoi(arg.c_str() + 8));
+        } else if (arg.compare(0, 10, "--threads=") == 0) {
+#ifdef _OPENMP
+            omp_set_num_threads(std::max(1, atoi(arg.c_str() + 10)));
+#endif
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+    if (chunk_rows == 0) {
+        // ~8MB of doubles per chunk
+        chunk_rows = std::max(1, (1 << 20) / dim);
+    }
 
-        // Output query
-        std::ofstream outfile("../resources/data/query_" +
-            std::to_string(k) + ".txt");
-        genQuery(outfile, data, dim);
-        outfile.close();
+    shared_ptr<Kernel> kernel;
+    if (kernel_name == "gaussian") {
+        kernel = make_shared<Gaussiankernel>(dim);
+    } else if (kernel_name == "exp") {
+        kernel = make_shared<Expkernel>(dim);
+    } else {
+        std::cout << "Unknown kernel " << kernel_name << std::endl;
+        exit(1);
     }
 
-}
\ No newline at end of file
+    std::cout << "dim = " << dim << ", seed = " << seed << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    int64_t N, cols;
+    if (mixed) {
+        std::cout << "uncorrelated: #pts (per cluster) = " << uN << ", #clusters = " << uC << std::endl;
+        std::cout << "correlated: #pts (per cluster) = " << cN << ", #clusters = " << cC << std::endl;
+        GenericInstance data = SyntheticData::writeMixed(data_file, uN, cN, uC, cC, dim, mu, num_scales,
+                spread, kernel, seed, chunk_rows);
+        std::ofstream outfile(query_file);
+        genQuery(outfile, data, dim, nqueries, correlated);
+    } else {
+        std::cout << "#pts (per cluster) = " << n << ", #clusters = " << k << std::endl;
+        GenericInstance data = SyntheticData::writeSingle(data_file, n, k, dim, mu, num_scales,
+                spread, kernel, seed, chunk_rows);
+        std::ofstream outfile(query_file);
+        genQuery(outfile, data, dim, nqueries, correlated);
+    }
+    BinaryDataset::shape(data_file, N, cols);
+    double secs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count() / 1000.0;
+    std::cout << "N=" << N << " written to " << data_file << " in " << secs << "s ("
+              << N / std::max(secs, 1e-3) << " points/s)" << std::endl;
+}
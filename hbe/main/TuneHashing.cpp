@@ -0,0 +1,254 @@
+/*
+ *  Hashing scheme tuner:
+ *     Choose the hashing scheme (number of hash functions k, bin width w) of each level of adaptive HBE
+ *     from the data, with the diagnosis procedure (AdaptiveRSDiag). For a sample of queries, bound the
+ *     relative variance of HBE under every scheme of a grid around the default one (vbHBE) at the
+ *     level the query is answered at, and take the largest bound V over the level's queries. At each
+ *     level, keep the scheme with the lowest expected cost
+ *
+ *         queries reaching the level * samples * cost of a sample + tables * cost of building a table,
+ *
+ *     where a level draws L * ceil(V / eps^2) samples, one table each, and the two costs are timed on
+ *     CALIBRATION_TABLES UniformHBE tables of sqrt(n) points built with the scheme. Schemes are
+ *     compared with the default one costed the same way, with its own V, so that they only differ by
+ *     their (k, w). As the default scheme is sized with the kernel's variance bound, which can be
+ *     tighter than V, a scheme must also beat that cost to replace it. The chosen schemes are printed
+ *     as config entries (hash_k, hash_w and hash_relvar, the V that sizes each level), which hbe and
+ *     hbe_server read. Levels that keep the default scheme, including those fewer than MIN_QUERIES
+ *     sampled queries stop at, keep the kernel's variance bound.
+ *
+ *  Example usage:
+ *      ./hbe_tune conf/shuttle.cfg gaussian 0.5
+ *          => Tune for eps=0.5 on 100 sampled queries, assuming 1e6 queries per build
+ *
+ *      ./hbe_tune conf/shuttle.cfg gaussian 0.5 --queries=200 --lifetime=1e4 --output=shuttle_tuned.cfg
+ *          => Tune for 1e4 queries per build (cheaper tables matter more) and write a copy of the
+ *             config with the chosen entries
+ */
+
+#include <chrono>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include "../utils/DataIngest.h"
+#include "../alg/AdaptiveRSDiag.h"
+#include "../alg/UniformHBE.h"
+#include "parseConfig.h"
+
+// Grid of schemes around the default (k, w) of a level
+const vector<double> K_FACTORS = {0.5, 0.75, 1, 1.25, 1.5};
+const vector<double> W_FACTORS = {0.5, 0.71, 1, 1.41, 2};
+// Medians of means of adaptive HBE
+const int L = 3;
+const int CALIBRATION_TABLES = 64;
+// Queries drawn per query wanted, before giving up on finding queries above tau
+const int MAX_DRAWS = 100;
+// Sampled queries a level needs to be tuned, for their largest bound to stand for the level's queries
+const int MIN_QUERIES = 10;
+
+///
+/// Time one sample and the build of one table, in nanoseconds, under a hashing scheme.
+///
+std::pair<double, double> calibrate(DataIngest& data, const vector<VectorXd>& queries, int k, double w) {
+    typedef std::chrono::steady_clock Clock;
+    auto t1 = Clock::now();
+    UniformHBE hbe(data.X_ptr, data.W_ptr, CALIBRATION_TABLES, w, k, data.kernel, int(sqrt(data.N)));
+    auto t2 = Clock::now();
+    for (auto& q : queries) { hbe.estimate(q, 1, CALIBRATION_TABLES, nullptr); }
+    auto t3 = Clock::now();
+    double build = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+    double query = std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t2).count();
+    return std::make_pair(query / queries.size() / CALIBRATION_TABLES, build / CALIBRATION_TABLES);
+}
+
+///
+/// Copy of the config file with the hash_* entries of the scope replaced.
+///
+void writeConfig(const std::string& in, const std::string& out, const std::string& scope,
+        const vector<std::string>& entries) {
+    std::ifstream src(in);
+    std::stringstream text;
+    std::regex start("^\\s*" + scope + "\\s*\\{.*");
+    std::regex end("^\\s*\\}.*");
+    std::regex old("^\\s*hash_(k|w|relvar)\\s*=.*");
+    bool inScope = false;
+    std::string line;
+    while (std::getline(src, line)) {
+        if (std::regex_match(line, start)) {
+            inScope = true;
+        } else if (inScope && std::regex_match(line, old)) {
+            continue;
+        } else if (inScope && std::regex_match(line, end)) {
+            for (auto& e : entries) { text << "    " << e << "\n"; }
+            inScope = false;
+        }
+        text << line << "\n";
+    }
+    src.close();
+    std::ofstream dst(out);
+    dst << text.str();
+}
+
+std::string join(const vector<double>& values) {
+    std::ostringstream s;
+    for (size_t i = 0; i < values.size(); i ++) {
+        s << (i > 0 ? "," : "") << values[i];
+    }
+    return s.str();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: ./hbe_tune <config> <scope> <eps> [--queries=Q] [--lifetime=N] [--output=file]"
+                  << std::endl;
+        exit(1);
+    }
+
+    char *scope = argv[2];
+    double eps = atof(argv[3]);
+    int queries = 100;
+    double lifetime = 1e6;
+    std::string output_path;
+    for (int i = 4; i < argc; i ++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 10, "--queries=") == 0) {
+            queries = std::max(1, atoi(arg.c_str() + 10));
+        } else if (arg.compare(0, 11, "--lifetime=") == 0) {
+            lifetime = atof(arg.c_str() + 11);
+        } else if (arg.compare(0, 9, "--output=") == 0) {
+            output_path = arg.substr(9);
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    parseConfig cfg(argv[1], scope);
+    DataIngest data(cfg, false);
+
+    AdaptiveRSDiag rs(data.X_ptr, data.kernel, data.tau, 0.6);
+    rs.setMedians(5);
+    int levels = rs.levels();
+    int grid = K_FACTORS.size() * W_FACTORS.size();
+    // The default scheme (factors 1 and 1) is the centre of the grid
+    int centre = 2 * W_FACTORS.size() + 2;
+
+    std::random_device rd;
+    std::mt19937 rng(rd());
+    std::uniform_int_distribution<int> distribution(0, data.M - 1);
+
+    // Largest relative variance bound of each level's queries under each scheme of the grid
+    vector<vector<double>> relVar(levels, vector<double>(grid, 0));
+    vector<int> stopped(levels, 0);
+    auto scheme = [&](int level, int c) {
+        std::pair<int, double> base = rs.hashParams(level);
+        int k = std::max(1, (int) round(base.first * K_FACTORS[c / W_FACTORS.size()]));
+        return std::make_pair(k, base.second * W_FACTORS[c % W_FACTORS.size()]);
+    };
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    vector<VectorXd> sampled;
+    int j = 0;
+    for (long draws = 0; j < queries && draws < (long) MAX_DRAWS * queries; draws ++) {
+        int idx = distribution(rng);
+        VectorXd q = data.hasQuery != 0 ? data.Y_ptr->row(idx) : data.X_ptr->row(idx);
+        rs.clearSamples();
+        vector<double> rs_est = rs.query(q);
+        if (rs_est[0] < data.tau) { continue; }
+        double r2 = rs_est[0] * rs_est[0];
+
+        int actual = rs.findActualLevel(q, rs_est[0], eps);
+        for (int c = 0; c < grid; c ++) {
+            std::pair<int, double> kw = scheme(actual, c);
+            rs.setHashParams(kw.first, kw.second);
+            rs.getConstants();
+            rs.findRings(1, 0.5, q, actual);
+            relVar[actual][c] = std::max(relVar[actual][c], rs.vbHBE() / r2);
+        }
+        rs.setHashParams(0, 0);
+        sampled.push_back(q);
+        stopped[actual] ++;
+        j ++;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    if (j == 0) {
+        std::cout << "No sampled query has a density above tau" << std::endl;
+        exit(1);
+    }
+    if (j < queries) {
+        std::cout << "Only " << j << " of " << (long) MAX_DRAWS * queries
+                  << " sampled queries have a density above tau" << std::endl;
+        queries = j;
+    }
+    std::cout << "Diagnosis of " << queries << " queries took: " <<
+              std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() << "ms" << std::endl;
+
+    vector<double> hash_k, hash_w, hash_relvar;
+    double total_default = 0, total_tuned = 0;
+    int reached = queries;
+    for (int i = 0; i < levels; i ++) {
+        double mu = rs.levelTarget(i);
+        std::pair<int, double> base = rs.hashParams(i);
+        // Queries reaching level i, over the lifetime of the index
+        double visits = lifetime * reached / queries;
+        reached -= stopped[i];
+        auto cost = [&](int k, double w, double v) {
+            double samples = L * ceil(v / eps / eps);
+            std::pair<double, double> unit = calibrate(data, sampled, k, w);
+            return visits * samples * unit.first + 1.1 * samples * unit.second;
+        };
+        // Schemes are compared with the default one under the variance bound of the grid's centre, on
+        // equal terms. A scheme replaces the default only if it also beats it as deployed, under the
+        // kernel's bound, which is the one the default scheme is sized with.
+        double kernel_var = data.kernel->RelVar(mu);
+        double centre_var = relVar[i][centre] > 0 ? relVar[i][centre] : kernel_var;
+        double default_cost = stopped[i] > 0 ? cost(base.first, base.second, centre_var) : 1;
+        double deployed_cost = stopped[i] > 0 ? cost(base.first, base.second, kernel_var) : 1;
+
+        int best_k = base.first;
+        double best_w = base.second;
+        double best_var = centre_var;
+        double best_cost = default_cost;
+        bool tuned = false;
+        for (int c = 0; stopped[i] >= MIN_QUERIES && c < grid; c ++) {
+            std::pair<int, double> kw = scheme(i, c);
+            double v = relVar[i][c];
+            if (c == centre || v <= 0) { continue; }
+            double cst = cost(kw.first, kw.second, v);
+            if (cst < best_cost) {
+                best_k = kw.first;
+                best_w = kw.second;
+                best_var = v;
+                best_cost = cst;
+                tuned = true;
+            }
+        }
+        if (!tuned || best_cost >= deployed_cost) {
+            best_k = base.first;
+            best_w = base.second;
+            best_var = kernel_var;
+            best_cost = deployed_cost;
+        }
+        if (stopped[i] > 0) {
+            total_default += deployed_cost;
+            total_tuned += best_cost;
+        }
+        hash_k.push_back(best_k);
+        hash_w.push_back(best_w);
+        hash_relvar.push_back(best_var);
+        std::cout << "Level " << i << ": mu=" << mu << " queries=" << stopped[i] << " default k=" << base.first
+                  << " w=" << base.second << " relvar=" << kernel_var << " (measured " << centre_var << ") -> k="
+                  << best_k << " w=" << best_w << " relvar=" << best_var << ", cost x" << best_cost / deployed_cost << std::endl;
+    }
+    std::cout << "Expected cost of the tuned levels relative to the default schemes: " << total_tuned / total_default << std::endl;
+
+    vector<std::string> entries = {
+            "hash_k = \"" + join(hash_k) + "\";",
+            "hash_w = \"" + join(hash_w) + "\";",
+            "hash_relvar = \"" + join(hash_relvar) + "\";"};
+    for (auto& e : entries) { std::cout << e << std::endl; }
+    if (!output_path.empty()) {
+        writeConfig(argv[1], output_path, scope, entries);
+        std::cout << "Wrote " << output_path << std::endl;
+    }
+}
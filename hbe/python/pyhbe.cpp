@@ -0,0 +1,256 @@
+/*
+ *  Python bindings (module pyhbe) for the estimators of alg/, built with -DHBE_PYTHON=ON.
+ *
+ *  Datasets and queries are float64 NumPy arrays of shape (n, d), already divided by the bandwidth
+ *  (as DataIngest does). Query batches are read in place when they are C-contiguous float64 arrays.
+ *  Datasets are always copied once: the estimators own their data (shared_ptr<MatrixXd>), so they
+ *  cannot borrow NumPy memory. The GIL is released while building
+ *  and while answering a batch, and batches are answered in parallel with OpenMP when available.
+ *
+ *  Example:
+ *      import numpy as np, pyhbe
+ *      X = np.random.randn(100000, 10)
+ *      hbe = pyhbe.AdaptiveHBE(X, tau=1e-3, eps=0.5)
+ *      est, samples, levels = hbe.query(X[:1000])
+ *      exact = pyhbe.NaiveKDE(X).query(X[:1000])
+ */
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include "../alg/AdaptiveHBE.h"
+#include "../alg/AdaptiveRS.h"
+#include "../alg/SketchHBE.h"
+#include "../alg/UniformHBE.h"
+#include "../alg/naiveKDE.h"
+#include "dataUtils.h"
+#include "expkernel.h"
+#include "gaussiankernel.h"
+#include "mathUtils.h"
+
+namespace py = pybind11;
+
+typedef py::array_t<double, py::array::c_style | py::array::forcecast> DoubleArray;
+
+///
+/// An estimator and the dimension of the data it was built on, to check queries against.
+///
+template <typename T>
+struct Bound {
+    shared_ptr<T> est;
+    int dim;
+};
+
+static shared_ptr<Kernel> makeKernel(const std::string& name, int dim) {
+    if (name == "gaussian") { return make_shared<Gaussiankernel>(dim); }
+    if (name == "exp") { return make_shared<Expkernel>(dim); }
+    throw std::invalid_argument("kernel must be \"gaussian\" or \"exp\"");
+}
+
+static void checkMatrix(const DoubleArray& X, const char* name) {
+    if (X.ndim() != 2 || X.shape(0) == 0) {
+        throw std::invalid_argument(std::string(name) + " must be a non-empty 2-d array");
+    }
+}
+
+///
+/// Copy an (n, d) array into the column-major matrix the estimators share. Does not need the GIL.
+static shared_ptr<MatrixXd> toMatrix(const double* data, ssize_t n, ssize_t d) {
+    auto X = make_shared<MatrixXd>(n, d);
+    *X = Eigen::Map<const RowMatrixXd>(data, n, d);
+    return X;
+}
+
+static shared_ptr<VectorXd> toWeights(const py::object& weights, ssize_t n) {
+    if (weights.is_none()) { return nullptr; }
+    DoubleArray w = DoubleArray::ensure(weights);
+    if (!w || w.ndim() != 1 || w.shape(0) != n) {
+        throw std::invalid_argument("weights must be a 1-d array with one weight per row");
+    }
+    return make_shared<VectorXd>(Eigen::Map<const VectorXd>(w.data(), n));
+}
+
+/// Answer a batch of queries in parallel, without the GIL.
+/// \param Q queries, one per row
+/// \param dim dimension the estimator was built for
+/// \param outputs number of arrays to return: estimates, then samples, then levels
+/// \param estimate answers one query; must be safe to call from several threads
+template <typename F>
+static py::object batch(const DoubleArray& Q, int dim, int outputs, F estimate) {
+    if (Q.ndim() != 2 || Q.shape(1) != dim) {
+        throw std::invalid_argument("queries must be a 2-d array with " + std::to_string(dim) + " columns");
+    }
+    ssize_t m = Q.shape(0);
+    vector<py::array_t<double>> out;
+    vector<double*> ptr;
+    for (int i = 0; i < outputs; i ++) {
+        out.push_back(py::array_t<double>(m));
+        ptr.push_back(out.back().mutable_data());
+    }
+    const double* q = Q.data();
+    {
+        py::gil_scoped_release release;
+#pragma omp parallel for schedule(dynamic, 16)
+        for (ssize_t j = 0; j < m; j ++) {
+            VectorXd v = Eigen::Map<const VectorXd>(q + j * dim, dim);
+            vector<double> r = estimate(v);
+            for (int i = 0; i < outputs; i ++) {
+                ptr[i][j] = r[i];
+            }
+        }
+    }
+    if (outputs == 1) { return out[0]; }
+    py::tuple result(outputs);
+    for (int i = 0; i < outputs; i ++) { result[i] = out[i]; }
+    return result;
+}
+
+/// Median of means over a fixed-size estimator, as in BatchBenchmark.
+/// \return estimate and number of samples
+template <typename T>
+static vector<double> medianOfMeans(T& hbe, const VectorXd& q, int L, int m) {
+    return vector<double>{hbe.estimate(q, L, m, nullptr), (double) L * m};
+}
+
+/// Threshold decision as returned to Python.
+/// \return 1 if above the threshold (else 0), estimate and number of samples
+static vector<double> decision(const ThresholdDecision& d) {
+    return vector<double>{(double) d.above, d.estimate, d.samples};
+}
+
+PYBIND11_MODULE(pyhbe, mod) {
+    mod.doc() = "Hashing-based kernel density estimators";
+
+    mod.def("hash_params", [](const DoubleArray& X, double tau, double beta) {
+        checkMatrix(X, "X");
+        auto data = toMatrix(X.data(), X.shape(0), X.shape(1));
+        double diam = dataUtils::estimateDiameter(data, tau);
+        int k = dataUtils::getPower(diam, beta);
+        return py::make_tuple(k, dataUtils::getWidth(k, beta));
+    }, "Number of hash functions k and bin width w for a dataset, as DataIngest::estimateHashParams",
+        py::arg("X"), py::arg("tau"), py::arg("beta") = 0.5);
+
+    py::class_<Bound<AdaptiveHBE>>(mod, "AdaptiveHBE", "Adaptive sampling via HBE")
+        .def(py::init([](const DoubleArray& X, double tau, double eps, const std::string& kernel, bool sketch,
+                         const py::object& weights, double memory_mb, int probes, double probe_gain,
+                         bool pyramid, bool lazy, bool prewarm) {
+            checkMatrix(X, "X");
+            HBEOptions opts;
+            opts.memoryBudget = size_t(memory_mb * 1e6);
+            opts.probes = probes;
+            opts.probeGain = probe_gain;
+            opts.pyramid = pyramid;
+            opts.lazy = lazy || prewarm;
+            opts.prewarm = prewarm;
+            opts.weights = toWeights(weights, X.shape(0));
+            int d = X.shape(1);
+            auto k = makeKernel(kernel, d);
+            const double* data = X.data();
+            ssize_t n = X.shape(0);
+            py::gil_scoped_release release;
+            auto est = make_shared<AdaptiveHBE>(toMatrix(data, n, d), k, tau, eps, sketch, opts);
+            return Bound<AdaptiveHBE>{est, d};
+        }), py::arg("X"), py::arg("tau"), py::arg("eps"), py::arg("kernel") = "gaussian", py::arg("sketch") = true,
+            py::arg("weights") = py::none(), py::arg("memory_mb") = 0, py::arg("probes") = 1,
+            py::arg("probe_gain") = 1.0, py::arg("pyramid") = false, py::arg("lazy") = false, py::arg("prewarm") = false)
+        .def("query", [](Bound<AdaptiveHBE>& self, const DoubleArray& Q) {
+            return batch(Q, self.dim, 3, [&](const VectorXd& q) { return self.est->estimate(q, nullptr); });
+        }, "Estimates, samples and stopping level of each query", py::arg("Q"))
+        .def("is_above", [](Bound<AdaptiveHBE>& self, const DoubleArray& Q, double t, double delta) {
+            return batch(Q, self.dim, 3, [&](const VectorXd& q) { return decision(self.est->isAbove(q, t, delta)); });
+        }, "Whether each query's density is at least t, stopping as soon as it is certain with probability "
+            "1 - delta: decisions (0/1), estimates and samples", py::arg("Q"), py::arg("t"), py::arg("delta") = 0.05)
+        .def("set_eps", [](Bound<AdaptiveHBE>& self, double eps) { self.est->setEps(eps); }, py::arg("eps"))
+        .def_property_readonly("levels", [](Bound<AdaptiveHBE>& self) { return self.est->levels(); })
+        .def_property_readonly("memory_bytes", [](Bound<AdaptiveHBE>& self) {
+            return self.est->memoryUsage().resident();
+        });
+
+    py::class_<Bound<AdaptiveRS>>(mod, "AdaptiveRS", "Adaptive sampling via random sampling")
+        .def(py::init([](const DoubleArray& X, double tau, double eps, const std::string& kernel,
+                         const py::object& weights) {
+            checkMatrix(X, "X");
+            auto W = toWeights(weights, X.shape(0));
+            int d = X.shape(1);
+            auto k = makeKernel(kernel, d);
+            const double* data = X.data();
+            ssize_t n = X.shape(0);
+            py::gil_scoped_release release;
+            auto est = make_shared<AdaptiveRS>(toMatrix(data, n, d), W, k, tau, eps);
+            return Bound<AdaptiveRS>{est, d};
+        }), py::arg("X"), py::arg("tau"), py::arg("eps"), py::arg("kernel") = "gaussian",
+            py::arg("weights") = py::none())
+        .def("query", [](Bound<AdaptiveRS>& self, const DoubleArray& Q) {
+            return batch(Q, self.dim, 3, [&](const VectorXd& q) { return self.est->estimate(q, nullptr); });
+        }, "Estimates, samples and stopping level of each query", py::arg("Q"))
+        .def("is_above", [](Bound<AdaptiveRS>& self, const DoubleArray& Q, double t, double delta) {
+            return batch(Q, self.dim, 3, [&](const VectorXd& q) { return decision(self.est->isAbove(q, t, delta)); });
+        }, "Whether each query's density is at least t, stopping as soon as it is certain with probability "
+            "1 - delta: decisions (0/1), estimates and samples", py::arg("Q"), py::arg("t"), py::arg("delta") = 0.05)
+        .def("set_eps", [](Bound<AdaptiveRS>& self, double eps) { self.est->setEps(eps); }, py::arg("eps"))
+        .def_property_readonly("levels", [](Bound<AdaptiveRS>& self) { return self.est->levels(); });
+
+    py::class_<Bound<UniformHBE>>(mod, "UniformHBE", "HBE with tables built on uniform samples")
+        .def(py::init([](const DoubleArray& X, int tables, double w, int k, const std::string& kernel,
+                         const py::object& weights, int subsample) {
+            checkMatrix(X, "X");
+            auto W = toWeights(weights, X.shape(0));
+            int d = X.shape(1);
+            auto ker = makeKernel(kernel, d);
+            const double* data = X.data();
+            ssize_t n = X.shape(0);
+            py::gil_scoped_release release;
+            auto est = make_shared<UniformHBE>(toMatrix(data, n, d), W, tables, w, k, ker, subsample);
+            return Bound<UniformHBE>{est, d};
+        }), py::arg("X"), py::arg("tables"), py::arg("w"), py::arg("k"), py::arg("kernel") = "gaussian",
+            py::arg("weights") = py::none(), py::arg("subsample") = 1)
+        .def("query", [](Bound<UniformHBE>& self, const DoubleArray& Q, int L, int m) {
+            return batch(Q, self.dim, 2, [&](const VectorXd& q) { return medianOfMeans(*self.est, q, L, m); });
+        }, "Median of L means of m samples for each query: estimates and samples",
+            py::arg("Q"), py::arg("L") = 3, py::arg("m") = 1)
+        .def("is_above", [](Bound<UniformHBE>& self, const DoubleArray& Q, double t, double delta, int m) {
+            return batch(Q, self.dim, 3, [&](const VectorXd& q) { return decision(self.est->isAbove(q, t, delta, m)); });
+        }, "Whether each query's density is at least t, drawing at most m samples: decisions (0/1), estimates "
+            "and samples", py::arg("Q"), py::arg("t"), py::arg("delta") = 0.05, py::arg("m") = 1000)
+        .def_property_readonly("memory_bytes", [](Bound<UniformHBE>& self) {
+            return self.est->memoryUsage().total();
+        });
+
+    py::class_<Bound<SketchHBE>>(mod, "SketchHBE", "HBE with tables built on HBS sketches")
+        .def(py::init([](const DoubleArray& X, int tables, double w, int k, const std::string& kernel) {
+            checkMatrix(X, "X");
+            int d = X.shape(1);
+            auto ker = makeKernel(kernel, d);
+            const double* data = X.data();
+            ssize_t n = X.shape(0);
+            py::gil_scoped_release release;
+            auto est = make_shared<SketchHBE>(toMatrix(data, n, d), tables, w, k, ker);
+            return Bound<SketchHBE>{est, d};
+        }), py::arg("X"), py::arg("tables"), py::arg("w"), py::arg("k"), py::arg("kernel") = "gaussian")
+        .def("query", [](Bound<SketchHBE>& self, const DoubleArray& Q, int L, int m) {
+            return batch(Q, self.dim, 2, [&](const VectorXd& q) { return medianOfMeans(*self.est, q, L, m); });
+        }, "Median of L means of m samples for each query: estimates and samples",
+            py::arg("Q"), py::arg("L") = 3, py::arg("m") = 1)
+        .def("is_above", [](Bound<SketchHBE>& self, const DoubleArray& Q, double t, double delta, int m) {
+            return batch(Q, self.dim, 3, [&](const VectorXd& q) { return decision(self.est->isAbove(q, t, delta, m)); });
+        }, "Whether each query's density is at least t, drawing at most m samples: decisions (0/1), estimates "
+            "and samples", py::arg("Q"), py::arg("t"), py::arg("delta") = 0.05, py::arg("m") = 1000)
+        .def_property_readonly("memory_bytes", [](Bound<SketchHBE>& self) {
+            return self.est->memoryUsage().total();
+        });
+
+    py::class_<Bound<naiveKDE>>(mod, "NaiveKDE", "Exact KDE")
+        .def(py::init([](const DoubleArray& X, const std::string& kernel, const py::object& weights) {
+            checkMatrix(X, "X");
+            auto W = toWeights(weights, X.shape(0));
+            int d = X.shape(1);
+            auto k = makeKernel(kernel, d);
+            const double* data = X.data();
+            ssize_t n = X.shape(0);
+            py::gil_scoped_release release;
+            auto est = make_shared<naiveKDE>(toMatrix(data, n, d), W, k);
+            return Bound<naiveKDE>{est, d};
+        }), py::arg("X"), py::arg("kernel") = "gaussian", py::arg("weights") = py::none())
+        .def("query", [](Bound<naiveKDE>& self, const DoubleArray& Q) {
+            return batch(Q, self.dim, 1, [&](const VectorXd& q) { return vector<double>{self.est->query(q)}; });
+        }, "Exact density of each query", py::arg("Q"));
+}
@@ -0,0 +1,156 @@
+#ifndef HBE_BINARYDATASET_H
+#define HBE_BINARYDATASET_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using Eigen::MatrixXd;
+
+///
+/// Binary dataset format, for instances too large for CSV:
+///     char[8]     magic "HBEDATA1"
+///     int64       number of rows
+///     int64       number of columns
+///     float32     values, one row after the other
+/// Values are stored in single precision, the precision dataUtils::readFile parses CSV fields with.
+///
+class BinaryDataset {
+public:
+    static constexpr int HEADER_BYTES = 24;
+
+    ///
+    /// \return whether the file starts with the magic of the binary format
+    static bool isBinary(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        char magic[8];
+        in.read(magic, 8);
+        return in && memcmp(magic, MAGIC, 8) == 0;
+    }
+
+    /// Read the header and leave the stream at the first value.
+    /// \param in stream at the start of a binary dataset
+    /// \param rows set to the number of rows
+    /// \param cols set to the number of columns
+    static void readHeader(std::istream& in, int64_t& rows, int64_t& cols) {
+        char magic[8];
+        in.read(magic, 8);
+        in.read((char*) &rows, sizeof(rows));
+        in.read((char*) &cols, sizeof(cols));
+        if (!in || memcmp(magic, MAGIC, 8) != 0 || rows < 0 || cols <= 0) {
+            throw std::runtime_error("Not a binary dataset");
+        }
+    }
+
+    /// \param path binary dataset
+    /// \param rows set to the number of rows
+    /// \param cols set to the number of columns
+    static void shape(const std::string& path, int64_t& rows, int64_t& cols) {
+        std::ifstream in(path, std::ios::binary);
+        readHeader(in, rows, cols);
+    }
+
+    /// Read rows [first, first + rows.rows()) of the open dataset, keeping columns startCol..endCol.
+    /// \param in stream positioned at row first
+    /// \param cols number of columns of the dataset
+    /// \param startCol first column to keep
+    /// \param rows filled with the values; its size sets how many rows are read
+    static void readRows(std::istream& in, int64_t cols, int startCol, MatrixXd& rows) {
+        std::vector<float> buffer(cols);
+        for (int i = 0; i < rows.rows(); i ++) {
+            in.read((char*) buffer.data(), cols * sizeof(float));
+            for (int j = 0; j < rows.cols(); j ++) {
+                rows(i, j) = buffer[startCol + j];
+            }
+        }
+        if (!in) {
+            throw std::runtime_error("Truncated binary dataset");
+        }
+    }
+
+    /// Read the first n rows of a binary dataset.
+    /// \param path dataset
+    /// \param n number of rows
+    /// \param startCol first column to read
+    /// \param endCol last column to read
+    static MatrixXd read(const std::string& path, long n, int startCol, int endCol) {
+        std::ifstream in(path, std::ios::binary);
+        int64_t rows, cols;
+        readHeader(in, rows, cols);
+        if (n > rows || endCol >= cols) {
+            throw std::runtime_error(path + " has " + std::to_string(rows) + " rows and "
+                    + std::to_string(cols) + " columns");
+        }
+        MatrixXd data(n, endCol - startCol + 1);
+        readRows(in, cols, startCol, data);
+        return data;
+    }
+
+private:
+    static constexpr const char* MAGIC = "HBEDATA1";
+
+    friend class BinaryDatasetWriter;
+};
+
+///
+/// Appends rows to a binary dataset; the row count in the header is written on close().
+///
+class BinaryDatasetWriter {
+public:
+    /// \param path file to create
+    /// \param cols number of columns
+    BinaryDatasetWriter(const std::string& path, int cols) : path(path), cols(cols) {
+        out.open(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path);
+        }
+        int64_t zero = 0;
+        int64_t c = cols;
+        out.write(BinaryDataset::MAGIC, 8);
+        out.write((const char*) &zero, sizeof(zero));
+        out.write((const char*) &c, sizeof(c));
+    }
+
+    ~BinaryDatasetWriter() {
+        try {
+            close();
+        } catch (...) {}
+    }
+
+    ///
+    /// \param data rows to append
+    void append(const MatrixXd& data) {
+        std::vector<float> buffer(data.size());
+        for (int i = 0; i < data.rows(); i ++) {
+            for (int j = 0; j < cols; j ++) {
+                buffer[(size_t) i * cols + j] = (float) data(i, j);
+            }
+        }
+        out.write((const char*) buffer.data(), buffer.size() * sizeof(float));
+        written += data.rows();
+    }
+
+    int64_t rows() const { return written; }
+
+    void close() {
+        if (!out.is_open()) { return; }
+        out.seekp(8);
+        out.write((const char*) &written, sizeof(written));
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Failed writing " + path);
+        }
+    }
+
+private:
+    std::string path;
+    int cols;
+    int64_t written = 0;
+    std::ofstream out;
+};
+
+#endif //HBE_BINARYDATASET_H
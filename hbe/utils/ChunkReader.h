@@ -0,0 +1,153 @@
+#ifndef HBE_CHUNKREADER_H
+#define HBE_CHUNKREADER_H
+
+#include <Eigen/Dense>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "BinaryDataset.h"
+
+using Eigen::MatrixXd;
+
+///
+/// Reads the rows of a CSV file or binary dataset (see BinaryDataset) in chunks of consecutive rows,
+/// so that datasets larger than memory can be streamed through an algorithm. Columns
+/// startCol..endCol are read, with empty CSV fields read as 0 and values parsed in single precision,
+/// as in dataUtils::readFile.
+///
+class ChunkReader {
+public:
+    ///
+    /// Index of the first row of the chunk returned by the last call to next()
+    ///
+    int offset = 0;
+
+    /// \param filename CSV file or binary dataset
+    /// \param ignoreHeader whether the first line of a CSV file is a header
+    /// \param n number of rows to read
+    /// \param startCol first column to read
+    /// \param endCol last column to read
+    /// \param chunkRows maximum number of rows per chunk
+    ChunkReader(std::string filename, bool ignoreHeader, int n, int startCol, int endCol, int chunkRows) :
+            filename(filename), ignoreHeader(ignoreHeader), n(n), startCol(startCol), endCol(endCol),
+            chunkRows(chunkRows) {
+        binary = BinaryDataset::isBinary(filename);
+        rewind();
+    }
+
+    int rows() const { return n; }
+    int cols() const { return endCol - startCol + 1; }
+
+    ///
+    /// Start over from the first row.
+    void rewind() {
+        in.close();
+        in.clear();
+        in.open(filename, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open " + filename);
+        }
+        if (binary) {
+            int64_t rows;
+            BinaryDataset::readHeader(in, rows, binaryCols);
+            if (n > rows || endCol >= binaryCols) {
+                throw std::runtime_error(filename + " has fewer rows or columns than requested");
+            }
+        } else if (ignoreHeader) {
+            std::getline(in, line);
+        }
+        read = 0;
+        offset = 0;
+    }
+
+    /// Move past rows without reading them: a seek in a binary dataset (or reading through the buffer
+    /// for short gaps), skipping lines without parsing them in a CSV file.
+    /// \param rows number of rows to skip
+    void skip(int rows) {
+        rows = std::min(rows, n - read);
+        if (rows <= 0) { return; }
+        read += rows;
+        offset = read;
+        if (binary) {
+            std::streamsize bytes = std::streamsize(rows) * binaryCols * sizeof(float);
+            if (bytes <= SEEK_BYTES) {
+                in.ignore(bytes);
+            } else {
+                in.seekg(BinaryDataset::HEADER_BYTES + std::streamoff(read) * binaryCols * sizeof(float));
+            }
+            return;
+        }
+        for (int i = 0; i < rows; i ++) {
+            if (!in.ignore(std::numeric_limits<std::streamsize>::max(), '\n')) {
+                throw std::runtime_error(filename + " has fewer than " + std::to_string(n) + " rows");
+            }
+        }
+    }
+
+    /// Read the next chunk of rows.
+    /// \param chunk filled with the next rows, at most chunkRows of them
+    /// \return false once all n rows have been read
+    bool next(MatrixXd& chunk) {
+        if (read >= n) { return false; }
+        int rows = std::min(chunkRows, n - read);
+        chunk.resize(rows, cols());
+        offset = read;
+        read += rows;
+        if (binary) {
+            BinaryDataset::readRows(in, binaryCols, startCol, chunk);
+            return true;
+        }
+        int i = 0;
+        while (i < rows && std::getline(in, line)) {
+            parseLine(chunk, i);
+            i ++;
+        }
+        if (i < rows) {
+            throw std::runtime_error(filename + " has fewer than " + std::to_string(n) + " rows");
+        }
+        return true;
+    }
+
+private:
+    ///
+    /// Gaps in a binary dataset up to this size are read through rather than seeked over, since a seek
+    /// drops the stream's buffer
+    ///
+    static const std::streamsize SEEK_BYTES = 1 << 16;
+
+    std::string filename;
+    bool ignoreHeader;
+    int n;
+    int startCol;
+    int endCol;
+    int chunkRows;
+    int read = 0;
+    bool binary = false;
+    int64_t binaryCols = 0;
+    std::ifstream in;
+    std::string line;
+
+    void parseLine(MatrixXd& chunk, int row) {
+        const char* p = line.c_str();
+        for (int j = 0; j <= endCol; j ++) {
+            const char* end = p;
+            while (*end != ',' && *end != '\0') { end ++; }
+            if (j >= startCol) {
+                chunk(row, j - startCol) = end == p ? 0 : strtof(p, nullptr);
+            }
+            if (*end == '\0') {
+                // Missing trailing columns read as 0
+                for (int k = j + 1; k <= endCol; k ++) {
+                    if (k >= startCol) { chunk(row, k - startCol) = 0; }
+                }
+                break;
+            }
+            p = end + 1;
+        }
+    }
+};
+
+#endif //HBE_CHUNKREADER_H
@@ -0,0 +1,128 @@
+#ifndef HBE_CORESET_H
+#define HBE_CORESET_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "kernel.h"
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+///
+/// A weighted sketch of a dataset that can be saved to and loaded from a compact binary file,
+/// so that the KDE can be evaluated on a few thousand points without the full dataset:
+///     KDE(q) ~= sum_i weights[i] * k((q - points[i]) / bandwidth)
+///
+/// File layout (little-endian, no padding):
+///     char[8]     magic "HBECSET1"
+///     char[16]    kernel name, zero padded
+///     int64       number of points m
+///     int64       dimension d
+///     int64       number of rows of the source dataset
+///     double[d]   bandwidth of each dimension
+///     int64[m]    row of the source dataset each point was sampled from
+///     double[m]   weights
+///     double[m*d] points in the units of the source dataset, one point after the other
+///
+class Coreset {
+public:
+    std::string kernel;
+    int64_t sourceRows = 0;
+    std::vector<double> bandwidth;
+    std::vector<int64_t> indices;
+    VectorXd weights;
+    MatrixXd points;
+
+    int size() const { return points.rows(); }
+    int dim() const { return points.cols(); }
+
+    ///
+    /// Approximate KDE at a query in the units of the source dataset.
+    /// \param k kernel of the type the coreset was built for, with unit bandwidth
+    /// \param q query
+    double density(Kernel& k, const VectorXd& q) const {
+        VectorXd delta(dim());
+        double est = 0;
+        for (int i = 0; i < size(); i ++) {
+            for (int j = 0; j < dim(); j ++) {
+                delta(j) = (q(j) - points(i, j)) / bandwidth[j];
+            }
+            est += weights(i) * k.density(delta);
+        }
+        return est;
+    }
+
+    void write(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path);
+        }
+        char name[16] = {0};
+        strncpy(name, kernel.c_str(), sizeof(name) - 1);
+        int64_t m = size();
+        int64_t d = dim();
+        out.write(MAGIC, 8);
+        out.write(name, sizeof(name));
+        out.write((const char*) &m, sizeof(m));
+        out.write((const char*) &d, sizeof(d));
+        out.write((const char*) &sourceRows, sizeof(sourceRows));
+        out.write((const char*) bandwidth.data(), d * sizeof(double));
+        out.write((const char*) indices.data(), m * sizeof(int64_t));
+        out.write((const char*) weights.data(), m * sizeof(double));
+        // Eigen is column-major: write point by point
+        for (int i = 0; i < m; i ++) {
+            VectorXd row = points.row(i);
+            out.write((const char*) row.data(), d * sizeof(double));
+        }
+        if (!out) {
+            throw std::runtime_error("Failed writing " + path);
+        }
+    }
+
+    static Coreset read(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        char magic[8];
+        in.read(magic, 8);
+        if (!in || memcmp(magic, MAGIC, 8) != 0) {
+            throw std::runtime_error(path + " is not a coreset file");
+        }
+        Coreset c;
+        char name[16];
+        int64_t m, d;
+        in.read(name, sizeof(name));
+        name[sizeof(name) - 1] = '\0';
+        c.kernel = name;
+        in.read((char*) &m, sizeof(m));
+        in.read((char*) &d, sizeof(d));
+        in.read((char*) &c.sourceRows, sizeof(c.sourceRows));
+        if (!in || m < 0 || d <= 0) {
+            throw std::runtime_error("Corrupt coreset header in " + path);
+        }
+        c.bandwidth.resize(d);
+        c.indices.resize(m);
+        c.weights.resize(m);
+        c.points.resize(m, d);
+        in.read((char*) c.bandwidth.data(), d * sizeof(double));
+        in.read((char*) c.indices.data(), m * sizeof(int64_t));
+        in.read((char*) c.weights.data(), m * sizeof(double));
+        VectorXd row(d);
+        for (int i = 0; i < m; i ++) {
+            in.read((char*) row.data(), d * sizeof(double));
+            c.points.row(i) = row;
+        }
+        if (!in) {
+            throw std::runtime_error("Truncated coreset file " + path);
+        }
+        return c;
+    }
+
+private:
+    static constexpr const char* MAGIC = "HBECSET1";
+};
+
+#endif //HBE_CORESET_H
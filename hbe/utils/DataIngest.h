@@ -12,7 +12,10 @@
 #include "mathUtils.h"
 #include "dataUtils.h"
 #include "bandwidth.h"
+#include "ChunkReader.h"
 #include <Eigen/Dense>
+#include <algorithm>
+#include <stdexcept>
 
 using Eigen::MatrixXd;
 
@@ -22,11 +25,33 @@ public:
     int N, M, dim, hasQuery, k;
     double tau, eps, beta, sample_ratio, h, diam, w;
     shared_ptr<MatrixXd> X_ptr, Y_ptr;
+    ///
+    /// Weights of the rows of X_ptr, or nullptr if every point has unit weight.
+    ///
+    shared_ptr<VectorXd> W_ptr;
+    ///
+    /// Source dataset as read, before duplicate compaction. Row indices in the exact
+    /// densities file refer to this matrix.
+    ///
+    shared_ptr<MatrixXd> Q_ptr;
     shared_ptr<Kernel> kernel;
+    ///
+    /// Bandwidth of each column, which the points are divided by
+    ///
+    std::vector<double> bandwidth;
+    ///
+    /// Column of the point weights in the data file, or -1 if every point has unit weight
+    ///
+    int weightCol = -1;
     bool sequential;
-    double *exact;
-
-    DataIngest(parseConfig cfg, bool read_exact) {
+    double *exact = nullptr;
+
+    /// \param cfg config
+    /// \param read_exact whether to read the exact densities file
+    /// \param read_data whether to read the dataset. If not (e.g. when shards read their own rows), X_ptr,
+    /// Q_ptr and W_ptr stay empty, and only the query rows of the dataset are read, so that getQuery()
+    /// still works given read_exact.
+    DataIngest(parseConfig cfg, bool read_exact, bool read_data = true) {
         try {
             eps = cfg.getEps();
         } catch (...) {
@@ -52,25 +77,12 @@ public:
         M = cfg.getM();
         sequential = (N == M);
 
-        // Read source dataset
-        MatrixXd X = dataUtils::readFile(
-                cfg.getDataFile(), cfg.ignoreHeader(), N, cfg.getStartCol(), cfg.getEndCol());
-
         // Read query dataset if it's a in a seperate file
         hasQuery = strcmp(cfg.getDataFile(), cfg.getQueryFile());
 
         // Get bandwidth
-        h = cfg.getH();
+        h = getBandwidth(cfg);
         const char* kernel_type = cfg.getKernel();
-        // If input bandwidth is not constant
-        if (!cfg.isConst()) {
-            // Scott's rule
-            h *= pow(N, -1.0 / (dim + 4));
-            // Gaussian Kernel:  1/(2h^2)
-            if (strcmp(kernel_type, "gaussian") == 0) {
-                h *= sqrt(2);
-            }
-        }
         std::cout << "bandwidth: " << h << std::endl;
         auto band = make_unique<Bandwidth>(N, dim);
         band->useConstant(h);
@@ -80,10 +92,44 @@ public:
             kernel = make_shared<Expkernel>(dim);
         }
 
-        // Normalized by bandwidth
-        // dataUtils::checkBandwidthSamples(X, eps, kernel);
-        X = dataUtils::normalizeBandwidth(X, band->bw);
-        X_ptr = make_shared<MatrixXd>(X);
+        bandwidth = band->bw;
+
+        // Optional per-point weights, e.g. for pre-aggregated records
+        try {
+            weightCol = cfg.getWeightCol();
+        } catch (...) {}
+
+        // Optional compaction of duplicate (dedup = 0) or near-duplicate (dedup > 0) points
+        double dedup = -1;
+        try {
+            dedup = cfg.getDedup();
+        } catch (...) {}
+        if (dedup >= 0 && !read_data) {
+            throw std::invalid_argument("dedup needs the whole dataset in memory");
+        }
+
+        if (read_data) {
+            // Read source dataset
+            MatrixXd X = dataUtils::readFile(
+                    cfg.getDataFile(), cfg.ignoreHeader(), N, cfg.getStartCol(), cfg.getEndCol());
+            // Normalized by bandwidth
+            // dataUtils::checkBandwidthSamples(X, eps, kernel);
+            X = dataUtils::normalizeBandwidth(X, band->bw);
+            X_ptr = make_shared<MatrixXd>(X);
+            Q_ptr = X_ptr;
+            if (weightCol >= 0) {
+                W_ptr = make_shared<VectorXd>(dataUtils::readFile(
+                        cfg.getDataFile(), cfg.ignoreHeader(), N, weightCol, weightCol).col(0));
+            }
+        }
+
+        if (dedup >= 0) {
+            VectorXd weights;
+            X_ptr = dataUtils::compact(*Q_ptr, W_ptr, dedup, weights);
+            W_ptr = make_shared<VectorXd>(weights);
+            N = X_ptr->rows();
+            std::cout << "compacted to " << N << " weighted points" << std::endl;
+        }
 
         if (hasQuery != 0) {
             MatrixXd Y = dataUtils::readFile(cfg.getQueryFile(), 
@@ -96,6 +142,37 @@ public:
             exact = new double[M * 2];
             dataUtils::readFile(cfg.getExactPath(), false, M, 0, 1, &exact[0]);
         }
+        if (!read_data && hasQuery == 0 && read_exact) {
+            Y_ptr = make_shared<MatrixXd>(readQueries(cfg));
+        }
+    }
+
+    ///
+    /// \return bandwidth for the config: h, scaled by Scott's rule unless the bandwidth is constant
+    static double getBandwidth(parseConfig& cfg) {
+        double h = cfg.getH();
+        // If input bandwidth is not constant
+        if (!cfg.isConst()) {
+            // Scott's rule
+            h *= pow(cfg.getN(), -1.0 / (cfg.getDim() + 4));
+            // Gaussian Kernel:  1/(2h^2)
+            if (strcmp(cfg.getKernel(), "gaussian") == 0) {
+                h *= sqrt(2);
+            }
+        }
+        return h;
+    }
+
+    ///
+    /// \param j query number
+    /// \return the j-th query point, whose exact density is exact[2 * j]
+    VectorXd getQuery(int j) {
+        if (Y_ptr != nullptr) {
+            return Y_ptr->row(j);
+        } else if (sequential) {
+            return Q_ptr->row(j);
+        }
+        return Q_ptr->row(int(exact[j * 2 + 1]));
     }
 
     void estimateHashParams() {
@@ -108,6 +185,35 @@ public:
         delete[] exact;
     }
 
+private:
+    ///
+    /// \return the query points getQuery() would take from the dataset, divided by the bandwidth, reading
+    /// only their rows
+    MatrixXd readQueries(parseConfig& cfg) {
+        vector<std::pair<int, int>> rows(M);
+        for (int j = 0; j < M; j ++) {
+            rows[j] = {sequential ? j : int(exact[j * 2 + 1]), j};
+        }
+        std::sort(rows.begin(), rows.end());
+        int n = M == 0 ? 0 : rows.back().first + 1;
+        ChunkReader reader(cfg.getDataFile(), cfg.ignoreHeader(), n, cfg.getStartCol(), cfg.getEndCol(), 1);
+        MatrixXd Y(M, reader.cols());
+        MatrixXd row;
+        int next = 0;
+        for (int j = 0; j < M; j ++) {
+            // Queries sharing a row copy it
+            if (j > 0 && rows[j].first == rows[j - 1].first) {
+                Y.row(rows[j].second) = Y.row(rows[j - 1].second);
+                continue;
+            }
+            reader.skip(rows[j].first - next);
+            reader.next(row);
+            Y.row(rows[j].second) = row.row(0);
+            next = rows[j].first + 1;
+        }
+        return dataUtils::normalizeBandwidth(Y, bandwidth);
+    }
+
 };
 
 
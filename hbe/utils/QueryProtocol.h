@@ -0,0 +1,77 @@
+#ifndef HBE_QUERYPROTOCOL_H
+#define HBE_QUERYPROTOCOL_H
+
+#include <cstdint>
+
+///
+/// Binary protocol of the KDE query server (main/QueryServer.cpp), in native byte order.
+///
+/// A client sends requests over a Unix domain socket and reads one response per request, in order:
+///     request:    RequestHeader, then count * dim doubles (the queries, one after the other,
+///                 in the units of the source dataset)
+///     response:   ResponseHeader, then count QueryResult if status is OK
+///
+/// A batch whose estimation fails (e.g. a shard worker died) is answered ERROR.
+///
+/// When the server already holds as many queries as it accepts, it answers BUSY immediately
+/// instead of queueing the request; the client should retry later.
+///
+class QueryProtocol {
+public:
+    static const uint32_t REQUEST_MAGIC = 0x51454248;   // "HBEQ"
+    static const uint32_t RESPONSE_MAGIC = 0x52454248;  // "HBER"
+
+    enum Status : uint32_t {
+        OK = 0,
+        ///
+        /// Too many queries pending: retry later
+        ///
+        BUSY = 1,
+        ///
+        /// Malformed request, wrong dimension or batch larger than the server ever accepts;
+        /// the server closes the connection after it
+        ///
+        BAD_REQUEST = 2,
+        ///
+        /// The estimator failed on a query of the batch; no results follow, and the connection stays open
+        ///
+        ERROR = 3
+    };
+
+    struct RequestHeader {
+        uint32_t magic;
+        ///
+        /// Number of queries in the batch
+        ///
+        uint32_t count;
+        uint32_t dim;
+        uint32_t reserved;
+    };
+
+    struct ResponseHeader {
+        uint32_t magic;
+        uint32_t status;
+        uint32_t count;
+        uint32_t reserved;
+        ///
+        /// Time from admitting the request to the last query of the batch finishing
+        ///
+        uint64_t serverNanos;
+        ///
+        /// Time the batch waited in the queue before its first query started
+        ///
+        uint64_t queueNanos;
+    };
+
+    struct QueryResult {
+        double estimate;
+        double samples;
+        double level;
+        ///
+        /// Time spent estimating this query
+        ///
+        double nanos;
+    };
+};
+
+#endif //HBE_QUERYPROTOCOL_H
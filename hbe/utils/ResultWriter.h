@@ -0,0 +1,121 @@
+#ifndef HBE_RESULTWRITER_H
+#define HBE_RESULTWRITER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+///
+/// Columnar binary result file, written by the benchmark mains with --output=<file> instead of
+/// one RESULT text line per query:
+///     char[8]     magic "HBERES01"
+///     int64       number of rows
+///     int64       number of columns
+///     int64       number of metadata entries
+///     per entry:  int64 length, key; int64 length, value (text)
+///     per column: int64 length, name; char type ('d' float64, 'q' int64)
+///     values      column after column, 8 bytes per row
+/// Integers and values are in native byte order. run_exp.py reads it with numpy.
+///
+class ResultWriter {
+public:
+    ///
+    /// \param path file written by write()
+    explicit ResultWriter(const std::string& path) : path(path) {}
+
+    /// Record a run parameter, e.g. eps or the build time.
+    /// \param key name
+    /// \param value anything std::ostream can print; doubles keep full precision
+    template <typename T>
+    void meta(const std::string& key, const T& value) {
+        std::ostringstream s;
+        s << std::setprecision(17) << value;
+        metadata.push_back(std::make_pair(key, s.str()));
+    }
+
+    /// \param name column name
+    /// \param values one value per row
+    void column(const std::string& name, const std::vector<double>& values) {
+        Column c = {name, 'd', values, {}};
+        add(c, values.size());
+    }
+
+    /// \param name column name
+    /// \param values one value per row
+    void column(const std::string& name, const std::vector<int64_t>& values) {
+        Column c = {name, 'q', {}, values};
+        add(c, values.size());
+    }
+
+    ///
+    /// Write the metadata and all columns.
+    void write() const {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path);
+        }
+        out.write(MAGIC, 8);
+        writeInt(out, std::max<int64_t>(rows, 0));
+        writeInt(out, columns.size());
+        writeInt(out, metadata.size());
+        for (auto& m : metadata) {
+            writeString(out, m.first);
+            writeString(out, m.second);
+        }
+        for (auto& c : columns) {
+            writeString(out, c.name);
+            out.put(c.type);
+        }
+        for (auto& c : columns) {
+            if (c.type == 'd') {
+                out.write((const char*) c.doubles.data(), rows * sizeof(double));
+            } else {
+                out.write((const char*) c.ints.data(), rows * sizeof(int64_t));
+            }
+        }
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path);
+        }
+    }
+
+private:
+    static constexpr const char* MAGIC = "HBERES01";
+
+    struct Column {
+        std::string name;
+        char type;
+        std::vector<double> doubles;
+        std::vector<int64_t> ints;
+    };
+
+    std::string path;
+    int64_t rows = -1;
+    std::vector<std::pair<std::string, std::string>> metadata;
+    std::vector<Column> columns;
+
+    void add(Column& c, size_t size) {
+        if (rows >= 0 && (int64_t) size != rows) {
+            throw std::invalid_argument("Column " + c.name + " has " + std::to_string(size) + " rows, expected "
+                    + std::to_string(rows));
+        }
+        rows = size;
+        columns.push_back(std::move(c));
+    }
+
+    static void writeInt(std::ostream& out, int64_t value) {
+        out.write((const char*) &value, sizeof(value));
+    }
+
+    static void writeString(std::ostream& out, const std::string& s) {
+        writeInt(out, s.size());
+        out.write(s.data(), s.size());
+    }
+};
+
+#endif //HBE_RESULTWRITER_H
@@ -0,0 +1,189 @@
+#ifndef HBE_RUNNINGSTATS_H
+#define HBE_RUNNINGSTATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "mathUtils.h"
+
+///
+/// Outcome of a threshold test (RunningStats::sequentialTest).
+///
+struct ThresholdDecision {
+    ///
+    /// Whether the density is judged to be at least the threshold
+    ///
+    bool above = false;
+    ///
+    /// Whether the confidence interval excludes the threshold; otherwise the decision compares the
+    /// estimate to the threshold after the whole sample budget
+    ///
+    bool certain = false;
+    double estimate = 0;
+    double samples = 0;
+    ///
+    /// Confidence interval at the last checkpoint
+    ///
+    double lower = 0;
+    double upper = 0;
+};
+
+///
+/// Running mean and variance of a stream of samples (Welford's algorithm).
+///
+class RunningStats {
+public:
+    void add(double x) {
+        n ++;
+        double d = x - m;
+        m += d / n;
+        s += d * (x - m);
+    }
+
+    long count() const { return n; }
+
+    double mean() const { return m; }
+
+    ///
+    /// \return empirical (biased) variance of the samples so far
+    double variance() const { return n > 0 ? s / n : 0; }
+
+    /// Empirical Bernstein bound (Audibert et al. 2009): for i.i.d. samples in [0, range], the true
+    /// mean is within this radius of mean() with probability at least 1 - delta.
+    /// \param range upper bound on a sample
+    /// \param delta failure probability
+    double bernstein(double range, double delta) const {
+        double l = log(3 / delta);
+        return sqrt(2 * variance() * l / n) + 3 * range * l / n;
+    }
+
+    /// Chernoff-Hoeffding interval: for i.i.d. samples in [0, range], the true mean lies in
+    /// [lower, upper] with probability at least 1 - delta, where n kl(mean() / range, x / range) = log(2 / delta)
+    /// at both ends (kl: Bernoulli relative entropy). Tighter than bernstein() for means far below the range.
+    /// \param range upper bound on a sample
+    /// \param delta failure probability
+    /// \return lower and upper end of the interval
+    std::pair<double, double> chernoff(double range, double delta) const {
+        double p = std::min(1.0, std::max(0.0, m / range));
+        double l = log(2 / delta) / n;
+        auto kl = [p](double x) {
+            double a = p > 0 ? p * log(p / x) : 0;
+            double b = p < 1 ? (1 - p) * log((1 - p) / (1 - x)) : 0;
+            return a + b;
+        };
+        // kl(p, x) is increasing in |x - p|: bisect on each side
+        double lo = 0, hi = p;
+        for (int i = 0; i < 50 && p > 0; i ++) {
+            double mid = (lo + hi) / 2;
+            (kl(mid) > l ? lo : hi) = mid;
+        }
+        double lower = hi;
+        lo = p, hi = 1;
+        for (int i = 0; i < 50 && p < 1; i ++) {
+            double mid = (lo + hi) / 2;
+            (kl(mid) > l ? hi : lo) = mid;
+        }
+        return std::make_pair(lower * range, lo * range);
+    }
+
+    /// Sequential replacement for a median of L means of m samples (EBStop, Mnih et al. 2008).
+    /// Samples are drawn one at a time; at geometrically spaced checkpoints, the empirical Bernstein
+    /// bound with failure probability delta / (t(t+1)) at the t-th checkpoint narrows an interval
+    /// [lb, ub] holding the mean. Sampling stops as soon as either
+    ///     - (1 + eps) lb >= (1 - eps) ub: the midpoint is a (1 +- eps)-approximation, or
+    ///     - ub < target: the mean is certainly below the level's target density,
+    /// each with probability at least 1 - delta. Otherwise, after L * m samples, return the median of
+    /// the L means of m consecutive samples, exactly as the fixed-size estimator.
+    /// \param sample draws the next sample
+    /// \param L median of L means
+    /// \param m means of m samples
+    /// \param target density below which the estimate only has to be known to be below it
+    /// \param eps relative error
+    /// \param delta failure probability
+    /// \param range upper bound on a sample
+    /// \return estimate and number of samples drawn
+    template <typename F>
+    static std::vector<double> sequentialMoM(F sample, int L, int m, double target, double eps, double delta,
+            double range) {
+        const long total = (long) L * m;
+        // Checkpoints at 16 samples, then every time the sample count grew by half
+        const long first = 16;
+        const double growth = 1.5;
+        RunningStats stats;
+        std::vector<double> Z(L, 0);
+        double lb = 0;
+        double ub = std::numeric_limits<double>::infinity();
+        long next = std::min(total, first);
+        int t = 0;
+        for (long i = 0; i < total; i ++) {
+            double x = sample();
+            stats.add(x);
+            Z[i / m] += x;
+            if (i + 1 < next || i + 1 == total) { continue; }
+
+            t ++;
+            double radius = stats.bernstein(range, delta / t / (t + 1));
+            lb = std::max(lb, stats.mean() - radius);
+            ub = std::min(ub, stats.mean() + radius);
+            if ((1 + eps) * lb >= (1 - eps) * ub) {
+                return std::vector<double>{((1 + eps) * lb + (1 - eps) * ub) / 2, (double) i + 1};
+            }
+            if (ub < target) {
+                return std::vector<double>{stats.mean(), (double) i + 1};
+            }
+            next = std::min(total, (long) ceil(next * growth));
+        }
+        return std::vector<double>{mathUtils::median(Z) / m, (double) total};
+    }
+
+    /// Sequential test of whether the mean of the samples is at least a threshold. Samples are drawn
+    /// one at a time and checked at the same checkpoints as sequentialMoM, with failure probability
+    /// delta / (t(t+1)) at the t-th one. Sampling stops as soon as the interval lies entirely above or
+    /// below the threshold, so that queries far from it only need a few samples; the decision is then
+    /// wrong with probability at most delta. Otherwise, after maxSamples samples, the mean decides.
+    /// \param sample draws the next sample
+    /// \param maxSamples sample budget
+    /// \param threshold threshold on the mean
+    /// \param delta failure probability
+    /// \param range upper bound on a sample
+    template <typename F>
+    static ThresholdDecision sequentialTest(F sample, long maxSamples, double threshold, double delta,
+            double range) {
+        const long first = 16;
+        const double growth = 1.5;
+        RunningStats stats;
+        ThresholdDecision d;
+        d.upper = range;
+        long next = std::min(maxSamples, first);
+        int t = 0;
+        for (long i = 0; i < maxSamples; i ++) {
+            stats.add(sample());
+            if (i + 1 < next) { continue; }
+
+            // Intersect the Bernstein and Chernoff intervals, each failing with half the probability
+            t ++;
+            double radius = stats.bernstein(range, delta / t / (t + 1) / 2);
+            std::pair<double, double> kl = stats.chernoff(range, delta / t / (t + 1) / 2);
+            d.lower = std::max(d.lower, std::max(stats.mean() - radius, kl.first));
+            d.upper = std::min(d.upper, std::min(stats.mean() + radius, kl.second));
+            if (d.lower >= threshold || d.upper < threshold) {
+                d.certain = true;
+                break;
+            }
+            next = std::min(maxSamples, (long) ceil(next * growth));
+        }
+        d.estimate = stats.mean();
+        d.samples = stats.count();
+        d.above = d.certain ? d.lower >= threshold : d.estimate >= threshold;
+        return d;
+    }
+
+private:
+    long n = 0;
+    double m = 0;
+    double s = 0;
+};
+
+#endif //HBE_RUNNINGSTATS_H
@@ -0,0 +1,93 @@
+#ifndef HBE_SOCKETIO_H
+#define HBE_SOCKETIO_H
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+///
+/// Blocking I/O on stream sockets, for the workers of ShardedEstimator and the query server.
+///
+class SocketIO {
+public:
+    ///
+    /// Write the whole buffer, retrying partial writes. Never raises SIGPIPE.
+    /// \return false if the peer is gone
+    static bool writeAll(int fd, const void* buf, size_t len) {
+        const char* p = (const char*) buf;
+        while (len > 0) {
+            ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0) { return false; }
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    ///
+    /// Read exactly len bytes.
+    /// \return false on end of stream or error
+    static bool readAll(int fd, void* buf, size_t len) {
+        char* p = (char*) buf;
+        while (len > 0) {
+            ssize_t n = read(fd, p, len);
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0) { return false; }
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    /// Listen on a Unix domain socket, replacing a stale socket file.
+    /// \param path socket path
+    /// \param backlog pending connections the kernel queues
+    /// \return listening socket
+    static int listenUnix(const std::string& path, int backlog) {
+        sockaddr_un addr = address(path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            throw std::runtime_error("socket failed");
+        }
+        unlink(path.c_str());
+        if (bind(fd, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot listen on " + path + ": " + strerror(errno));
+        }
+        return fd;
+    }
+
+    /// \param path socket path
+    /// \return socket connected to the server listening on path
+    static int connectUnix(const std::string& path) {
+        sockaddr_un addr = address(path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            throw std::runtime_error("socket failed");
+        }
+        if (connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot connect to " + path + ": " + strerror(errno));
+        }
+        return fd;
+    }
+
+private:
+    static sockaddr_un address(const std::string& path) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Socket path too long: " + path);
+        }
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+};
+
+#endif //HBE_SOCKETIO_H
@@ -3,10 +3,14 @@
 
 
 
+#include "BinaryDataset.h"
 #include "CSVparser.h"
 #include "kernel.h"
 #include "math.h"
 #include <Eigen/Dense>
+#include <cstring>
+#include <unordered_map>
+#include <boost/functional/hash.hpp>
 
 using namespace parser::csv;
 using Eigen::MatrixXd;
@@ -109,6 +113,9 @@ public:
     }
 
     static MatrixXd readFile(std::string filename, bool ignoreHeader, int n, int startCol, int endCol) {
+        if (BinaryDataset::isBinary(filename)) {
+            return BinaryDataset::read(filename, n, startCol, endCol);
+        }
         std::ifstream f(filename);
         CsvParser parser(f);
 
@@ -211,6 +218,80 @@ public:
         return X_sample;
     }
 
+    /// Draw rows with replacement, with probability proportional to their weights.
+    /// The sample is an unweighted sample of the weighted dataset.
+    /// \param data dataset
+    /// \param cdf prefix sums of the row weights (see mathUtils::cumulative)
+    /// \param indices filled with the sampled row indices, sorted
+    /// \param samples number of rows to draw
+    /// \param rng random number generator
+    static shared_ptr<MatrixXd> downSample(shared_ptr<MatrixXd> data, const vector<double>& cdf,
+            vector<int>& indices, int samples, std::mt19937_64 &rng) {
+        indices.clear();
+        for (int k = 0; k < samples; k ++) { indices.push_back(mathUtils::sampleCumulative(cdf, rng)); }
+        std::sort(indices.begin(), indices.end());
+
+        shared_ptr<MatrixXd> X_sample = make_shared<MatrixXd>(samples, data->cols());
+        for (int k = 0; k < samples; k ++) {
+            X_sample->row(k) = data->row(indices[k]);
+        }
+        return X_sample;
+    }
+
+    /// Collapse duplicate rows into weighted rows.
+    /// With resolution 0, only identical rows are merged. Otherwise rows that fall into the same
+    /// grid cell of side resolution are merged into their weighted mean, which moves each point
+    /// by at most resolution * sqrt(d).
+    /// \param X dataset
+    /// \param weights weights of the rows of X, or nullptr for unit weights
+    /// \param resolution grid cell side, in the units of X
+    /// \param merged filled with the weight of each row of the result
+    /// \return one row per distinct point (or grid cell), in order of first occurrence
+    static shared_ptr<MatrixXd> compact(const MatrixXd& X, shared_ptr<VectorXd> weights, double resolution,
+            VectorXd& merged) {
+        int n = X.rows();
+        int d = X.cols();
+        // Exact duplicates are keyed by their bit patterns, near duplicates by their grid cell
+        std::unordered_map<vector<long>, int, boost::hash<vector<long>>> cells;
+        vector<int> owner(n);
+        vector<double> mass;
+        for (int i = 0; i < n; i ++) {
+            vector<long> key(d);
+            for (int j = 0; j < d; j ++) {
+                double v = X(i, j);
+                if (resolution > 0) {
+                    key[j] = (long) floor(v / resolution);
+                } else {
+                    // Normalize -0.0 so that it matches 0.0
+                    v = (v == 0) ? 0 : v;
+                    memcpy(&key[j], &v, sizeof(double));
+                }
+            }
+            auto it = cells.find(key);
+            if (it == cells.end()) {
+                owner[i] = mass.size();
+                cells[key] = mass.size();
+                mass.push_back(0);
+            } else {
+                owner[i] = it->second;
+            }
+            mass[owner[i]] += (weights == nullptr) ? 1 : (*weights)(i);
+        }
+
+        int m = mass.size();
+        shared_ptr<MatrixXd> Y = make_shared<MatrixXd>(MatrixXd::Zero(m, d));
+        for (int i = 0; i < n; i ++) {
+            if (resolution > 0) {
+                double wi = (weights == nullptr) ? 1 : (*weights)(i);
+                Y->row(owner[i]) += X.row(i) * (wi / mass[owner[i]]);
+            } else {
+                Y->row(owner[i]) = X.row(i);
+            }
+        }
+        merged = Eigen::Map<VectorXd>(mass.data(), m);
+        return Y;
+    }
+
     static double getAvg(vector<double>& results) {
         double sum = 0;
         for (auto& n : results) { sum += n; }
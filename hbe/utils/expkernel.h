@@ -35,6 +35,7 @@ public:
     }
 
     double density(double dist) { return exp(-dist); }
+    void densityFromSquared(Eigen::ArrayXd& sq) { sq = dimFactor * bwFactor * (-sq.sqrt()).exp(); }
     double invDensity(double p) { return -log(p); }
 
     bool shouldReject(double weight, double prob, double prob_mu, double log_mu, double delta) {
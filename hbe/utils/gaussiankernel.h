@@ -36,6 +36,7 @@ public:
     }
 
     double density(double dist) { return exp(-dist * dist); }
+    void densityFromSquared(Eigen::ArrayXd& sq) { sq = dimFactor * bwFactor * (-sq).exp(); }
     double invDensity(double p) { return sqrt(-log(p)); }
 
     bool shouldReject(double weight, double prob, double prob_mu, double log_mu, double delta) {
@@ -38,6 +38,12 @@ public:
     virtual double density(double dist) = 0;
     virtual double invDensity(double p) = 0;
 
+    ///
+    /// Batched density: replace each squared distance, already scaled by the inverse bandwidth,
+    /// with the kernel value at that distance.
+    /// \param sq squared distances
+    virtual void densityFromSquared(Eigen::ArrayXd& sq) = 0;
+
     double density(const VectorXd& p, const VectorXd& q) {
         return density(p - q);
     }
@@ -3,6 +3,7 @@
 
 
 #include <Eigen/Dense>
+#include <algorithm>
 #include <math.h>
 #include <iostream>
 #include <random>
@@ -12,6 +13,11 @@
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
+///
+/// Points stored one per row, for algorithms that scan the data point by point
+///
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXd;
+
 const double SQRT_2PI = sqrt(2.0 / M_PI);
 
 const double a1 =  0.254829592;
@@ -57,6 +63,19 @@ public:
         return prob;
     }
 
+    static double normalCdf(double x) { return 0.5 * std::erfc(-x / M_SQRT2); }
+
+    ///
+    /// Probability that a point at normalized distance c from the query falls m cells away from
+    /// the query along one hash coordinate, given that the query projects f below its cell's upper boundary.
+    /// \param f ceil(u) - u, where u is the query's projection
+    /// \param m cell offset
+    /// \param c distance / bin width
+    ///
+    static double cellProb(double f, int m, double c) {
+        return normalCdf((f + m) / c) - normalCdf((f + m - 1) / c);
+    }
+
     static double collisionProb(double dist, double w, double k) {
         // Normalized distance
         double c = dist / w;
@@ -75,6 +94,38 @@ public:
         return median;
     }
 
+    ///
+    /// Random number generator owned by the calling thread, so that concurrent queries
+    /// do not share (or race on) an engine. Seeded once per thread.
+    ///
+    static std::mt19937_64& threadRng() {
+        thread_local std::mt19937_64 rng{std::random_device{}()};
+        return rng;
+    }
+
+    ///
+    /// Prefix sums of the weights, for drawing indices with probability proportional to weight.
+    ///
+    static std::vector<double> cumulative(const VectorXd& weights) {
+        std::vector<double> cdf(weights.size());
+        double sum = 0;
+        for (int i = 0; i < weights.size(); i ++) {
+            sum += weights(i);
+            cdf[i] = sum;
+        }
+        return cdf;
+    }
+
+    ///
+    /// Draw an index with probability proportional to its weight.
+    /// \param cdf prefix sums of the weights (see cumulative())
+    ///
+    static int sampleCumulative(const std::vector<double>& cdf, std::mt19937_64 &rng) {
+        double u = std::uniform_real_distribution<double>(0, cdf.back())(rng);
+        int idx = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return std::min(idx, int(cdf.size()) - 1);
+    }
+
     static VectorXd randNormal(int n, std::mt19937_64 &rng) {
         VectorXd r(n);
         std::normal_distribution<double> normal(0.0, 1.0);
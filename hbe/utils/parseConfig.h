@@ -4,6 +4,9 @@
 #include <config4cpp/Configuration.h>
 #include <exception>
 #include <math.h>
+#include <sstream>
+#include <string>
+#include <vector>
 using namespace config4cpp;
 
 class parseConfig {
@@ -84,6 +87,26 @@ public:
         return cfg->lookupString(scope, "name");
     }
 
+    int getWeightCol() {
+        return cfg->lookupInt(scope, "weight_col");
+    }
+
+    double getDedup() {
+        return cfg->lookupFloat(scope, "dedup");
+    }
+
+    ///
+    /// \return comma separated numbers, e.g. hash_k = "12,15,18" as written by hbe_tune
+    std::vector<double> getList(const char* name) {
+        std::vector<double> values;
+        std::stringstream ss(cfg->lookupString(scope, name));
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            values.push_back(atof(item.c_str()));
+        }
+        return values;
+    }
+
 };
 
 
@@ -1,9 +1,10 @@
 from itertools import product
 import yaml
 import os
+import struct
 import sys
 import subprocess
-import re
+import tempfile
 import h5py
 import numpy
 
@@ -13,35 +14,64 @@ def get_result_fn(dataset, algorithm, eps, mu):
         os.makedirs(dir_name)
     return os.path.join(dir_name, f"{eps}.hdf5")
 
-def invoke(dataset, algorithm, eps):
+def invoke(dataset, algorithm, eps, output):
     if algorithm == "hbe":
-        return f'{sys.argv[2]} resources/data/{dataset}.conf gaussian {eps}'
+        return f'{sys.argv[2]} resources/data/{dataset}.conf gaussian {eps} --output={output}'
     if algorithm == 'rs':
-        return f'{sys.argv[2]} resources/data/{dataset}.conf gaussian {eps} true'
+        return f'{sys.argv[2]} resources/data/{dataset}.conf gaussian {eps} true --output={output}'
     print(f'Cannot invoke {algorithm}')
 
-def write_result(result, ds, algorithm, eps, mu):
+def read_results(fn):
+    """Read a result file written with --output (format in hbe/utils/ResultWriter.h).
+
+    Returns the run metadata as a dict of strings and the columns as a dict of numpy arrays."""
+    with open(fn, 'rb') as f:
+        buf = f.read()
+    if buf[:8] != b'HBERES01':
+        raise ValueError(f'{fn} is not a result file')
+    rows, ncols, nmeta = struct.unpack_from('=qqq', buf, 8)
+    pos = 32
+
+    def string():
+        nonlocal pos
+        (n,) = struct.unpack_from('=q', buf, pos)
+        s = buf[pos + 8:pos + 8 + n].decode('utf-8')
+        pos += 8 + n
+        return s
+
+    meta = {}
+    for _ in range(nmeta):
+        key = string()
+        meta[key] = string()
+    names = []
+    for _ in range(ncols):
+        names.append((string(), chr(buf[pos])))
+        pos += 1
+    columns = {}
+    for name, kind in names:
+        columns[name] = numpy.frombuffer(buf, dtype='=f8' if kind == 'd' else '=i8', count=rows, offset=pos)
+        pos += 8 * rows
+    return meta, columns
+
+def write_result(output, ds, algorithm, eps, mu):
     fn = get_result_fn(ds, algorithm, eps, mu)
-    regex = r"RESULT id=(\d+) err=(\d+.\d+) samples=(\d+) time=(\d+.\d+)"
-    ids = []
-    errs = []
-    samples = []
-    times = []
-    for line in result.split("\n"):
-        if m := re.match(regex, line):
-            ids.append(int(m.group(1)))
-            errs.append(float(m.group(2)))
-            samples.append(int(m.group(3)))
-            times.append(float(m.group(4)))
+    meta, columns = read_results(output)
+    exact = columns['exact']
+    errs = numpy.abs(columns['estimate'] - exact) / numpy.maximum(float(meta['tau']), exact)
     f = h5py.File(fn, 'w')
     f.attrs['dataset'] = ds
     f.attrs['algorithm'] = algorithm
     f.attrs['params'] = f'eps={eps}'
     f.attrs['mu'] = mu
-    f.create_dataset('ids', data=numpy.array(ids))
-    f.create_dataset('errors', data=numpy.array(errs))
-    f.create_dataset('samples', data=numpy.array(samples))
-    f.create_dataset('times', data=numpy.array(times))
+    for key, value in meta.items():
+        f.attrs['run_' + key] = value
+    f.create_dataset('ids', data=columns['id'])
+    f.create_dataset('errors', data=errs)
+    f.create_dataset('estimates', data=columns['estimate'])
+    f.create_dataset('samples', data=columns['samples'])
+    f.create_dataset('levels', data=columns['level'])
+    # milliseconds, as the RESULT lines report
+    f.create_dataset('times', data=columns['nanos'] / 1e6)
     f.close()
 
 
@@ -60,9 +90,12 @@ if __name__ == "__main__":
             if not os.path.exists(get_result_fn(ds, algorithm, eps, mu))]
     for ds, eps, algorithm in exps:
         print(f'Running {algorithm} on {ds} with eps={eps}')
-        print(invoke(ds, algorithm, eps))
-        result = subprocess.run(invoke(ds, algorithm, eps).split(), stdout=subprocess.PIPE,stderr=subprocess.PIPE)
-        write_result(result.stdout.decode('utf-8').strip(), ds, algorithm, eps, mu)
+        with tempfile.TemporaryDirectory() as tmp:
+            output = os.path.join(tmp, 'result.bin')
+            print(invoke(ds, algorithm, eps, output))
+            subprocess.run(invoke(ds, algorithm, eps, output).split(), stdout=subprocess.PIPE,
+                           stderr=subprocess.PIPE, check=True)
+            write_result(output, ds, algorithm, eps, mu)
 
 
 